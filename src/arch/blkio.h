@@ -0,0 +1,30 @@
+/*
+ * Copyright (c) 2008 Martin Decky
+ * All rights reserved.
+ *
+ * Distributed under the terms of GPL.
+ *
+ */
+
+#ifndef BLKIO_H_
+#define BLKIO_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Host file accessed by asynchronous block requests
+ *
+ * At most one request can be in progress at a time.
+ *
+ */
+typedef struct blkio blkio_t;
+
+extern blkio_t *blkio_open(const char *path, uint64_t *size);
+extern void blkio_close(blkio_t *bio);
+extern void blkio_submit(blkio_t *bio, bool write, void *buf, size_t size,
+    uint64_t offset);
+extern bool blkio_done(blkio_t *bio, bool *ok);
+extern bool blkio_wait(blkio_t *bio);
+
+#endif
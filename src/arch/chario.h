@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) 2008 Martin Decky
+ * All rights reserved.
+ *
+ * Distributed under the terms of GPL.
+ *
+ */
+
+#ifndef CHARIO_H_
+#define CHARIO_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Size of the transmit and receive buffers */
+#define CHARIO_RING_SIZE  4096
+
+/** Host character stream
+ *
+ * The characters are buffered in both directions and
+ * transferred to the host by a worker thread.
+ *
+ */
+typedef struct chario chario_t;
+
+extern chario_t *chario_open(int fd, bool readable);
+extern void chario_close(chario_t *cio);
+extern bool chario_putc(chario_t *cio, char c);
+extern bool chario_getc(chario_t *cio, char *c);
+extern size_t chario_rx_count(chario_t *cio);
+extern size_t chario_tx_count(chario_t *cio);
+extern bool chario_hangup(chario_t *cio);
+extern uint64_t chario_dropped(chario_t *cio);
+
+#endif
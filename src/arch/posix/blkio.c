@@ -0,0 +1,266 @@
+/*
+ * Copyright (c) 2008 Martin Decky
+ * All rights reserved.
+ *
+ * Distributed under the terms of GPL.
+ *
+ */
+
+#include "../blkio.h"
+
+#ifndef __WIN32__
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "../../../config.h"
+#include "../../utils.h"
+
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#endif
+
+struct blkio {
+	int fd;
+	
+	/* Current request */
+	bool write;
+	void *buf;
+	size_t size;
+	uint64_t offset;
+	
+	bool done;  /**< Request finished */
+	bool ok;    /**< Request succeeded */
+	
+#ifdef HAVE_LIBPTHREAD
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	
+	/** Signalled on a new request and on its completion,
+	    the worker and the waiters share it */
+	pthread_cond_t cond;
+	
+	bool pending;  /**< Request waiting for the worker */
+	bool quit;     /**< Worker should terminate */
+#endif
+};
+
+/** Perform the current request
+ *
+ * @return True if all the data have been transferred.
+ *
+ */
+static bool blkio_transfer(blkio_t *bio)
+{
+	unsigned char *buf = (unsigned char *) bio->buf;
+	size_t left = bio->size;
+	off_t offset = (off_t) bio->offset;
+	
+	while (left > 0) {
+		ssize_t res;
+		
+		if (bio->write)
+			res = pwrite(bio->fd, buf, left, offset);
+		else
+			res = pread(bio->fd, buf, left, offset);
+		
+		if (res <= 0)
+			return false;
+		
+		buf += res;
+		left -= res;
+		offset += res;
+	}
+	
+	return true;
+}
+
+#ifdef HAVE_LIBPTHREAD
+
+/** Worker thread serving the requests
+ *
+ */
+static void *blkio_worker(void *arg)
+{
+	blkio_t *bio = (blkio_t *) arg;
+	
+	pthread_mutex_lock(&bio->mutex);
+	
+	while (true) {
+		while ((!bio->pending) && (!bio->quit))
+			pthread_cond_wait(&bio->cond, &bio->mutex);
+		
+		if (bio->pending) {
+			bio->pending = false;
+			pthread_mutex_unlock(&bio->mutex);
+			
+			bool ok = blkio_transfer(bio);
+			
+			pthread_mutex_lock(&bio->mutex);
+			bio->ok = ok;
+			bio->done = true;
+			pthread_cond_broadcast(&bio->cond);
+			continue;
+		}
+		
+		break;
+	}
+	
+	pthread_mutex_unlock(&bio->mutex);
+	return NULL;
+}
+
+#endif
+
+/** Open a host file for block requests
+ *
+ * @param path Path to the file.
+ * @param size Size of the file is returned through this parameter.
+ *
+ * @return Block I/O structure or NULL on failure (errno is set).
+ *
+ */
+blkio_t *blkio_open(const char *path, uint64_t *size)
+{
+	int fd = open(path, O_RDWR);
+	if (fd == -1)
+		return NULL;
+	
+	struct stat st;
+	if (fstat(fd, &st) == -1) {
+		close(fd);
+		return NULL;
+	}
+	
+	blkio_t *bio = safe_malloc_t(blkio_t);
+	bio->fd = fd;
+	bio->done = false;
+	bio->ok = false;
+	
+#ifdef HAVE_LIBPTHREAD
+	bio->pending = false;
+	bio->quit = false;
+	pthread_mutex_init(&bio->mutex, NULL);
+	pthread_cond_init(&bio->cond, NULL);
+	
+	if (pthread_create(&bio->thread, NULL, blkio_worker, bio) != 0) {
+		pthread_cond_destroy(&bio->cond);
+		pthread_mutex_destroy(&bio->mutex);
+		close(fd);
+		safe_free(bio);
+		return NULL;
+	}
+#endif
+	
+	*size = (uint64_t) st.st_size;
+	return bio;
+}
+
+/** Close the file
+ *
+ * Waits for the request in progress.
+ *
+ */
+void blkio_close(blkio_t *bio)
+{
+#ifdef HAVE_LIBPTHREAD
+	pthread_mutex_lock(&bio->mutex);
+	bio->quit = true;
+	pthread_cond_broadcast(&bio->cond);
+	pthread_mutex_unlock(&bio->mutex);
+	
+	pthread_join(bio->thread, NULL);
+	pthread_cond_destroy(&bio->cond);
+	pthread_mutex_destroy(&bio->mutex);
+#endif
+	
+	close(bio->fd);
+	safe_free(bio);
+}
+
+/** Submit a request
+ *
+ * The buffer must not be touched until the request is done.
+ *
+ */
+void blkio_submit(blkio_t *bio, bool write, void *buf, size_t size,
+    uint64_t offset)
+{
+	bio->write = write;
+	bio->buf = buf;
+	bio->size = size;
+	bio->offset = offset;
+	
+#ifdef HAVE_LIBPTHREAD
+	pthread_mutex_lock(&bio->mutex);
+	bio->done = false;
+	bio->pending = true;
+	pthread_cond_broadcast(&bio->cond);
+	pthread_mutex_unlock(&bio->mutex);
+#else
+	bio->ok = blkio_transfer(bio);
+	bio->done = true;
+#endif
+}
+
+/** Check whether the request is done
+ *
+ * @param ok Result of the request is returned through this parameter.
+ *
+ * @return True if the request has finished.
+ *
+ */
+bool blkio_done(blkio_t *bio, bool *ok)
+{
+	bool done;
+	
+#ifdef HAVE_LIBPTHREAD
+	pthread_mutex_lock(&bio->mutex);
+#endif
+	
+	done = bio->done;
+	if (done) {
+		bio->done = false;
+		*ok = bio->ok;
+	}
+	
+#ifdef HAVE_LIBPTHREAD
+	pthread_mutex_unlock(&bio->mutex);
+#endif
+	
+	return done;
+}
+
+
+/** Wait for the submitted request to finish
+ *
+ * Blocks until the worker finishes the request.
+ * A request must have been submitted.
+ *
+ * @return True if the request has succeeded.
+ *
+ */
+bool blkio_wait(blkio_t *bio)
+{
+	bool ok;
+	
+#ifdef HAVE_LIBPTHREAD
+	pthread_mutex_lock(&bio->mutex);
+	
+	while (!bio->done)
+		pthread_cond_wait(&bio->cond, &bio->mutex);
+	
+	bio->done = false;
+	ok = bio->ok;
+	
+	pthread_mutex_unlock(&bio->mutex);
+#else
+	bio->done = false;
+	ok = bio->ok;
+#endif
+	
+	return ok;
+}
+
+#endif /* __WIN32__ */
@@ -0,0 +1,351 @@
+/*
+ * Copyright (c) 2008 Martin Decky
+ * All rights reserved.
+ *
+ * Distributed under the terms of GPL.
+ *
+ */
+
+#include "../chario.h"
+
+#ifndef __WIN32__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include "../../../config.h"
+#include "../../utils.h"
+
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#endif
+
+/** Worker thread poll interval (us) */
+#define WORKER_POLL  10000
+
+#ifndef MSG_NOSIGNAL
+	#define MSG_NOSIGNAL  0
+#endif
+
+/*
+ * Both rings have a single producer and a single consumer.
+ * The simulation produces the transmitted characters and
+ * consumes the received ones, the worker thread does the
+ * opposite.
+ */
+struct chario {
+	int fd;
+	bool readable;
+	bool socket;
+	
+	/* The peer has closed the stream, the output is dropped */
+	bool hangup;
+	uint64_t dropped;
+	
+	char rx[CHARIO_RING_SIZE];
+	size_t rx_head;
+	size_t rx_tail;
+	
+	char tx[CHARIO_RING_SIZE];
+	size_t tx_head;
+	size_t tx_tail;
+
+#ifdef HAVE_LIBPTHREAD
+	pthread_t thread;
+	bool threaded;
+	bool quit;
+#endif
+};
+
+/** Read the available input into the receive ring
+ *
+ * @return False if the stream has been closed or failed.
+ *
+ */
+static bool chario_fill(chario_t *cio)
+{
+	size_t head = cio->rx_head;
+	size_t tail = __atomic_load_n(&cio->rx_tail, __ATOMIC_ACQUIRE);
+	size_t space = CHARIO_RING_SIZE - (head - tail);
+	
+	/* Contiguous free part of the ring */
+	size_t pos = head % CHARIO_RING_SIZE;
+	if (space > CHARIO_RING_SIZE - pos)
+		space = CHARIO_RING_SIZE - pos;
+	
+	if (space == 0)
+		return true;
+	
+	ssize_t rd = read(cio->fd, cio->rx + pos, space);
+	if (rd <= 0) {
+		if ((rd == -1) && (errno == EAGAIN))
+			return true;
+		
+		/* A closed socket is never connected again */
+		if ((cio->socket) && ((rd == 0) || (errno == ECONNRESET)))
+			__atomic_store_n(&cio->hangup, true, __ATOMIC_RELEASE);
+		
+		return false;
+	}
+	
+	__atomic_store_n(&cio->rx_head, head + rd, __ATOMIC_RELEASE);
+	return true;
+}
+
+/** Write the buffered output from the transmit ring
+ *
+ * Characters which cannot be written due to an error are discarded.
+ * The sockets are written without SIGPIPE, a closed peer only stops
+ * the output.
+ *
+ */
+static void chario_flush(chario_t *cio)
+{
+	size_t tail = cio->tx_tail;
+	size_t head = __atomic_load_n(&cio->tx_head, __ATOMIC_ACQUIRE);
+	
+	while (head != tail) {
+		/* Contiguous used part of the ring */
+		size_t pos = tail % CHARIO_RING_SIZE;
+		size_t count = head - tail;
+		if (count > CHARIO_RING_SIZE - pos)
+			count = CHARIO_RING_SIZE - pos;
+		
+		ssize_t wr = -1;
+		
+		if (!__atomic_load_n(&cio->hangup, __ATOMIC_ACQUIRE)) {
+			if (cio->socket)
+				wr = send(cio->fd, cio->tx + pos, count, MSG_NOSIGNAL);
+			else
+				wr = write(cio->fd, cio->tx + pos, count);
+			
+			if ((wr == -1) && (errno == EAGAIN))
+				break;
+			
+			if ((wr == -1) && ((errno == EPIPE) || (errno == ECONNRESET)))
+				__atomic_store_n(&cio->hangup, true, __ATOMIC_RELEASE);
+		}
+		
+		if (wr <= 0) {
+			wr = count;
+			__atomic_add_fetch(&cio->dropped, count, __ATOMIC_RELAXED);
+		}
+		
+		tail += wr;
+		__atomic_store_n(&cio->tx_tail, tail, __ATOMIC_RELEASE);
+	}
+}
+
+#ifdef HAVE_LIBPTHREAD
+
+/** Worker thread transferring the characters
+ *
+ */
+static void *chario_worker(void *arg)
+{
+	chario_t *cio = (chario_t *) arg;
+	
+	while (!__atomic_load_n(&cio->quit, __ATOMIC_ACQUIRE)) {
+		/* Nothing to wait for on a closed socket */
+		if (__atomic_load_n(&cio->hangup, __ATOMIC_ACQUIRE)) {
+			chario_flush(cio);
+			usleep(WORKER_POLL);
+			continue;
+		}
+		
+		struct pollfd pfd;
+		pfd.fd = cio->fd;
+		pfd.events = 0;
+		pfd.revents = 0;
+		
+		if ((cio->readable) && (cio->rx_head -
+		    __atomic_load_n(&cio->rx_tail, __ATOMIC_ACQUIRE) <
+		    CHARIO_RING_SIZE))
+			pfd.events |= POLLIN;
+		
+		if (__atomic_load_n(&cio->tx_head, __ATOMIC_ACQUIRE) !=
+		    cio->tx_tail)
+			pfd.events |= POLLOUT;
+		
+		/* New output is noticed after the poll interval */
+		if (pfd.events == 0) {
+			usleep(WORKER_POLL);
+			continue;
+		}
+		
+		if (poll(&pfd, 1, WORKER_POLL / 1000) <= 0)
+			continue;
+		
+		bool hangup = ((pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) != 0);
+		
+		if ((pfd.revents & POLLIN) && (!chario_fill(cio)))
+			hangup = true;
+		
+		if (pfd.revents & POLLOUT)
+			chario_flush(cio);
+		
+		/* A closed socket is never connected again */
+		if ((hangup) && (cio->socket))
+			__atomic_store_n(&cio->hangup, true, __ATOMIC_RELEASE);
+		
+		/*
+		 * A pseudo-terminal can be opened again by another
+		 * client, do not spin until it happens
+		 */
+		if (hangup)
+			usleep(WORKER_POLL);
+	}
+	
+	return NULL;
+}
+
+#endif
+
+/** Start buffering a host file descriptor
+ *
+ * @param fd       File descriptor (owned by the stream from now on).
+ * @param readable The input should be read.
+ *
+ * @return Stream structure.
+ *
+ */
+chario_t *chario_open(int fd, bool readable)
+{
+	chario_t *cio = safe_malloc_t(chario_t);
+	cio->fd = fd;
+	cio->readable = readable;
+	cio->hangup = false;
+	cio->dropped = 0;
+	cio->rx_head = 0;
+	cio->rx_tail = 0;
+	cio->tx_head = 0;
+	cio->tx_tail = 0;
+	
+	struct stat st;
+	cio->socket = ((fstat(fd, &st) == 0) && (S_ISSOCK(st.st_mode)));
+
+#ifdef SO_NOSIGPIPE
+	if (cio->socket) {
+		int on = 1;
+		(void) setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+	}
+#endif
+	
+	/* The simulation must never block */
+	int flags = fcntl(fd, F_GETFL);
+	if (flags != -1)
+		(void) fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+
+#ifdef HAVE_LIBPTHREAD
+	cio->quit = false;
+	cio->threaded =
+	    (pthread_create(&cio->thread, NULL, chario_worker, cio) == 0);
+#endif
+	
+	return cio;
+}
+
+/** Close the stream
+ *
+ * The remaining output is written if possible.
+ *
+ */
+void chario_close(chario_t *cio)
+{
+#ifdef HAVE_LIBPTHREAD
+	if (cio->threaded) {
+		__atomic_store_n(&cio->quit, true, __ATOMIC_RELEASE);
+		pthread_join(cio->thread, NULL);
+	}
+#endif
+	
+	chario_flush(cio);
+	close(cio->fd);
+	safe_free(cio);
+}
+
+/** Transmit a character
+ *
+ * @return False if the transmit buffer is full.
+ *
+ */
+bool chario_putc(chario_t *cio, char c)
+{
+	size_t head = cio->tx_head;
+	if (head - __atomic_load_n(&cio->tx_tail, __ATOMIC_ACQUIRE) ==
+	    CHARIO_RING_SIZE)
+		return false;
+	
+	cio->tx[head % CHARIO_RING_SIZE] = c;
+	__atomic_store_n(&cio->tx_head, head + 1, __ATOMIC_RELEASE);
+
+#ifdef HAVE_LIBPTHREAD
+	if (!cio->threaded)
+#endif
+		chario_flush(cio);
+	
+	return true;
+}
+
+/** Receive a character
+ *
+ * @return False if there is no input.
+ *
+ */
+bool chario_getc(chario_t *cio, char *c)
+{
+	size_t tail = cio->rx_tail;
+	if (chario_rx_count(cio) == 0)
+		return false;
+	
+	*c = cio->rx[tail % CHARIO_RING_SIZE];
+	__atomic_store_n(&cio->rx_tail, tail + 1, __ATOMIC_RELEASE);
+	
+	return true;
+}
+
+/** Number of received characters in the buffer
+ *
+ */
+size_t chario_rx_count(chario_t *cio)
+{
+#ifdef HAVE_LIBPTHREAD
+	if (!cio->threaded)
+#endif
+	{
+		if ((cio->readable) && (cio->rx_head == cio->rx_tail))
+			(void) chario_fill(cio);
+	}
+	
+	return __atomic_load_n(&cio->rx_head, __ATOMIC_ACQUIRE) - cio->rx_tail;
+}
+
+/** Number of characters waiting for transmission
+ *
+ */
+size_t chario_tx_count(chario_t *cio)
+{
+	return cio->tx_head - __atomic_load_n(&cio->tx_tail, __ATOMIC_ACQUIRE);
+}
+
+/** Check whether the peer has closed the stream
+ *
+ */
+bool chario_hangup(chario_t *cio)
+{
+	return __atomic_load_n(&cio->hangup, __ATOMIC_ACQUIRE);
+}
+
+/** Number of characters dropped since the stream has been opened
+ *
+ */
+uint64_t chario_dropped(chario_t *cio)
+{
+	return __atomic_load_n(&cio->dropped, __ATOMIC_RELAXED);
+}
+
+#endif /* !__WIN32__ */
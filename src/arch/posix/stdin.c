@@ -10,15 +10,54 @@
 
 #ifndef __WIN32__
 
+#include <stddef.h>
 #include <unistd.h>
 #include <sys/select.h>
+#include "../../../config.h"
 
-bool stdin_poll(char *key)
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#endif
+
+/** Input ring buffer size (power of 2) */
+#define RING_SIZE  4096
+
+/** Reader thread poll interval (us) */
+#define READER_POLL  10000
+
+/*
+ * Single-producer single-consumer ring. The producer (the reader
+ * thread) only advances head, the consumer (the simulation) only
+ * advances tail.
+ */
+static char ring[RING_SIZE];
+static size_t ring_head = 0;
+static size_t ring_tail = 0;
+
+/** Standard input reached the end */
+static bool stdin_eof = false;
+
+/** Standard input is used by the interactive mode */
+static bool stdin_paused = false;
+
+/** Read the available input into the ring
+ *
+ */
+static void stdin_fill(void)
 {
-	/* Check new character */
-	fd_set rfds;
+	size_t head = ring_head;
+	size_t tail = __atomic_load_n(&ring_tail, __ATOMIC_ACQUIRE);
+	size_t space = RING_SIZE - (head - tail);
+	
+	/* Contiguous free part of the ring */
+	size_t pos = head % RING_SIZE;
+	if (space > RING_SIZE - pos)
+		space = RING_SIZE - pos;
 	
-	/* Watch stdin */
+	if (space == 0)
+		return;
+	
+	fd_set rfds;
 	FD_ZERO(&rfds);
 	FD_SET(0, &rfds);
 	
@@ -26,15 +65,117 @@ bool stdin_poll(char *key)
 	tv.tv_sec = 0;
 	tv.tv_usec = 0;
 	
-	int retval = select(1, &rfds, NULL, NULL, &tv);
+	if (select(1, &rfds, NULL, NULL, &tv) != 1)
+		return;
+	
+	/* Do not steal the input of the interactive mode */
+	if (__atomic_load_n(&stdin_paused, __ATOMIC_ACQUIRE))
+		return;
 	
-	if (retval == 1) {
-		/* There is a new character */
-		read(0, key, 1);
-		return true;
+	ssize_t rd = read(0, ring + pos, space);
+	if (rd <= 0) {
+		stdin_eof = true;
+		return;
+	}
+	
+	__atomic_store_n(&ring_head, head + rd, __ATOMIC_RELEASE);
+}
+
+#ifdef HAVE_LIBPTHREAD
+
+static bool reader_started = false;
+static bool reader_running = false;
+static pthread_t reader;
+static pthread_mutex_t reader_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** Reader thread collecting the standard input
+ *
+ */
+static void *stdin_reader(void *arg)
+{
+	while (!stdin_eof) {
+		/* The pause is checked and the input read
+		   atomically with respect to stdin_pause() */
+		pthread_mutex_lock(&reader_mutex);
+		stdin_fill();
+		pthread_mutex_unlock(&reader_mutex);
+		
+		/* Wait for the input without the lock */
+		fd_set rfds;
+		FD_ZERO(&rfds);
+		FD_SET(0, &rfds);
+		
+		struct timeval tv;
+		tv.tv_sec = 0;
+		tv.tv_usec = READER_POLL;
+		
+		if ((__atomic_load_n(&stdin_paused, __ATOMIC_ACQUIRE)) ||
+		    (ring_head - __atomic_load_n(&ring_tail, __ATOMIC_ACQUIRE) ==
+		    RING_SIZE))
+			usleep(READER_POLL);
+		else
+			(void) select(1, &rfds, NULL, NULL, &tv);
 	}
 	
-	return false;
+	return NULL;
+}
+
+#endif
+
+/** Stop reading the standard input
+ *
+ * Used while the input belongs to the interactive mode.
+ *
+ */
+void stdin_pause(void)
+{
+#ifdef HAVE_LIBPTHREAD
+	pthread_mutex_lock(&reader_mutex);
+#endif
+	
+	__atomic_store_n(&stdin_paused, true, __ATOMIC_RELEASE);
+	
+#ifdef HAVE_LIBPTHREAD
+	pthread_mutex_unlock(&reader_mutex);
+#endif
+}
+
+/** Continue reading the standard input
+ *
+ */
+void stdin_resume(void)
+{
+	__atomic_store_n(&stdin_paused, false, __ATOMIC_RELEASE);
+}
+
+bool stdin_poll(char *key)
+{
+#ifdef HAVE_LIBPTHREAD
+	/* Start the reader on the first use */
+	if (!reader_started) {
+		reader_started = true;
+		if (pthread_create(&reader, NULL, stdin_reader, NULL) == 0) {
+			pthread_detach(reader);
+			reader_running = true;
+		}
+	}
+	
+	if (!reader_running)
+#endif
+	{
+		/* Read all the pending input at once */
+		if ((ring_head == ring_tail) && (!stdin_eof))
+			stdin_fill();
+	}
+	
+	size_t tail = ring_tail;
+	if (__atomic_load_n(&ring_head, __ATOMIC_ACQUIRE) == tail)
+		return false;
+	
+	*key = ring[tail % RING_SIZE];
+	__atomic_store_n(&ring_tail, tail + 1, __ATOMIC_RELEASE);
+	
+	return true;
 }
 
 #endif /* !__WIN32__ */
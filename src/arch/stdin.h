@@ -12,5 +12,7 @@
 #include <stdbool.h>
 
 extern bool stdin_poll(char *key);
+extern void stdin_pause(void);
+extern void stdin_resume(void);
 
 #endif
@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2008 Martin Decky
+ * All rights reserved.
+ *
+ * Distributed under the terms of GPL.
+ *
+ */
+
+#include "../blkio.h"
+
+#ifdef __WIN32__
+
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#include "../../utils.h"
+
+/* Requests are served synchronously */
+struct blkio {
+	int fd;
+	bool done;
+	bool ok;
+};
+
+blkio_t *blkio_open(const char *path, uint64_t *size)
+{
+	int fd = open(path, O_RDWR | O_BINARY);
+	if (fd == -1)
+		return NULL;
+	
+	struct _stati64 st;
+	if (_fstati64(fd, &st) == -1) {
+		close(fd);
+		return NULL;
+	}
+	
+	blkio_t *bio = safe_malloc_t(blkio_t);
+	bio->fd = fd;
+	bio->done = false;
+	bio->ok = false;
+	
+	*size = (uint64_t) st.st_size;
+	return bio;
+}
+
+void blkio_close(blkio_t *bio)
+{
+	close(bio->fd);
+	safe_free(bio);
+}
+
+void blkio_submit(blkio_t *bio, bool write, void *buf, size_t size,
+    uint64_t offset)
+{
+	unsigned char *ptr = (unsigned char *) buf;
+	
+	bio->done = true;
+	bio->ok = false;
+	
+	if (_lseeki64(bio->fd, offset, SEEK_SET) == -1)
+		return;
+	
+	while (size > 0) {
+		int res;
+		
+		if (write)
+			res = _write(bio->fd, ptr, size);
+		else
+			res = _read(bio->fd, ptr, size);
+		
+		if (res <= 0)
+			return;
+		
+		ptr += res;
+		size -= res;
+	}
+	
+	bio->ok = true;
+}
+
+bool blkio_done(blkio_t *bio, bool *ok)
+{
+	bool done = bio->done;
+	
+	if (done) {
+		bio->done = false;
+		*ok = bio->ok;
+	}
+	
+	return done;
+}
+
+bool blkio_wait(blkio_t *bio)
+{
+	bio->done = false;
+	return bio->ok;
+}
+
+#endif /* __WIN32__ */
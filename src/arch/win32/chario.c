@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2008 Martin Decky
+ * All rights reserved.
+ *
+ * Distributed under the terms of GPL.
+ *
+ */
+
+#include "../chario.h"
+
+#ifdef __WIN32__
+
+#include <io.h>
+#include "../../utils.h"
+
+/* Output is written synchronously, input is not supported */
+struct chario {
+	int fd;
+};
+
+chario_t *chario_open(int fd, bool readable)
+{
+	chario_t *cio = safe_malloc_t(chario_t);
+	cio->fd = fd;
+	
+	return cio;
+}
+
+void chario_close(chario_t *cio)
+{
+	close(cio->fd);
+	safe_free(cio);
+}
+
+bool chario_putc(chario_t *cio, char c)
+{
+	(void) _write(cio->fd, &c, 1);
+	return true;
+}
+
+bool chario_getc(chario_t *cio, char *c)
+{
+	return false;
+}
+
+size_t chario_rx_count(chario_t *cio)
+{
+	return 0;
+}
+
+size_t chario_tx_count(chario_t *cio)
+{
+	return 0;
+}
+
+bool chario_hangup(chario_t *cio)
+{
+	return false;
+}
+
+uint64_t chario_dropped(chario_t *cio)
+{
+	return 0;
+}
+
+#endif /* __WIN32__ */
@@ -54,6 +54,14 @@ void *mmap(void *addr, size_t length, int prot, int flags, int fd,
 		}
 	}
 	
+	/* Private writable mapping is copy-on-write */
+	if (((flags & MAP_PRIVATE) == MAP_PRIVATE) &&
+	    ((prot & PROT_WRITE) == PROT_WRITE)) {
+		protect = ((prot & PROT_EXEC) == PROT_EXEC) ?
+		    PAGE_EXECUTE_WRITECOPY : PAGE_WRITECOPY;
+		access = FILE_MAP_COPY;
+	}
+	
 	HANDLE handle = CreateFileMapping(fh, NULL, protect,
 	    ((uint64_t) length) >> 32, length & 0xffffffff, NULL);
 	if (handle == NULL) {
@@ -54,4 +54,12 @@ bool stdin_poll(char *key)
 	return false;
 }
 
+void stdin_pause(void)
+{
+}
+
+void stdin_resume(void)
+{
+}
+
 #endif /* __WIN32__ */
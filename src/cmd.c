@@ -25,6 +25,7 @@
 #include "check.h"
 #include "device/device.h"
 #include "device/machine.h"
+#include "device/elf.h"
 #include "debug/debug.h"
 #include "debug/breakpoint.h"
 #include "fault.h"
@@ -51,6 +52,7 @@ static bool system_step(parm_link_s *pl, void *data);
 static bool system_set(parm_link_s *pl, void *data);
 static bool system_unset(parm_link_s *pl, void *data);
 static bool system_help(parm_link_s *pl, void *data);
+static bool system_loadelf(parm_link_s *pl, void *data);
 
 
 /**< TAB completion generator-finders */
@@ -227,6 +229,19 @@ static cmd_s system_cmds[] = {
 		"Display a help text",
 		OPT STR "cmd/command name" END
 	},
+	{
+		"loadelf",
+		system_loadelf,
+		DEFAULT,
+		DEFAULT,
+		"Load an ELF executable",
+		"Load the segments of an ELF executable into the memory, "
+			"set the entry point of the processor 0 and keep "
+			"the symbols for the trace (map keeps read-only "
+			"segments mapped from the file)",
+		REQ STR "fname/file name" NEXT
+		OPT STR "mode/copy or map" END
+	},
 	LAST_CMD
 };
 
@@ -512,6 +527,27 @@ static bool system_help(parm_link_s *pl, void *data)
 }
 
 
+/** Loadelf command implementation
+ *
+ * Load an ELF executable. The segments are copied
+ * unless mapping from the file is requested.
+ *
+ */
+static bool system_loadelf(parm_link_s *pl, void *data)
+{
+	const char *const path = parm_next_str(&pl);
+	const char *const mode =
+	    (parm_type(pl) == tt_str) ? parm_str(pl) : "copy";
+	
+	if ((strcmp(mode, "copy") != 0) && (strcmp(mode, "map") != 0)) {
+		mprintf("Unknown mode, copy or map expected\n");
+		return false;
+	}
+	
+	return elf_load(path, strcmp(mode, "map") == 0);
+}
+
+
 /** Interprets the command line.
  *
  * Line is terminated by '\0' or '\n'.
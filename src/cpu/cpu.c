@@ -17,6 +17,7 @@
 #include "../debug/debug.h"
 #include "../debug/breakpoint.h"
 #include "../debug/gdb.h"
+#include "../debug/semihost.h"
 #include "../io/output.h"
 #include "../check.h"
 #include "../main.h"
@@ -1624,6 +1625,7 @@ static exc_t execute(cpu_t *cpu, instr_info_t ii)
 		    cpu->regs[4], cpu->regs[4]);
 		break;
 	case opcDTRC:
+		machine_fast_leave("DTRC instruction");
 		if (!totrace) {
 			reg_view(cpu);
 			mprintf("\n");
@@ -1645,8 +1647,12 @@ static exc_t execute(cpu_t *cpu, instr_info_t ii)
 		tohalt = true;
 		break;
 	case opcDINT:
+		machine_fast_leave("DINT instruction");
 		interactive = true;
 		break;
+	case opcDSYS:
+		semihost_call(cpu);
+		break;
 	
 	/*
 	 * Unimplemented instructions
@@ -97,7 +97,7 @@ static instr_form_t instr_table[64] = {
 static instr_opcode_t SPEC_instr_table[64] = {
 	/* 0x00 */
 	opcSLL,     opcRES,   opcSRL,  opcSRA,
-	opcSLLV,    opcRES,   opcSRLV, opcSRAV,
+	opcSLLV,    opcDSYS,  opcSRLV, opcSRAV,
 	opcJR,      opcJALR,  opcMOVZ, opcMOVN,
 	opcSYSCALL, opcBREAK, opcRES,  opcSYNC,
 	
@@ -513,6 +513,8 @@ instr_text_t instr_names_acronym[] = {
 	{ "d_traceoff", ifERR },
 	{ "d_regview",  ifERR },
 	{ "d_halt",     ifERR },
+	{ "d_interact", ifERR },
+	{ "d_syscall",  ifERR },
 	
 	{ "---", ifERR }
 };
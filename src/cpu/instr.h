@@ -238,6 +238,7 @@ typedef enum {
 	opcDRV,
 	opcDHLT,
 	opcDINT,
+	opcDSYS,
 	
 	opcIllegal,
 	
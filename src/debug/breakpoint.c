@@ -310,10 +310,16 @@ breakpoint_t *breakpoint_find_by_address(list_t breakpoints,
 bool breakpoint_check_for_code_breakpoints(void)
 {
 	bool hit = false;
-	device_s *dev = NULL;
+	size_t count;
+	device_s *const *devs = dev_cached(DEVICE_FILTER_PROCESSOR, &count);
+	size_t i;
 	
-	while (dev_next(&dev, DEVICE_FILTER_PROCESSOR)) {
-		cpu_t* cpu = (cpu_t *) dev->data;
+	for (i = 0; i < count; i++) {
+		cpu_t* cpu = (cpu_t *) devs[i]->data;
+		
+		/* Most processors have no code breakpoints */
+		if (cpu->bps.head == NULL)
+			continue;
 		
 		if (breakpoint_hit_by_address(cpu->bps, cpu->pc))
 			hit = true;
@@ -16,6 +16,7 @@
 #include "../cpu/cpu.h"
 #include "../device/machine.h"
 #include "../device/dcpu.h"
+#include "../device/elf.h"
 #include "../device/mem.h"
 #include "../io/output.h"
 #include "../main.h"
@@ -448,6 +449,10 @@ void iview(cpu_t *cpu, uint32_t addr, instr_info_t *ii, char *regch)
 	if ((s_cmt[0]) && (regch[0]))
 		s_cmtx = ", ";
 	
+	const char *sym = elf_symbol(addr);
+	if (sym != NULL)
+		mprintf("%s:\n", sym);
+	
 	mprintf("%-4s%s%s  %-6s%-18s%-2s%s%s%s\n",
 	    s_proc, s_addr, s_iopc,
 	    instr_names_acronym[ii->opcode].acronym, s_parm,
@@ -0,0 +1,365 @@
+/*
+ * Copyright (c) 2008 Martin Decky
+ * All rights reserved.
+ *
+ * Distributed under the terms of GPL.
+ *
+ *
+ *  Semihosting
+ *
+ * The DSYS instruction lets the simulated software access host files
+ * in a sandbox directory and terminate the simulation with an exit code.
+ * The operation is selected by the v0 register, the arguments are passed
+ * in the a0..a2 registers and the result is returned in v0 (-1 on error,
+ * the host errno value is returned in v1).
+ *
+ * The data are transferred directly between the host files and
+ * the memory areas, page by page.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+
+#include "semihost.h"
+
+#include "../device/machine.h"
+#include "../io/output.h"
+#include "../utils.h"
+
+#ifndef O_BINARY
+	#define O_BINARY  0
+#endif
+
+/** \{ \name Operations (v0) */
+#define SEMIHOST_OPEN   1  /**< Open a file (a0 path, a1 mode) */
+#define SEMIHOST_CLOSE  2  /**< Close a file (a0 descriptor) */
+#define SEMIHOST_READ   3  /**< Read (a0 descriptor, a1 buffer, a2 length) */
+#define SEMIHOST_WRITE  4  /**< Write (a0 descriptor, a1 buffer, a2 length) */
+#define SEMIHOST_SEEK   5  /**< Seek (a0 descriptor, a1 offset, a2 whence) */
+#define SEMIHOST_EXIT   6  /**< Halt with an exit code (a0 code) */
+/* \} */
+
+/** \{ \name Open modes (a1) */
+#define MODE_READ    0  /**< Read only */
+#define MODE_WRITE   1  /**< Write only, create or truncate */
+#define MODE_UPDATE  2  /**< Read and write, create */
+#define MODE_APPEND  3  /**< Append, create */
+/* \} */
+
+/** Number of descriptors (0..2 are reserved, 1 and 2 are the console) */
+#define SEMIHOST_FILES  16
+
+/** Longest path accepted */
+#define SEMIHOST_PATH  1024
+
+/** Transfer unit (the smallest page size) */
+#define SEMIHOST_PAGE  4096
+
+/** Register numbers */
+#define REG_V0  2
+#define REG_V1  3
+#define REG_A0  4
+#define REG_A1  5
+#define REG_A2  6
+
+/** Sandbox directory (NULL disables the file access) */
+char *semihost_dir = NULL;
+
+/** Host descriptors of the open files (-1 if not open) */
+static int files[SEMIHOST_FILES] = {
+	-1, STDOUT_FILENO, STDERR_FILENO, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1
+};
+
+/** Set the sandbox directory
+ *
+ * @param dir Directory path
+ *
+ * @return true if successful
+ *
+ */
+bool semihost_set_dir(const char *dir)
+{
+	struct stat st;
+	
+	if ((stat(dir, &st) == -1) || (!S_ISDIR(st.st_mode))) {
+		mprintf("%s: Not a directory\n", dir);
+		return false;
+	}
+	
+	safe_free(semihost_dir);
+	semihost_dir = safe_strdup(dir);
+	
+	return true;
+}
+
+/** Close all the files
+ *
+ */
+void semihost_done(void)
+{
+	unsigned int i;
+	
+	for (i = 3; i < SEMIHOST_FILES; i++) {
+		if (files[i] != -1) {
+			close(files[i]);
+			files[i] = -1;
+		}
+	}
+}
+
+/** Read a path from the virtual memory
+ *
+ * Only relative paths without the parent directory
+ * components are accepted.
+ *
+ * @param cpu  Processor
+ * @param addr Virtual address of the path
+ * @param path Buffer for the full host path
+ *
+ * @return errno value (0 if successful)
+ *
+ */
+static int semihost_path(cpu_t *cpu, ptr_t addr, char *path)
+{
+	if (semihost_dir == NULL)
+		return EACCES;
+	
+	char name[SEMIHOST_PATH];
+	size_t i;
+	
+	for (i = 0; i < SEMIHOST_PATH; i++) {
+		uint32_t val;
+		
+		if (cpu_read_mem(cpu, addr + i, BITS_8, &val, false) != excNone)
+			return EFAULT;
+		
+		name[i] = (char) val;
+		if (name[i] == 0)
+			break;
+	}
+	
+	if (i == SEMIHOST_PATH)
+		return ENAMETOOLONG;
+	
+	if ((name[0] == 0) || (name[0] == '/') || (name[0] == '\\'))
+		return EACCES;
+	
+	/* Reject the parent directory components */
+	const char *comp = name;
+	while (comp != NULL) {
+		if ((comp[0] == '.') && (comp[1] == '.') &&
+		    ((comp[2] == 0) || (comp[2] == '/') || (comp[2] == '\\')))
+			return EACCES;
+		
+		comp = strpbrk(comp, "/\\");
+		if (comp != NULL)
+			comp++;
+	}
+	
+	if (strlen(semihost_dir) + strlen(name) + 2 > 2 * SEMIHOST_PATH)
+		return ENAMETOOLONG;
+	
+	strcpy(path, semihost_dir);
+	strcat(path, "/");
+	strcat(path, name);
+	return 0;
+}
+
+/** Open implementation
+ *
+ * @param cpu  Processor
+ * @param addr Virtual address of the path
+ * @param mode Open mode
+ *
+ * @return Descriptor or -1 on error
+ *
+ */
+static int semihost_open(cpu_t *cpu, ptr_t addr, uint32_t mode)
+{
+	static const int flags[] = {
+		[MODE_READ] = O_RDONLY,
+		[MODE_WRITE] = O_WRONLY | O_CREAT | O_TRUNC,
+		[MODE_UPDATE] = O_RDWR | O_CREAT,
+		[MODE_APPEND] = O_WRONLY | O_CREAT | O_APPEND
+	};
+	
+	if (mode > MODE_APPEND) {
+		errno = EINVAL;
+		return -1;
+	}
+	
+	char path[2 * SEMIHOST_PATH];
+	int err = semihost_path(cpu, addr, path);
+	if (err != 0) {
+		errno = err;
+		return -1;
+	}
+	
+	unsigned int fd;
+	for (fd = 3; fd < SEMIHOST_FILES; fd++) {
+		if (files[fd] == -1)
+			break;
+	}
+	
+	if (fd == SEMIHOST_FILES) {
+		errno = EMFILE;
+		return -1;
+	}
+	
+	files[fd] = open(path, flags[mode] | O_BINARY, 0644);
+	if (files[fd] == -1)
+		return -1;
+	
+	return fd;
+}
+
+/** Get the host descriptor
+ *
+ * @param fd Simulated descriptor
+ *
+ * @return Host descriptor or -1 if not open
+ *
+ */
+static int semihost_file(uint32_t fd)
+{
+	if ((fd >= SEMIHOST_FILES) || (files[fd] == -1)) {
+		errno = EBADF;
+		return -1;
+	}
+	
+	return files[fd];
+}
+
+/** Read and write implementation
+ *
+ * The buffer is translated and transferred page by page,
+ * the transfer stops at the first page which is not mapped
+ * to a memory area.
+ *
+ * @param cpu     Processor
+ * @param fd      Simulated descriptor
+ * @param addr    Virtual address of the buffer
+ * @param len     Length in bytes
+ * @param to_file Write to the file
+ *
+ * @return Number of bytes transferred or -1 on error
+ *
+ */
+static int32_t semihost_transfer(cpu_t *cpu, uint32_t fd, ptr_t addr,
+    uint32_t len, bool to_file)
+{
+	int hfd = semihost_file(fd);
+	if (hfd == -1)
+		return -1;
+	
+	if ((hfd == STDOUT_FILENO) || (hfd == STDERR_FILENO))
+		fflush(NULL);
+	
+	/* Keep the result representable */
+	if (len > INT32_MAX)
+		len = INT32_MAX;
+	
+	uint32_t done = 0;
+	while (done < len) {
+		ptr_t vaddr = addr + done;
+		len_t chunk = SEMIHOST_PAGE - (vaddr & (SEMIHOST_PAGE - 1));
+		if (chunk > len - done)
+			chunk = len - done;
+		
+		ptr_t paddr = vaddr;
+		unsigned char *data = NULL;
+		
+		if (convert_addr(cpu, &paddr, !to_file, false) == excNone)
+			data = mem_direct(paddr, chunk, !to_file);
+		
+		if (data == NULL) {
+			if (done > 0)
+				break;
+			
+			errno = EFAULT;
+			return -1;
+		}
+		
+		ssize_t ret = to_file ? (ssize_t) (write(hfd, data, chunk)) :
+		    (ssize_t) (read(hfd, data, chunk));
+		
+		if (ret == -1)
+			return (done > 0) ? (int32_t) done : -1;
+		
+		done += ret;
+		if ((len_t) ret < chunk)
+			break;
+	}
+	
+	return (int32_t) done;
+}
+
+/** Semihosting call
+ *
+ * @param cpu Processor which executes the DSYS instruction
+ *
+ */
+void semihost_call(cpu_t *cpu)
+{
+	uint32_t a0 = cpu->regs[REG_A0];
+	uint32_t a1 = cpu->regs[REG_A1];
+	uint32_t a2 = cpu->regs[REG_A2];
+	int32_t ret = -1;
+	int hfd;
+	off_t off;
+	
+	errno = 0;
+	
+	switch (cpu->regs[REG_V0]) {
+	case SEMIHOST_OPEN:
+		ret = semihost_open(cpu, a0, a1);
+		break;
+	case SEMIHOST_CLOSE:
+		hfd = semihost_file(a0);
+		if ((hfd != -1) && (a0 > 2)) {
+			ret = close(hfd);
+			files[a0] = -1;
+		} else if (hfd != -1)
+			ret = 0;
+		break;
+	case SEMIHOST_READ:
+		ret = semihost_transfer(cpu, a0, a1, a2, false);
+		break;
+	case SEMIHOST_WRITE:
+		ret = semihost_transfer(cpu, a0, a1, a2, true);
+		break;
+	case SEMIHOST_SEEK:
+		hfd = semihost_file(a0);
+		if (hfd != -1) {
+			off = lseek(hfd, (off_t) (int32_t) a1, (int) a2);
+			if ((off != -1) && (off > INT32_MAX)) {
+				errno = EOVERFLOW;
+				off = -1;
+			}
+			ret = (int32_t) off;
+		}
+		break;
+	case SEMIHOST_EXIT:
+		if (totrace)
+			mprintf("\nMachine halt (exit code %" PRId32 ")\n\n",
+			    (int32_t) a0);
+		exit_code = (int) a0;
+		tohalt = true;
+		ret = 0;
+		break;
+	default:
+		errno = ENOSYS;
+		break;
+	}
+	
+	cpu->regs[REG_V0] = (uint32_t) ret;
+	cpu->regs[REG_V1] = (ret == -1) ? (uint32_t) errno : 0;
+}
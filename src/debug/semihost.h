@@ -0,0 +1,25 @@
+/*
+ * Copyright (c) 2008 Martin Decky
+ * All rights reserved.
+ *
+ * Distributed under the terms of GPL.
+ *
+ *
+ *  Semihosting
+ *
+ */
+
+#ifndef SEMIHOST_H_
+#define SEMIHOST_H_
+
+#include <stdbool.h>
+
+#include "../cpu/cpu.h"
+
+extern char *semihost_dir;
+
+extern bool semihost_set_dir(const char *dir);
+extern void semihost_call(cpu_t *cpu);
+extern void semihost_done(void);
+
+#endif
@@ -192,6 +192,9 @@ device_type_s dcpu = {
 };
 
 
+/** Processors indexed by their numbers (NULL for unused slots) */
+static cpu_t *cpus[MAX_CPU];
+
 /** Get first available CPU id
  *
  * @return First available CPU id or MAX_CPU if no
@@ -201,21 +204,14 @@ device_type_s dcpu = {
 static unsigned int dcpu_get_free_id(void)
 {
 	unsigned int c;
-	unsigned int id_mask = 0;
-	device_s *dev = NULL;
-
-	while (dev_next(&dev, DEVICE_FILTER_PROCESSOR))
-		id_mask |= 1 << ((cpu_t *) dev->data)->procno;
 	
-	for (c = 0; c < MAX_CPU; c++, id_mask >>= 1)
-		if (!(id_mask & 1))
+	for (c = 0; c < MAX_CPU; c++)
+		if (cpus[c] == NULL)
 			return c;
-
+	
 	return MAX_CPU;
 }
 
-	
-
 
 /** Initialization
  *
@@ -225,7 +221,7 @@ static bool dcpu_init(parm_link_s *parm, device_s *dev)
 	unsigned int id = dcpu_get_free_id();
 	
 	if (id == MAX_CPU) {
-		mprintf("Maximum CPU count exceeded (%u)", MAX_CPU);
+		mprintf("Maximum CPU count exceeded (%u)\n", MAX_CPU);
 		return false;
 	}
 	
@@ -233,6 +229,7 @@ static bool dcpu_init(parm_link_s *parm, device_s *dev)
 	cpu_init(cpu, id);
 	
 	dev->data = cpu;
+	cpus[id] = cpu;
 	
 	return true;
 }
@@ -475,6 +472,8 @@ static bool dcpu_br(parm_link_s *parm, device_s *dev)
  */
 static void dcpu_done(device_s *dev)
 {
+	cpus[((cpu_t *) dev->data)->procno] = NULL;
+	
 	safe_free(dev->name);
 	safe_free(dev->data);
 }
@@ -490,15 +489,10 @@ static void dcpu_step(device_s *dev)
 
 cpu_t *dcpu_find_no(unsigned int no)
 {
-	device_s *dev = NULL;
+	if (no >= MAX_CPU)
+		return NULL;
 	
-	while (dev_next(&dev, DEVICE_FILTER_PROCESSOR)) {
-		cpu_t* cpu = (cpu_t *) dev->data;
-		if (cpu->procno == no)
-			return cpu;
-	}
-	
-	return NULL;
+	return cpus[no];
 }
 
 void dcpu_interrupt_up(unsigned int cpuno, unsigned int no)
@@ -516,3 +510,251 @@ void dcpu_interrupt_down(unsigned int cpuno, unsigned int no)
 	if (cpu != NULL)
 		cpu_interrupt_down(cpu, no);
 }
+
+/** Initialize the interrupt routing
+ *
+ * The interrupt is delivered to the processor 0 by default.
+ *
+ */
+void dcpu_route_init(intr_route_t *route)
+{
+	route->mode = ROUTE_CPU;
+	memset(route->mask, 0, sizeof(route->mask));
+	route->cpuno = 0;
+	route->next = 0;
+	route->pending = false;
+}
+
+/** Test whether a processor is in the mask of an interrupt routing
+ *
+ */
+static bool route_mask_test(const intr_route_t *route, unsigned int cpuno)
+{
+	return ((route->mask[cpuno / 32] & (1U << (cpuno % 32))) != 0);
+}
+
+/** Parse a list of processors
+ *
+ * The list contains processor numbers and ranges of
+ * processor numbers separated by commas (e.g. "0-3,40").
+ *
+ * @param mask Processor mask to be filled.
+ * @param str  List of processors.
+ *
+ * @return True if successful.
+ *
+ */
+static bool route_mask_parse(uint32_t *mask, const char *str)
+{
+	memset(mask, 0, ROUTE_MASK_WORDS * sizeof(uint32_t));
+	
+	while (*str != 0) {
+		char *end;
+		unsigned long first = strtoul(str, &end, 0);
+		unsigned long last = first;
+		
+		if (end == str)
+			return false;
+		
+		if (*end == '-') {
+			str = end + 1;
+			last = strtoul(str, &end, 0);
+			
+			if (end == str)
+				return false;
+		}
+		
+		if ((first > last) || (last >= MAX_CPU))
+			return false;
+		
+		for (; first <= last; first++)
+			mask[first / 32] |= 1U << (first % 32);
+		
+		if (*end == ',')
+			end++;
+		else if (*end != 0)
+			return false;
+		
+		str = end;
+	}
+	
+	return true;
+}
+
+/** Set the interrupt routing from command parameters
+ *
+ * @param route Interrupt routing to be changed.
+ * @param parm  Routing mode ("cpu", "mask" or "rr") followed
+ *              by the processor number or the processor mask.
+ *              The mask is either a number (processors 0..31)
+ *              or a list of processors (e.g. "0-3,40").
+ *
+ * @return True if successful.
+ *
+ */
+bool dcpu_route_set(intr_route_t *route, parm_link_s *parm)
+{
+	if (route->pending) {
+		mprintf("Cannot change the routing of a pending interrupt\n");
+		return false;
+	}
+	
+	const char *mode = parm_next_str(&parm);
+	
+	if (strcmp(mode, "rr") == 0) {
+		route->mode = ROUTE_ROUND_ROBIN;
+		return true;
+	}
+	
+	if (strcmp(mode, "cpu") == 0) {
+		if (parm_type(parm) != tt_int) {
+			mprintf("Missing processor number\n");
+			return false;
+		}
+		
+		uint32_t val = parm_int(parm);
+		if (val >= MAX_CPU) {
+			mprintf("Processor number out of range\n");
+			return false;
+		}
+		
+		route->mode = ROUTE_CPU;
+		route->cpuno = val;
+		return true;
+	}
+	
+	if (strcmp(mode, "mask") != 0) {
+		mprintf("Unknown routing mode (cpu, mask or rr expected)\n");
+		return false;
+	}
+	
+	uint32_t mask[ROUTE_MASK_WORDS];
+	
+	switch (parm_type(parm)) {
+	case tt_int:
+		memset(mask, 0, sizeof(mask));
+		mask[0] = parm_int(parm);
+		break;
+	case tt_str:
+		if (!route_mask_parse(mask, parm_str(parm))) {
+			mprintf("Invalid list of processors\n");
+			return false;
+		}
+		break;
+	default:
+		mprintf("Missing processor mask\n");
+		return false;
+	}
+	
+	route->mode = ROUTE_MASK;
+	memcpy(route->mask, mask, sizeof(mask));
+	
+	return true;
+}
+
+/** Print the interrupt routing
+ *
+ * The processor mask is printed as a list of processors.
+ *
+ */
+void dcpu_route_print(const intr_route_t *route)
+{
+	unsigned int i;
+	bool first = true;
+	
+	switch (route->mode) {
+	case ROUTE_CPU:
+		mprintf("cpu %u", route->cpuno);
+		break;
+	case ROUTE_MASK:
+		mprintf("mask ");
+		
+		for (i = 0; i < MAX_CPU; i++) {
+			if (!route_mask_test(route, i))
+				continue;
+			
+			unsigned int last = i;
+			while ((last + 1 < MAX_CPU) && (route_mask_test(route, last + 1)))
+				last++;
+			
+			if (last == i)
+				mprintf("%s%u", first ? "" : ",", i);
+			else
+				mprintf("%s%u-%u", first ? "" : ",", i, last);
+			
+			first = false;
+			i = last;
+		}
+		
+		if (first)
+			mprintf("none");
+		break;
+	case ROUTE_ROUND_ROBIN:
+		mprintf("rr");
+		break;
+	}
+}
+
+/** Assert a device interrupt according to the routing
+ *
+ * In the round-robin mode the next processor is chosen only if
+ * the interrupt is not pending already.
+ *
+ */
+void dcpu_route_up(intr_route_t *route, unsigned int no)
+{
+	unsigned int i;
+	
+	switch (route->mode) {
+	case ROUTE_CPU:
+		dcpu_interrupt_up(route->cpuno, no);
+		break;
+	case ROUTE_MASK:
+		for (i = 0; i < MAX_CPU; i++)
+			if (route_mask_test(route, i))
+				dcpu_interrupt_up(i, no);
+		break;
+	case ROUTE_ROUND_ROBIN:
+		if (!route->pending) {
+			size_t count;
+			device_s *const *devs =
+			    dev_cached(DEVICE_FILTER_PROCESSOR, &count);
+			
+			if (count == 0)
+				return;
+			
+			if (route->next >= count)
+				route->next = 0;
+			
+			route->cpuno = ((cpu_t *) devs[route->next]->data)->procno;
+			route->next++;
+		}
+		
+		dcpu_interrupt_up(route->cpuno, no);
+		break;
+	}
+	
+	route->pending = true;
+}
+
+/** Deassert a device interrupt according to the routing
+ *
+ */
+void dcpu_route_down(intr_route_t *route, unsigned int no)
+{
+	unsigned int i;
+	
+	switch (route->mode) {
+	case ROUTE_CPU:
+	case ROUTE_ROUND_ROBIN:
+		dcpu_interrupt_down(route->cpuno, no);
+		break;
+	case ROUTE_MASK:
+		for (i = 0; i < MAX_CPU; i++)
+			if (route_mask_test(route, i))
+				dcpu_interrupt_down(i, no);
+		break;
+	}
+	
+	route->pending = false;
+}
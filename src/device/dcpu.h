@@ -12,9 +12,30 @@
 #ifndef DCPU_H_
 #define DCPU_H_
 
+#include "../main.h"
 #include "device.h"
 #include "../cpu/cpu.h"
 
+/** Number of words of the processor mask of an interrupt routing */
+#define ROUTE_MASK_WORDS  ((MAX_CPU + 31) / 32)
+
+/** Device interrupt routing modes */
+typedef enum {
+	ROUTE_CPU,         /**< Deliver to a single processor */
+	ROUTE_MASK,        /**< Deliver to all processors in the mask */
+	ROUTE_ROUND_ROBIN  /**< Rotate over all processors */
+} intr_route_mode_t;
+
+/** Routing of a device interrupt to processors */
+typedef struct {
+	intr_route_mode_t mode;  /**< Routing mode */
+	uint32_t mask[ROUTE_MASK_WORDS];  /**< Processors (ROUTE_MASK) */
+	unsigned int cpuno;      /**< Target processor (ROUTE_CPU) or
+	                              the last one used (ROUTE_ROUND_ROBIN) */
+	size_t next;             /**< Next processor index (ROUTE_ROUND_ROBIN) */
+	bool pending;            /**< Interrupt asserted on cpuno */
+} intr_route_t;
+
 extern device_type_s dcpu;
 extern const char id_dcpu[];
 
@@ -22,4 +43,10 @@ extern cpu_t *dcpu_find_no(unsigned int no);
 extern void dcpu_interrupt_up(unsigned int cpuno, unsigned int no);
 extern void dcpu_interrupt_down(unsigned int cpuno, unsigned int no);
 
+extern void dcpu_route_init(intr_route_t *route);
+extern bool dcpu_route_set(intr_route_t *route, parm_link_s *parm);
+extern void dcpu_route_print(const intr_route_t *route);
+extern void dcpu_route_up(intr_route_t *route, unsigned int no);
+extern void dcpu_route_down(intr_route_t *route, unsigned int no);
+
 #endif
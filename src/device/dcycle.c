@@ -0,0 +1,585 @@
+/*
+ * Copyright (c) 2008 Martin Decky
+ * All rights reserved.
+ *
+ * Distributed under the terms of GPL.
+ *
+ *
+ *  Cycle and performance counters
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "dcycle.h"
+
+#include "machine.h"
+#include "dcpu.h"
+#include "../cpu/cpu.h"
+#include "../fault.h"
+#include "../io/output.h"
+#include "../utils.h"
+
+/** Number of programmable counters */
+#define COUNTERS  2
+
+/** Latch of the accesses which do not come from a processor */
+#define LATCH_OTHER  MAX_CPU
+
+/** \{ \name Register offsets */
+#define REGISTER_CYCLES_LO     0   /**< Machine cycles (latches the high word) */
+#define REGISTER_CYCLES_HI     4   /**< Machine cycles, high word */
+#define REGISTER_KERNEL_LO     8   /**< Kernel cycles (latches the high word) */
+#define REGISTER_KERNEL_HI     12  /**< Kernel cycles, high word */
+#define REGISTER_USER_LO       16  /**< User cycles (latches the high word) */
+#define REGISTER_USER_HI       20  /**< User cycles, high word */
+#define REGISTER_WAIT_LO       24  /**< Wait cycles (latches the high word) */
+#define REGISTER_WAIT_HI       28  /**< Wait cycles, high word */
+#define REGISTER_TLB_REFILL    32  /**< TLB refill exceptions */
+#define REGISTER_TLB_INVALID   36  /**< TLB invalid exceptions */
+#define REGISTER_TLB_MODIFIED  40  /**< TLB modified exceptions */
+#define REGISTER_INTERRUPTS    44  /**< Interrupts asserted */
+#define REGISTER_CONTROL       48  /**< Counter control */
+#define REGISTER_COUNTER       52  /**< Counter value */
+#define REGISTER_PAIR          8   /**< Size of counter registers */
+#define REGISTER_LIMIT         (REGISTER_CONTROL + COUNTERS * REGISTER_PAIR)
+/* \} */
+
+/** \{ \name Counter control */
+#define CONTROL_EVENT_MASK  0x0000000fU  /**< Counted event */
+#define CONTROL_ENABLE      0x00000010U  /**< Counting enabled */
+#define CONTROL_INT         0x00000020U  /**< Interrupt on the overflow */
+#define CONTROL_CPU_SHIFT   8
+#define CONTROL_CPU_MASK    0x0000ff00U  /**< Processor number */
+#define CONTROL_OVERFLOW    0x80000000U  /**< Overflow (write 0 to clear) */
+#define CONTROL_MASK        0x8000ff3fU
+/* \} */
+
+/** Counter overflow (the most significant bit) */
+#define COUNTER_OVERFLOW  0x80000000U
+
+/** Counted events */
+typedef enum {
+	EVENT_CYCLES = 0,        /**< Machine cycles */
+	EVENT_KERNEL = 1,        /**< Kernel cycles */
+	EVENT_USER = 2,          /**< User cycles */
+	EVENT_WAIT = 3,          /**< Wait cycles */
+	EVENT_TLB_REFILL = 4,    /**< TLB refill exceptions */
+	EVENT_TLB_INVALID = 5,   /**< TLB invalid exceptions */
+	EVENT_TLB_MODIFIED = 6,  /**< TLB modified exceptions */
+	EVENT_INTERRUPTS = 7,    /**< Interrupts asserted */
+	EVENT_COUNT = 8
+} cycle_event_t;
+
+/** Event names */
+static const char *const event_names[EVENT_COUNT] = {
+	"cycles",
+	"kernel",
+	"user",
+	"wait",
+	"tlb-refill",
+	"tlb-invalid",
+	"tlb-modified",
+	"interrupts"
+};
+
+/*
+ * Device commands
+ */
+
+static bool dcycle_init(parm_link_s *parm, device_s *dev);
+static bool dcycle_info(parm_link_s *parm, device_s *dev);
+static bool dcycle_stat(parm_link_s *parm, device_s *dev);
+static bool dcycle_route(parm_link_s *parm, device_s *dev);
+
+cmd_s dcycle_cmds[] = {
+	{
+		"init",
+		(cmd_f) dcycle_init,
+		DEFAULT,
+		DEFAULT,
+		"Initialization",
+		"Initialization",
+		REQ STR "name/device name" NEXT
+		REQ INT "addr/register block address" NEXT
+		REQ INT "intno/interrupt number within 0..6" END
+	},
+	{
+		"help",
+		(cmd_f) dev_generic_help,
+		DEFAULT,
+		DEFAULT,
+		"Display help",
+		"Display help",
+		OPT STR "cmd/command name" END
+	},
+	{
+		"info",
+		(cmd_f) dcycle_info,
+		DEFAULT,
+		DEFAULT,
+		"Configuration information",
+		"Configuration information",
+		NOCMD
+	},
+	{
+		"stat",
+		(cmd_f) dcycle_stat,
+		DEFAULT,
+		DEFAULT,
+		"Statistics",
+		"Statistics",
+		NOCMD
+	},
+	{
+		"route",
+		(cmd_f) dcycle_route,
+		DEFAULT,
+		DEFAULT,
+		"Set the interrupt routing",
+		"Route the interrupt to a processor (cpu no), to processors "
+			"in a mask (mask mask) or round-robin to all processors (rr)",
+		REQ STR "mode/cpu, mask or rr" NEXT
+		OPT VAR "target/processor number, mask or list" END
+	},
+	LAST_CMD
+};
+
+/**< Name of the device as presented to the user */
+const char id_dcycle[] = "dcycle";
+
+static void dcycle_done(device_s *dev);
+static void dcycle_step4(device_s *dev);
+static void dcycle_read(cpu_t *cpu, device_s *dev, ptr_t addr, uint32_t *val);
+static void dcycle_write(cpu_t *cpu, device_s *dev, ptr_t addr, uint32_t val);
+
+/**< Dcycle object structure */
+device_type_s dcycle = {
+	/* Type name and description */
+	.name = id_dcycle,
+	.brief = "Cycle counters",
+	.full = "Cycle and performance counters of the processors "
+		"with programmable counters",
+	
+	/* Functions */
+	.done = dcycle_done,
+	.step4 = dcycle_step4,
+	.read = dcycle_read,
+	.write = dcycle_write,
+	
+	/* Commands */
+	dcycle_cmds
+};
+
+/** Programmable counter structure */
+typedef struct {
+	uint32_t control;    /**< Control */
+	uint32_t value;      /**< Counter value when started */
+	uint64_t base;       /**< Event count when started */
+} cycle_counter_s;
+
+/** Dcycle instance data structure */
+typedef struct {
+	/* Configuration */
+	uint32_t addr;                        /**< Register block location */
+	int intno;                            /**< Interrupt number */
+	intr_route_t route;                   /**< Interrupt routing */
+	
+	/* Registers */
+	uint32_t latch[MAX_CPU + 1];          /**< Latched high words */
+	cycle_counter_s counters[COUNTERS];   /**< Programmable counters */
+	
+	/* Statistics */
+	uint64_t intrcount;                   /**< Number of interrupts */
+	uint64_t overflows;                   /**< Number of overflows */
+} cycle_data_s;
+
+/** Get the current count of an event
+ *
+ * @param cpu   Processor (or NULL)
+ * @param event Event
+ *
+ * @return The event count
+ *
+ */
+static uint64_t dcycle_event(cpu_t *cpu, cycle_event_t event)
+{
+	if (event == EVENT_CYCLES)
+		return msteps;
+	
+	if (cpu == NULL)
+		return 0;
+	
+	uint64_t sum;
+	unsigned int i;
+	
+	switch (event) {
+	case EVENT_KERNEL:
+		return cpu->k_cycles;
+	case EVENT_USER:
+		return cpu->u_cycles;
+	case EVENT_WAIT:
+		return cpu->w_cycles;
+	case EVENT_TLB_REFILL:
+		return cpu->tlb_refill;
+	case EVENT_TLB_INVALID:
+		return cpu->tlb_invalid;
+	case EVENT_TLB_MODIFIED:
+		return cpu->tlb_modified;
+	case EVENT_INTERRUPTS:
+		for (i = 0, sum = 0; i < INTR_COUNT; i++)
+			sum += cpu->intr[i];
+		return sum;
+	default:
+		return 0;
+	}
+}
+
+/** Get the current count of the event of a counter
+ *
+ * @param cnt Programmable counter
+ *
+ * @return The event count
+ *
+ */
+static uint64_t dcycle_counter_event(cycle_counter_s *cnt)
+{
+	unsigned int cpuno =
+	    (cnt->control & CONTROL_CPU_MASK) >> CONTROL_CPU_SHIFT;
+	
+	return dcycle_event(dcpu_find_no(cpuno),
+	    (cycle_event_t) (cnt->control & CONTROL_EVENT_MASK));
+}
+
+/** Get the value of a counter
+ *
+ * The counters are not stepped, the value is computed
+ * from the event count when the counter was started.
+ *
+ * @param cnt Programmable counter
+ *
+ * @return The counter value
+ *
+ */
+static uint32_t dcycle_counter_value(cycle_counter_s *cnt)
+{
+	if (!(cnt->control & CONTROL_ENABLE))
+		return cnt->value;
+	
+	return cnt->value + (uint32_t) (dcycle_counter_event(cnt) - cnt->base);
+}
+
+/** Restart a counter from a value
+ *
+ * @param cnt   Programmable counter
+ * @param value Counter value
+ *
+ */
+static void dcycle_counter_set(cycle_counter_s *cnt, uint32_t value)
+{
+	cnt->value = value;
+	cnt->base = dcycle_counter_event(cnt);
+}
+
+/** Deassert the interrupt if no overflow is pending
+ *
+ * @param cd Device instance data structure
+ *
+ */
+static void dcycle_intr_update(cycle_data_s *cd)
+{
+	unsigned int i;
+	for (i = 0; i < COUNTERS; i++) {
+		if ((cd->counters[i].control & (CONTROL_INT | CONTROL_OVERFLOW)) ==
+		    (CONTROL_INT | CONTROL_OVERFLOW))
+			return;
+	}
+	
+	if (cd->route.pending)
+		dcpu_route_down(&cd->route, cd->intno);
+}
+
+/** Init command implementation
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ *
+ * @return true if successful
+ *
+ */
+static bool dcycle_init(parm_link_s *parm, device_s *dev)
+{
+	cycle_data_s *cd = (cycle_data_s *) safe_malloc_t(cycle_data_s);
+	memset(cd, 0, sizeof(cycle_data_s));
+	dev->data = cd;
+	
+	parm_next(&parm);
+	cd->addr = parm_next_int(&parm);
+	cd->intno = parm_next_int(&parm);
+	dcpu_route_init(&cd->route);
+	
+	if (!addr_word_aligned(cd->addr)) {
+		mprintf("Device address must be 4-byte aligned\n");
+		free(cd);
+		return false;
+	}
+	
+	if ((uint64_t) cd->addr + (uint64_t) REGISTER_LIMIT > 0x100000000ull) {
+		mprintf("Invalid address; registers would exceed the 4 GB limit\n");
+		free(cd);
+		return false;
+	}
+	
+	if ((cd->intno < 0) || (cd->intno > 6)) {
+		mprintf("Interrupt number must be within 0..6\n");
+		free(cd);
+		return false;
+	}
+	
+	return true;
+}
+
+/** Info command implementation
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ *
+ * @return true; always successful
+ *
+ */
+static bool dcycle_info(parm_link_s *parm, device_s *dev)
+{
+	cycle_data_s *cd = (cycle_data_s *) dev->data;
+	
+	mprintf("address:%#010" PRIx32 " intno:%d route:", cd->addr,
+	    cd->intno);
+	dcpu_route_print(&cd->route);
+	mprintf("\n");
+	
+	unsigned int i;
+	for (i = 0; i < COUNTERS; i++) {
+		cycle_counter_s *cnt = &cd->counters[i];
+		cycle_event_t event =
+		    (cycle_event_t) (cnt->control & CONTROL_EVENT_MASK);
+		
+		mprintf("counter:%u event:%s cpu:%" PRIu32 " %s%s value:%#010"
+		    PRIx32 "\n", i,
+		    (event < EVENT_COUNT) ? event_names[event] : "none",
+		    (cnt->control & CONTROL_CPU_MASK) >> CONTROL_CPU_SHIFT,
+		    (cnt->control & CONTROL_ENABLE) ? "running" : "stopped",
+		    (cnt->control & CONTROL_INT) ? ",int" : "",
+		    dcycle_counter_value(cnt));
+	}
+	
+	return true;
+}
+
+/** Stat command implementation
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ *
+ * @return true; always successful
+ *
+ */
+static bool dcycle_stat(parm_link_s *parm, device_s *dev)
+{
+	cycle_data_s *cd = (cycle_data_s *) dev->data;
+	
+	mprintf("Interrupts           Overflows\n");
+	mprintf("-------------------- --------------------\n");
+	mprintf("%20" PRIu64 " %20" PRIu64 "\n", cd->intrcount, cd->overflows);
+	
+	return true;
+}
+
+/** Route command implementation
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ *
+ * @return true if successful
+ *
+ */
+static bool dcycle_route(parm_link_s *parm, device_s *dev)
+{
+	cycle_data_s *cd = (cycle_data_s *) dev->data;
+	
+	return dcpu_route_set(&cd->route, parm);
+}
+
+/** Dispose the device
+ *
+ * @param dev Device instance structure
+ *
+ */
+static void dcycle_done(device_s *dev)
+{
+	safe_free(dev->name);
+	safe_free(dev->data);
+}
+
+/** One step4 implementation
+ *
+ * The overflows are detected only here, thus the overflow
+ * interrupt can be delayed by up to 4096 cycles.
+ *
+ * @param dev Device instance structure
+ *
+ */
+static void dcycle_step4(device_s *dev)
+{
+	cycle_data_s *cd = (cycle_data_s *) dev->data;
+	
+	unsigned int i;
+	for (i = 0; i < COUNTERS; i++) {
+		cycle_counter_s *cnt = &cd->counters[i];
+		
+		if ((!(cnt->control & CONTROL_ENABLE)) ||
+		    (cnt->control & CONTROL_OVERFLOW))
+			continue;
+		
+		if (dcycle_counter_value(cnt) & COUNTER_OVERFLOW) {
+			cnt->control |= CONTROL_OVERFLOW;
+			cd->overflows++;
+			
+			if ((cnt->control & CONTROL_INT) && (!cd->route.pending)) {
+				cd->intrcount++;
+				dcpu_route_up(&cd->route, cd->intno);
+			}
+		}
+	}
+}
+
+/** Read a 64-bit register
+ *
+ * Reading the low word latches the high word. Each processor
+ * has its own latch, so that the reads do not interfere.
+ *
+ * @param cd    Device instance data structure
+ * @param latch Latch index (processor number or LATCH_OTHER)
+ * @param value Register value
+ * @param high  Read the high word
+ *
+ * @return The word read
+ *
+ */
+static uint32_t dcycle_read64(cycle_data_s *cd, unsigned int latch,
+    uint64_t value, bool high)
+{
+	if (high)
+		return cd->latch[latch];
+	
+	cd->latch[latch] = (uint32_t) (value >> 32);
+	return (uint32_t) value;
+}
+
+/** Read command implementation
+ *
+ * The statistics registers show the processor which reads
+ * (the processor 0 for other accesses).
+ *
+ * @param cpu  Processor which reads (or NULL)
+ * @param dev  Device instance structure
+ * @param addr Address of the read operation
+ * @param val  Read (returned) value
+ *
+ */
+static void dcycle_read(cpu_t *cpu, device_s *dev, ptr_t addr, uint32_t *val)
+{
+	cycle_data_s *cd = (cycle_data_s *) dev->data;
+	
+	if ((addr < cd->addr) || (addr >= cd->addr + REGISTER_LIMIT))
+		return;
+	
+	unsigned int latch = (cpu != NULL) ? cpu->procno : LATCH_OTHER;
+	
+	if (cpu == NULL)
+		cpu = dcpu_find_no(0);
+	
+	ptr_t offset = addr - cd->addr;
+	
+	if (offset >= REGISTER_CONTROL) {
+		cycle_counter_s *cnt =
+		    &cd->counters[(offset - REGISTER_CONTROL) / REGISTER_PAIR];
+		
+		if ((offset - REGISTER_CONTROL) % REGISTER_PAIR == 0)
+			*val = cnt->control;
+		else
+			*val = dcycle_counter_value(cnt);
+		
+		return;
+	}
+	
+	switch (offset) {
+	case REGISTER_CYCLES_LO:
+	case REGISTER_CYCLES_HI:
+		*val = dcycle_read64(cd, latch, msteps,
+		    offset == REGISTER_CYCLES_HI);
+		break;
+	case REGISTER_KERNEL_LO:
+	case REGISTER_KERNEL_HI:
+		*val = dcycle_read64(cd, latch, dcycle_event(cpu, EVENT_KERNEL),
+		    offset == REGISTER_KERNEL_HI);
+		break;
+	case REGISTER_USER_LO:
+	case REGISTER_USER_HI:
+		*val = dcycle_read64(cd, latch, dcycle_event(cpu, EVENT_USER),
+		    offset == REGISTER_USER_HI);
+		break;
+	case REGISTER_WAIT_LO:
+	case REGISTER_WAIT_HI:
+		*val = dcycle_read64(cd, latch, dcycle_event(cpu, EVENT_WAIT),
+		    offset == REGISTER_WAIT_HI);
+		break;
+	case REGISTER_TLB_REFILL:
+		*val = (uint32_t) dcycle_event(cpu, EVENT_TLB_REFILL);
+		break;
+	case REGISTER_TLB_INVALID:
+		*val = (uint32_t) dcycle_event(cpu, EVENT_TLB_INVALID);
+		break;
+	case REGISTER_TLB_MODIFIED:
+		*val = (uint32_t) dcycle_event(cpu, EVENT_TLB_MODIFIED);
+		break;
+	case REGISTER_INTERRUPTS:
+		*val = (uint32_t) dcycle_event(cpu, EVENT_INTERRUPTS);
+		break;
+	}
+}
+
+/** Write command implementation
+ *
+ * Writing the control register keeps the counter value,
+ * the overflow flag can only be cleared.
+ *
+ * @param cpu  Processor which writes (or NULL)
+ * @param dev  Device instance structure
+ * @param addr Address of the write operation
+ * @param val  Value to write
+ *
+ */
+static void dcycle_write(cpu_t *cpu, device_s *dev, ptr_t addr, uint32_t val)
+{
+	cycle_data_s *cd = (cycle_data_s *) dev->data;
+	
+	if ((addr < cd->addr + REGISTER_CONTROL) ||
+	    (addr >= cd->addr + REGISTER_LIMIT))
+		return;
+	
+	ptr_t offset = addr - cd->addr - REGISTER_CONTROL;
+	cycle_counter_s *cnt = &cd->counters[offset / REGISTER_PAIR];
+	
+	if (offset % REGISTER_PAIR == 0) {
+		uint32_t value = dcycle_counter_value(cnt);
+		
+		cnt->control = (val & CONTROL_MASK) &
+		    (cnt->control | ~CONTROL_OVERFLOW);
+		dcycle_counter_set(cnt, value);
+	} else
+		dcycle_counter_set(cnt, val);
+	
+	dcycle_intr_update(cd);
+}
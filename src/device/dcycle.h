@@ -0,0 +1,19 @@
+/*
+ * Copyright (c) 2008 Martin Decky
+ * All rights reserved.
+ *
+ * Distributed under the terms of GPL.
+ *
+ *
+ *  Cycle and performance counters
+ *
+ */
+
+#ifndef DCYCLE_H_
+#define DCYCLE_H_
+
+#include "device.h"
+
+extern device_type_s dcycle;
+
+#endif /* DCYCLE_H_ */
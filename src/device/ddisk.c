@@ -21,6 +21,7 @@
 
 #include "../text.h"
 #include "../arch/mmap.h"
+#include "../arch/blkio.h"
 #include "machine.h"
 #include "dcpu.h"
 #include "../fault.h"
@@ -44,6 +45,35 @@ enum action_e {
 #define REGISTER_LIMIT    16  /**< Size of register block */
 /* \} */
 
+/** \{ \name Extended register offsets (optional block) */
+#define REGISTER_EXT_COUNT      0   /**< Sector count of a command */
+#define REGISTER_EXT_RING_ADDR  4   /**< Descriptor ring address */
+#define REGISTER_EXT_RING_SIZE  8   /**< Number of ring descriptors */
+#define REGISTER_EXT_RING_HEAD  12  /**< Producer index (doorbell) */
+#define REGISTER_EXT_RING_TAIL  16  /**< Consumer index */
+#define REGISTER_EXT_LIMIT      20  /**< Size of extended register block */
+/* \} */
+
+/** Size of the changed sectors bitmap of a disk */
+#define DIRTY_SIZE(size)  (ALIGN_UP((size) / 512, 8) / 8)
+
+/** Largest request of the file backend (sectors of the transfer buffer) */
+#define FILE_MAX_COUNT  2048
+
+/** Delta file signature */
+#define DELTA_MAGIC  0x746c6464
+
+/** \{ \name Ring descriptor words */
+#define DESC_COMMAND  0  /**< Command, completion status when done */
+#define DESC_SECNO    1  /**< First sector */
+#define DESC_COUNT    2  /**< Number of sectors */
+#define DESC_ADDR     3  /**< Physical memory address */
+#define DESC_WORDS    4  /**< Descriptor size in words */
+/* \} */
+
+/** Descriptor completion flag */
+#define DESC_DONE  0x80000000U
+
 /** \{ \name Status flags */
 #define STATUS_INT    0x04  /**< Interrupt pending */
 #define STATUS_ERROR  0x08  /**< Command error */
@@ -61,7 +91,9 @@ enum action_e {
 enum disk_type_e {
 	DISKT_NONE,  /**< Uninitialized */
 	DISKT_MEM,   /**< Memory-only disk */
-	DISKT_FMAP   /**< File-mapped */
+	DISKT_FMAP,  /**< File-mapped */
+	DISKT_FILE,    /**< Host file accessed by asynchronous I/O */
+	DISKT_OVERLAY  /**< Copy-on-write overlay of a base image */
 };
 
 /*
@@ -73,9 +105,15 @@ static bool ddisk_info(parm_link_s *parm, device_s *dev);
 static bool ddisk_stat(parm_link_s *parm, device_s *dev);
 static bool ddisk_generic(parm_link_s *parm, device_s *dev);
 static bool ddisk_fmap(parm_link_s *parm, device_s *dev);
+static bool ddisk_file(parm_link_s *parm, device_s *dev);
+static bool ddisk_overlay(parm_link_s *parm, device_s *dev);
+static bool ddisk_commit(parm_link_s *parm, device_s *dev);
+static bool ddisk_discard(parm_link_s *parm, device_s *dev);
 static bool ddisk_fill(parm_link_s *parm, device_s *dev);
 static bool ddisk_load(parm_link_s *parm, device_s *dev);
 static bool ddisk_save(parm_link_s *parm, device_s *dev);
+static bool ddisk_route(parm_link_s *parm, device_s *dev);
+static bool ddisk_dma(parm_link_s *parm, device_s *dev);
 
 cmd_s ddisk_cmds[] = {
 	{
@@ -87,7 +125,8 @@ cmd_s ddisk_cmds[] = {
 		"Initialization",
 		REQ STR "name/disk name" NEXT
 		REQ INT "addr/register block address" NEXT
-		REQ INT "intno/interrupt number within 0..6" END
+		REQ INT "intno/interrupt number within 0..6" NEXT
+		OPT INT "ext_addr/extended register block address" END
 	},
 	{
 		"help",
@@ -134,6 +173,48 @@ cmd_s ddisk_cmds[] = {
 		"Map the memory as the file specified",
 		REQ STR "fname/file name" END
 	},
+	{
+		"file",
+		(cmd_f) ddisk_file,
+		DEFAULT,
+		DEFAULT,
+		"Access the file specified by asynchronous host I/O",
+		"Access the file specified by asynchronous host I/O; sectors "
+			"are read and written by a worker thread on demand",
+		REQ STR "fname/file name" END
+	},
+	{
+		"overlay",
+		(cmd_f) ddisk_overlay,
+		DEFAULT,
+		DEFAULT,
+		"Overlay the base image file specified",
+		"Read the sectors from the base image file specified and keep "
+			"the written sectors in memory; the changes are committed "
+			"or discarded (default) at exit",
+		REQ STR "fname/base image file name" NEXT
+		OPT STR "exit/commit or discard" END
+	},
+	{
+		"commit",
+		(cmd_f) ddisk_commit,
+		DEFAULT,
+		DEFAULT,
+		"Write the changed sectors of the overlay",
+		"Replace the base image by a new file with the changes "
+			"or write the changed sectors at their offsets into "
+			"the (sparse) delta file specified",
+		OPT STR "fname/delta file name" END
+	},
+	{
+		"discard",
+		(cmd_f) ddisk_discard,
+		DEFAULT,
+		DEFAULT,
+		"Discard the changed sectors of the overlay",
+		"Discard the changed sectors of the overlay",
+		NOCMD
+	},
 	{
 		"fill",
 		(cmd_f) ddisk_fill,
@@ -149,8 +230,10 @@ cmd_s ddisk_cmds[] = {
 		DEFAULT,
 		DEFAULT,
 		"Load the memory image from the file specified",
-		"Load the memory image from the file specified",
-		REQ STR "fname/file name" END
+		"Load the memory image from the file specified or apply "
+			"the delta file specified (delta)",
+		REQ STR "fname/file name" NEXT
+		OPT STR "mode/full or delta" END
 	},
 	{
 		"save",
@@ -158,8 +241,32 @@ cmd_s ddisk_cmds[] = {
 		DEFAULT,
 		DEFAULT,
 		"Save the memory image into the file specified",
-		"Save the memory image into the file specified",
-		REQ STR "fname/file name" END
+		"Save the whole memory image (full), only the sectors written "
+			"since the last save in place (dirty) or as a delta file (delta)",
+		REQ STR "fname/file name" NEXT
+		OPT STR "mode/full, dirty or delta" END
+	},
+	{
+		"route",
+		(cmd_f) ddisk_route,
+		DEFAULT,
+		DEFAULT,
+		"Set the interrupt routing",
+		"Route the interrupt to a processor (cpu no), to processors "
+			"in a mask (mask mask) or round-robin to all processors (rr)",
+		REQ STR "mode/cpu, mask or rr" NEXT
+		OPT VAR "target/processor number, mask or list" END
+	},
+	{
+		"dma",
+		(cmd_f) ddisk_dma,
+		DEFAULT,
+		DEFAULT,
+		"Set the DMA transfer mode",
+		"Transfer one word per cycle (word) or the whole sector at once "
+			"with the completion interrupt after the latency in cycles (bulk)",
+		REQ STR "mode/word or bulk" NEXT
+		OPT INT "latency/completion latency in cycles" END
 	},
 	LAST_CMD
 };
@@ -192,24 +299,53 @@ device_type_s ddisk = {
 /** Disk instance data structure */
 typedef struct {
 	uint32_t *img;  /**< Disk image memory */
+	blkio_t *bio;   /**< Host file (DISKT_FILE) */
+	uint32_t *buf;  /**< Transfer buffer (DISKT_FILE) */
+	size_t buf_size;  /**< Transfer buffer size */
+	char *base;       /**< Base image path (DISKT_OVERLAY) */
+	uint8_t *changed; /**< Sectors changed against the base (DISKT_OVERLAY) */
+	uint8_t *dirty;   /**< Sectors written since the last save */
+	bool commit;      /**< Commit the overlay at exit */
+	
+	/* File the dirty sectors are relative to (loaded or saved last) */
+	char *save_path;     /**< Path (or NULL) */
+	uint64_t save_size;  /**< Size of the file */
+	time_t save_mtime;   /**< Modification time of the file */
 	
 	/* Configuration */
 	int intno;                   /**< Interrupt number */
+	intr_route_t route;          /**< Interrupt routing */
 	enum disk_type_e disk_type;  /**< Disk type: none, memory, file-mapped */
 	uint32_t addr;               /**< Disk memory location */
+	bool ext;                    /**< Extended register block present */
+	uint32_t ext_addr;           /**< Extended register block location */
 	uint32_t size;               /**< Disk size */
+	bool bulk;                   /**< Transfer whole sectors at once */
+	uint32_t latency;            /**< Bulk transfer completion latency */
 	
 	/* Registers */
 	uint32_t disk_wptr;     /**< Current write pointer */
 	uint32_t disk_secno;    /**< Active sector to read/write */
 	uint32_t disk_status;   /**< Disk status register */
 	uint32_t disk_command;  /**< Disk command register */
+	uint32_t disk_count;    /**< Sector count register */
+	uint32_t ring_addr;     /**< Descriptor ring address */
+	uint32_t ring_size;     /**< Number of ring descriptors */
+	uint32_t ring_head;     /**< Ring producer index */
+	uint32_t ring_tail;     /**< Ring consumer index */
 	
 	/* Current action variables */
 	enum action_e action;  /**< Action type */
 	unsigned int secno;    /**< Sector number */
+	unsigned int count;    /**< Number of sectors */
 	unsigned int cnt;      /**< Word counter */
+	uint32_t *data;        /**< Sector data of the action */
+	bool io_pending;       /**< Waiting for the host I/O */
+	uint64_t delay;        /**< Cycles left until completion (bulk mode) */
 	bool ig;               /**< Interrupt pending flag */
+	bool from_ring;        /**< Action is a ring request */
+	ptr_t desc_addr;       /**< Descriptor of the ring request */
+	bool ring_error;       /**< A ring request has failed */
 	
 	/* Statistics */
 	uint64_t intrcount;   /**< Number of interrupts */
@@ -262,9 +398,82 @@ static void ddisk_free(disk_data_s *dd)
  */
 static void ddisk_cancel_action(disk_data_s *dd)
 {
+	/* The transfer buffer is owned by the host I/O
+	   until the request finishes */
+	if (dd->io_pending) {
+		blkio_wait(dd->bio);
+		dd->io_pending = false;
+	}
+	
 	dd->action = ACTION_NONE;
 	dd->disk_wptr = 0;
 	dd->cnt = 0;
+	dd->delay = 0;
+	dd->from_ring = false;
+	dd->ring_head = 0;
+	dd->ring_tail = 0;
+}
+
+/** Forget the file the dirty sectors are relative to
+ *
+ * @param dd Disk instance data structure
+ *
+ */
+static void ddisk_save_forget(disk_data_s *dd)
+{
+	if (dd->save_path != NULL) {
+		safe_free(dd->save_path);
+		dd->save_path = NULL;
+	}
+}
+
+/** Remember the file the dirty sectors are relative to
+ *
+ * The size and the modification time of the file are kept,
+ * so that a file changed by somebody else is not updated
+ * in place.
+ *
+ * @param dd   Disk instance data structure
+ * @param path File name
+ *
+ * @return true if the file has been remembered
+ *
+ */
+static bool ddisk_save_track(disk_data_s *dd, const char *path)
+{
+	ddisk_save_forget(dd);
+	
+	struct stat st;
+	if (stat(path, &st) == -1)
+		return false;
+	
+	dd->save_path = safe_strdup(path);
+	dd->save_size = (uint64_t) st.st_size;
+	dd->save_mtime = st.st_mtime;
+	
+	return true;
+}
+
+/** Check whether a file is the one the dirty sectors are relative to
+ *
+ * @param dd   Disk instance data structure
+ * @param path File name
+ *
+ * @return true if the file is the one loaded or saved last
+ *         and it has not been changed since
+ *
+ */
+static bool ddisk_save_match(disk_data_s *dd, const char *path)
+{
+	if ((dd->save_path == NULL) || (strcmp(dd->save_path, path) != 0))
+		return false;
+	
+	struct stat st;
+	if (stat(path, &st) == -1)
+		return false;
+	
+	return (((uint64_t) st.st_size == dd->save_size) &&
+	    (dd->save_size == dd->size) && (st.st_mtime == dd->save_mtime));
 }
 
 /** Clean up old configuration
@@ -287,8 +496,21 @@ static void ddisk_clean_up(disk_data_s *dd)
 	case DISKT_FMAP:
 		try_munmap(dd->img, dd->size);
 		break;
+	case DISKT_FILE:
+		blkio_close(dd->bio);
+		dd->bio = NULL;
+		safe_free(dd->buf);
+		dd->buf_size = 0;
+		break;
+	case DISKT_OVERLAY:
+		try_munmap(dd->img, dd->size);
+		safe_free(dd->changed);
+		safe_free(dd->base);
+		break;
 	}
 	
+	safe_free(dd->dirty);
+	ddisk_save_forget(dd);
 	dd->size = 0;
 	dd->disk_type = DISKT_NONE;
 }
@@ -317,19 +539,47 @@ static bool ddisk_init(parm_link_s *parm, device_s *dev)
 	parm_next(&parm);
 	dd->addr = parm_next_int(&parm);
 	dd->intno = parm_next_int(&parm);
+	dcpu_route_init(&dd->route);
 	dd->size = 0;
+	dd->bulk = false;
+	dd->latency = 0;
+	dd->delay = 0;
 	dd->disk_wptr = 0;
 	dd->disk_secno = 0;
 	dd->disk_status = 0;
 	dd->disk_command = 0;
+	dd->disk_count = 1;
+	dd->ring_addr = 0;
+	dd->ring_size = 0;
+	dd->ring_head = 0;
+	dd->ring_tail = 0;
 	dd->img = (uint32_t *) MAP_FAILED;
+	dd->bio = NULL;
+	dd->buf = NULL;
+	dd->buf_size = 0;
+	dd->base = NULL;
+	dd->changed = NULL;
+	dd->dirty = NULL;
+	dd->commit = false;
+	dd->save_path = NULL;
+	
+	dd->ext = (parm_type(parm) == tt_int);
+	dd->ext_addr = dd->ext ? parm_int(parm) : 0;
 	
 	dd->action = ACTION_NONE;
+	dd->count = 0;
+	dd->cnt = 0;
+	dd->data = NULL;
+	dd->io_pending = false;
+	dd->from_ring = false;
+	dd->desc_addr = 0;
+	dd->ring_error = false;
 	
 	dd->ig = false;
 	dd->intrcount = 0;
 	dd->cmds_read = 0;
 	dd->cmds_write = 0;
+	dd->cmds_error = 0;
 	
 	dd->disk_type = DISKT_NONE;
 	
@@ -349,12 +599,35 @@ static bool ddisk_init(parm_link_s *parm, device_s *dev)
 	}
 	
 	/* Interrupt no */
-	if (dd->intno > 6) {
+	if ((dd->intno < 0) || (dd->intno > 6)) {
 		mprintf(txt_intnum_range);
 		free(dd);
 		return false;
 	}
 	
+	/* Extended register block */
+	if (dd->ext) {
+		if (!addr_word_aligned(dd->ext_addr)) {
+			mprintf("Disk extended address must be 4-byte aligned\n");
+			free(dd);
+			return false;
+		}
+		
+		if ((uint64_t) dd->ext_addr + (uint64_t) REGISTER_EXT_LIMIT
+		    > 0x100000000ull) {
+			mprintf("Invalid address; registers would exceed the 4GB limit\n");
+			free(dd);
+			return false;
+		}
+		
+		if ((dd->ext_addr < dd->addr + REGISTER_LIMIT) &&
+		    (dd->addr < dd->ext_addr + REGISTER_EXT_LIMIT)) {
+			mprintf("Extended registers overlap the basic registers\n");
+			free(dd);
+			return false;
+		}
+	}
+	
 	return true;
 }
 
@@ -381,6 +654,12 @@ static bool ddisk_info(parm_link_s *parm, device_s *dev)
 	case DISKT_FMAP:
 		stype = "file-map";
 		break;
+	case DISKT_FILE:
+		stype = "file";
+		break;
+	case DISKT_OVERLAY:
+		stype = "overlay";
+		break;
 	}
 	
 	mprintf("address:0x%08x intno:%d size:%s type:%s regs(mem:0x%08x "
@@ -390,6 +669,22 @@ static bool ddisk_info(parm_link_s *parm, device_s *dev)
 	    (int) dd->disk_secno, (unsigned int) dd->disk_status,
 	    (unsigned int) dd->disk_command, (int) dd->ig);
 	
+	mprintf("route:");
+	dcpu_route_print(&dd->route);
+	
+	if (dd->bulk)
+		mprintf(" dma:bulk latency:%" PRIu32, dd->latency);
+	else
+		mprintf(" dma:word");
+	
+	if (dd->ext)
+		mprintf(" ext:0x%08x count:%" PRIu32 " ring(addr:0x%08x size:%" PRIu32
+		    " head:%" PRIu32 " tail:%" PRIu32 ")\n", (unsigned int) dd->ext_addr,
+		    dd->disk_count, (unsigned int) dd->ring_addr, dd->ring_size,
+		    dd->ring_head, dd->ring_tail);
+	else
+		mprintf("\n");
+	
 	return true;
 }
 
@@ -418,6 +713,35 @@ static bool ddisk_stat(parm_link_s *parm, device_s *dev)
 	return true;
 }
 
+/** Mark sectors as written
+ *
+ * @param dd    Disk instance data structure
+ * @param secno First sector
+ * @param count Number of sectors
+ *
+ */
+static void ddisk_mark_dirty(disk_data_s *dd, uint32_t secno, uint32_t count)
+{
+	for (uint32_t i = secno; i < secno + count; i++) {
+		if (dd->dirty != NULL)
+			dd->dirty[i / 8] |= 1 << (i % 8);
+		
+		if (dd->changed != NULL)
+			dd->changed[i / 8] |= 1 << (i % 8);
+	}
+}
+
+/** Start tracking the written sectors of a new image
+ *
+ * @param dd Disk instance data structure
+ *
+ */
+static void ddisk_dirty_init(disk_data_s *dd)
+{
+	dd->dirty = (uint8_t *) safe_malloc(DIRTY_SIZE(dd->size));
+	memset(dd->dirty, 0, DIRTY_SIZE(dd->size));
+}
+
 /* Make the disk mapped to a memory block
  *
  * @param parm Command-line parameters
@@ -443,50 +767,49 @@ static bool ddisk_generic(parm_link_s *parm, device_s *dev)
 	dd->size = size;
 	ddisk_malloc(dd);
 	/* Disk type already set by ddisk_malloc. */
+	ddisk_dirty_init(dd);
 	
 	return true;
 }
 
 
-/** Fmap command implementation
+/** Map a disk image file
  *
- * Map the disk to a file. The allocated memory block is disposed.
+ * @param path   File name
+ * @param shared Map the file shared (changes are written to the file)
+ *               or private (changes are kept in memory)
+ * @param size   Mapped disk size is returned through this parameter
  *
- * @param parm Command-line parameters
- * @param dev  Device instance structure
- * @return true if successful
+ * @return Mapped image or MAP_FAILED on failure
  *
  */
-static bool ddisk_fmap(parm_link_s *parm, device_s *dev)
+static void *ddisk_map_file(const char *path, bool shared, uint32_t *size)
 {
-	disk_data_s *dd = (disk_data_s *) dev->data;
-	const char *const path = parm_str(parm);
-	
-	FILE *file = try_fopen(path, "rb+");
+	FILE *file = try_fopen(path, shared ? "rb+" : "rb");
 	if (file == NULL) {
 		io_error(path);
 		mprintf("%s\n", txt_file_open_err);
-		return false;
+		return MAP_FAILED;
 	}
 	
 	/* File size test */
 	if (!try_fseek(file, 0, SEEK_END, path)) {
 		mprintf("%s\n", txt_file_seek_err);
 		try_soft_fclose(file, path);
-		return false;
+		return MAP_FAILED;
 	}
 	
 	size_t fsize;
 	if (!try_ftell(file, path, &fsize)) {
 		mprintf("%s\n", txt_file_seek_err);
 		try_soft_fclose(file, path);
-		return false;
+		return MAP_FAILED;
 	}
 	
 	if (fsize == 0) {
 		mprintf("Empty file\n");
 		try_soft_fclose(file, path);
-		return false;
+		return MAP_FAILED;
 	}
 	
 	/* Align the file size to the nearest
@@ -497,115 +820,153 @@ static bool ddisk_fmap(parm_link_s *parm, device_s *dev)
 	if (fsize == 0) {
 		mprintf("File is too small; at least one sector (512 B) should be present");
 		try_soft_fclose(file, path);
-		return false;
+		return MAP_FAILED;
 	}
 	
 	if (!try_fseek(file, 0, SEEK_SET, path)) {
 		mprintf("%s\n", txt_file_seek_err);
 		try_soft_fclose(file, path);
-		return false;
+		return MAP_FAILED;
 	}
 	
 	int fd = fileno(file);
-	void *ptr = mmap(0, fsize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	void *ptr = mmap(0, fsize, PROT_READ | PROT_WRITE,
+	    shared ? MAP_SHARED : MAP_PRIVATE, fd, 0);
 	
 	if (ptr == MAP_FAILED) {
 		io_error(path);
 		mprintf("%s\n", txt_file_map_fail);
 		try_soft_fclose(file, path);
-		return false;
+		return MAP_FAILED;
 	}
 	
 	/* Close file */
 	if (!try_fclose(file, path)) {
 		mprintf(txt_file_close_err);
-		return false;
+		try_munmap(ptr, fsize);
+		return MAP_FAILED;
 	}
 	
+	*size = fsize;
+	return ptr;
+}
+
+/** Fmap command implementation
+ *
+ * Map the disk to a file. The allocated memory block is disposed.
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ * @return true if successful
+ *
+ */
+static bool ddisk_fmap(parm_link_s *parm, device_s *dev)
+{
+	disk_data_s *dd = (disk_data_s *) dev->data;
+	uint32_t size;
+	
+	void *ptr = ddisk_map_file(parm_str(parm), true, &size);
+	if (ptr == MAP_FAILED)
+		return false;
+	
 	/* Upgrade structures and reset the device */
 	ddisk_clean_up(dd);
-	dd->size = fsize;
+	dd->size = size;
 	dd->disk_type = DISKT_FMAP;
 	dd->img = (uint32_t *) ptr;
+	ddisk_dirty_init(dd);
 	
 	return true;
 }
 
-/** Fill command implementation
+/** Overlay command implementation
  *
- * Fill the disk image with a specified character (byte).
+ * Map the base image privately. The written sectors are kept
+ * in memory and tracked in the dirty bitmap.
  *
  * @param parm Command-line parameters
  * @param dev  Device instance structure
- *
  * @return true if successful
  *
  */
-static bool ddisk_fill(parm_link_s *parm, device_s *dev)
+static bool ddisk_overlay(parm_link_s *parm, device_s *dev)
 {
 	disk_data_s *dd = (disk_data_s *) dev->data;
-	unsigned char c;
+	const char *const path = parm_next_str(&parm);
+	bool commit = false;
+	uint32_t size;
 	
-	/* String/character */
 	if (parm_type(parm) == tt_str) {
-		if ((!parm_str(parm)[0]) || (parm_str(parm)[1])) {
-			mprintf("Invalid string parameter; exactly one character is necessary.\n");
-			return false;
-		}
+		const char *const policy = parm_str(parm);
 		
-		c = parm_str(parm)[0];
-	} else {
-		/* Number */
-		if (parm_int(parm) > 255) {
-			mprintf("Integer constant out of range 0..255\n");
+		if (strcmp(policy, "commit") == 0)
+			commit = true;
+		else if (strcmp(policy, "discard") != 0) {
+			mprintf("Unknown exit policy, commit or discard expected\n");
 			return false;
 		}
-		
-		c = parm_int(parm);
 	}
 	
-	memset(dd->img, c, dd->size);
+	void *ptr = ddisk_map_file(path, false, &size);
+	if (ptr == MAP_FAILED)
+		return false;
+	
+	/* Upgrade structures and reset the device */
+	ddisk_clean_up(dd);
+	dd->size = size;
+	dd->disk_type = DISKT_OVERLAY;
+	dd->img = (uint32_t *) ptr;
+	dd->base = safe_strdup(path);
+	dd->changed = (uint8_t *) safe_malloc(DIRTY_SIZE(size));
+	memset(dd->changed, 0, DIRTY_SIZE(size));
+	dd->commit = commit;
+	ddisk_dirty_init(dd);
 	
 	return true;
 }
 
-/** Load command implementation
+/** Write the sectors marked in a bitmap in place
  *
- * Load the content of the file "filename" to the disk image.
- *
- * @param parm Command-line parameters
- * @param dev  Device instance structure
+ * @param dd     Disk instance data structure
+ * @param map    Sectors to write
+ * @param path   Target file name
+ * @param create Create a (sparse) file if it does not exist
  *
  * @return true if successful
  *
  */
-static bool ddisk_load(parm_link_s *parm, device_s *dev)
+static bool ddisk_write_dirty(disk_data_s *dd, const uint8_t *map,
+    const char *path, bool create)
 {
-	disk_data_s *dd = (disk_data_s *) dev->data;
-	const char *const path = parm_str(parm);
-	
-	if (dd->disk_type == DISKT_NONE) {
-		/* Illegal */
-		return false;
-	}
+	/* Sectors are written at their offsets,
+	   a new delta file is left sparse */
+	FILE *file = create ? fopen(path, "rb+") : try_fopen(path, "rb+");
+	if ((file == NULL) && (create))
+		file = try_fopen(path, "wb");
 	
-	/* Open file */
-	FILE *file = try_fopen(path, "rb");
 	if (file == NULL) {
-		mprintf(txt_file_open_err);
+		mprintf("%s\n", txt_file_open_err);
 		return false;
 	}
 	
-	/* Read the file directly */
-	size_t rd = fread(dd->img, 1, dd->size, file);
-	if (rd < dd->size) {
-		io_error(path);
-		mprintf(txt_file_read_err);
-		try_soft_fclose(file, path);
-		return false;
+	for (uint32_t i = 0; i < dd->size / 512; i++) {
+		if ((map[i / 8] & (1 << (i % 8))) == 0)
+			continue;
+		
+		if (!try_fseek(file, (size_t) i * 512, SEEK_SET, path)) {
+			mprintf("%s\n", txt_file_seek_err);
+			try_soft_fclose(file, path);
+			return false;
+		}
+		
+		if (fwrite(&dd->img[i * 128], 1, 512, file) < 512) {
+			io_error(path);
+			mprintf(txt_file_write_err);
+			try_soft_fclose(file, path);
+			return false;
+		}
 	}
 	
-	/* Close file */
 	if (!try_fclose(file, path)) {
 		mprintf(txt_file_close_err);
 		return false;
@@ -614,44 +975,50 @@ static bool ddisk_load(parm_link_s *parm, device_s *dev)
 	return true;
 }
 
-/** Save command implementation
+/** Save the sectors written since the last save as a delta file
  *
- * Save the disk content to the file specified.
+ * The delta file consists of a header (signature, disk size and
+ * number of sectors) followed by the sector number and contents
+ * of each sector.
  *
- * @param parm Command-line parameters
- * @param dev  Device instance structure
+ * @param dd   Disk instance data structure
+ * @param path Target file name
  *
  * @return true if successful
  *
  */
-static bool ddisk_save(parm_link_s *parm, device_s *dev)
+static bool ddisk_save_delta(disk_data_s *dd, const char *path)
 {
-	disk_data_s *dd = (disk_data_s *) dev->data;
-	const char *const path = parm_str(parm);
+	uint32_t header[3] = {DELTA_MAGIC, dd->size, 0};
 	
-	/* Do not write anything when
-	   the image is not initialized */
-	if (dd->disk_type == DISKT_NONE)
-		return true;
+	for (uint32_t i = 0; i < dd->size / 512; i++) {
+		if ((dd->dirty[i / 8] & (1 << (i % 8))) != 0)
+			header[2]++;
+	}
 	
-	/* Create file */
 	FILE *file = try_fopen(path, "wb");
 	if (file == NULL) {
-		io_error(path);
 		mprintf(txt_file_create_err);
-		return true;
+		return false;
 	}
 	
-	/* Write data */
-	size_t wr = fwrite(dd->img, 1, dd->size, file);
-	if (wr < dd->size) {
+	bool ok = (fwrite(header, sizeof(header), 1, file) == 1);
+	
+	for (uint32_t i = 0; (ok) && (i < dd->size / 512); i++) {
+		if ((dd->dirty[i / 8] & (1 << (i % 8))) == 0)
+			continue;
+		
+		ok = (fwrite(&i, sizeof(i), 1, file) == 1) &&
+		    (fwrite(&dd->img[i * 128], 512, 1, file) == 1);
+	}
+	
+	if (!ok) {
 		io_error(path);
 		mprintf(txt_file_write_err);
 		try_soft_fclose(file, path);
 		return false;
 	}
 	
-	/* Close file */
 	if (!try_fclose(file, path)) {
 		mprintf(txt_file_close_err);
 		return false;
@@ -660,45 +1027,815 @@ static bool ddisk_save(parm_link_s *parm, device_s *dev)
 	return true;
 }
 
-/** Dispose disk
- *
- * @param d Device pointer
+/** Apply a delta file to the disk image
  *
- */
-static void ddisk_done(device_s *d) {
-	disk_data_s *dd = (disk_data_s *) d->data;
-	
-	ddisk_clean_up(dd);
-	
-	safe_free(d->name);
-	safe_free(d->data);
-}
-
-/** Read command implementation
+ * @param dd   Disk instance data structure
+ * @param path Delta file name
  *
- * @param d    Ddisk device pointer
- * @param addr Address of the read operation
- * @param val  Readed (returned) value
+ * @return true if successful
  *
  */
-static void ddisk_read(cpu_t *cpu, device_s *dev, ptr_t addr,
-    uint32_t *val)
+static bool ddisk_load_delta(disk_data_s *dd, const char *path)
 {
-	disk_data_s *dd = (disk_data_s *) dev->data;
+	uint32_t header[3];
 	
-	/* Do nothing if the disk is not initialized. */
-	if (dd->disk_type == DISKT_NONE)
-		return;
+	FILE *file = try_fopen(path, "rb");
+	if (file == NULL) {
+		mprintf(txt_file_open_err);
+		return false;
+	}
 	
-	/* Read internal registers. */
-	if (addr == dd->addr + REGISTER_ADDR)
-		*val = dd->disk_wptr;
-	else if (addr == dd->addr + REGISTER_SECNO)
-		*val = dd->disk_secno;
+	if ((fread(header, sizeof(header), 1, file) != 1) ||
+	    (header[0] != DELTA_MAGIC)) {
+		mprintf("Not a delta file\n");
+		try_soft_fclose(file, path);
+		return false;
+	}
+	
+	if (header[1] != dd->size) {
+		mprintf("Delta file size does not match the disk size\n");
+		try_soft_fclose(file, path);
+		return false;
+	}
+	
+	for (uint32_t n = 0; n < header[2]; n++) {
+		uint32_t secno;
+		
+		if ((fread(&secno, sizeof(secno), 1, file) != 1) ||
+		    (secno >= dd->size / 512) ||
+		    (fread(&dd->img[secno * 128], 512, 1, file) != 1)) {
+			io_error(path);
+			mprintf(txt_file_read_err);
+			try_soft_fclose(file, path);
+			return false;
+		}
+		
+		ddisk_mark_dirty(dd, secno, 1);
+	}
+	
+	if (!try_fclose(file, path)) {
+		mprintf(txt_file_close_err);
+		return false;
+	}
+	
+	return true;
+}
+
+/** Commit the overlay to the base image
+ *
+ * Other overlays may map the base image privately, the pages they
+ * have not copied yet would change if the file was written in place.
+ * Therefore the whole image is written into a new file which then
+ * replaces the base image, while the other overlays keep the original.
+ *
+ * @param dd Disk instance data structure
+ *
+ * @return true if successful
+ *
+ */
+static bool ddisk_commit_base(disk_data_s *dd)
+{
+	string_t tmp;
+	string_init(&tmp);
+	string_printf(&tmp, "%s.commit", dd->base);
+	
+	FILE *file = try_fopen(tmp.str, "wb");
+	if (file == NULL) {
+		mprintf("%s\n", txt_file_create_err);
+		string_done(&tmp);
+		return false;
+	}
+	
+	if (fwrite(dd->img, 1, dd->size, file) < dd->size) {
+		io_error(tmp.str);
+		mprintf(txt_file_write_err);
+		try_soft_fclose(file, tmp.str);
+		(void) remove(tmp.str);
+		string_done(&tmp);
+		return false;
+	}
+	
+	if (!try_fclose(file, tmp.str)) {
+		mprintf(txt_file_close_err);
+		(void) remove(tmp.str);
+		string_done(&tmp);
+		return false;
+	}
+	
+	/* Keep the permissions of the base image */
+	struct stat st;
+	if (stat(dd->base, &st) == 0)
+		(void) chmod(tmp.str, st.st_mode & 07777);
+	
+	if (rename(tmp.str, dd->base) == -1) {
+		io_error(dd->base);
+		mprintf("Cannot replace the base image\n");
+		(void) remove(tmp.str);
+		string_done(&tmp);
+		return false;
+	}
+	
+	string_done(&tmp);
+	return true;
+}
+
+/** Commit command implementation
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ * @return true if successful
+ *
+ */
+static bool ddisk_commit(parm_link_s *parm, device_s *dev)
+{
+	disk_data_s *dd = (disk_data_s *) dev->data;
+	
+	if (dd->disk_type != DISKT_OVERLAY) {
+		mprintf("Not an overlay\n");
+		return false;
+	}
+	
+	/* Delta file */
+	if (parm_type(parm) == tt_str)
+		return ddisk_write_dirty(dd, dd->changed, parm_str(parm), true);
+	
+	if (!ddisk_commit_base(dd))
+		return false;
+	
+	memset(dd->changed, 0, DIRTY_SIZE(dd->size));
+	return true;
+}
+
+/** Discard command implementation
+ *
+ * Map the base image again.
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ * @return true if successful
+ *
+ */
+static bool ddisk_discard(parm_link_s *parm, device_s *dev)
+{
+	disk_data_s *dd = (disk_data_s *) dev->data;
+	uint32_t size;
+	
+	if (dd->disk_type != DISKT_OVERLAY) {
+		mprintf("Not an overlay\n");
+		return false;
+	}
+	
+	if (dd->action != ACTION_NONE) {
+		mprintf("Disk is busy\n");
+		return false;
+	}
+	
+	void *ptr = ddisk_map_file(dd->base, false, &size);
+	if (ptr == MAP_FAILED)
+		return false;
+	
+	try_munmap(dd->img, dd->size);
+	dd->img = (uint32_t *) ptr;
+	
+	/* The base image may have changed in the meantime */
+	if (size != dd->size) {
+		safe_free(dd->changed);
+		safe_free(dd->dirty);
+		dd->changed = (uint8_t *) safe_malloc(DIRTY_SIZE(size));
+		dd->size = size;
+		ddisk_dirty_init(dd);
+		ddisk_mark_dirty(dd, 0, size / 512);
+	} else {
+		/* Reverted sectors differ from the last save */
+		for (size_t i = 0; i < DIRTY_SIZE(size); i++)
+			dd->dirty[i] |= dd->changed[i];
+	}
+	
+	memset(dd->changed, 0, DIRTY_SIZE(dd->size));
+	return true;
+}
+
+/** File command implementation
+ *
+ * Access the disk image in a host file by asynchronous block requests.
+ * The allocated memory block is disposed.
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ * @return true if successful
+ *
+ */
+static bool ddisk_file(parm_link_s *parm, device_s *dev)
+{
+	disk_data_s *dd = (disk_data_s *) dev->data;
+	const char *const path = parm_str(parm);
+	uint64_t fsize;
+	
+	blkio_t *bio = blkio_open(path, &fsize);
+	if (bio == NULL) {
+		io_error(path);
+		mprintf("%s\n", txt_file_open_err);
+		return false;
+	}
+	
+	/* Align the file size to the nearest
+	   smalled 512 B block */
+	fsize = ALIGN_DOWN(fsize, 512);
+	
+	/* Disk size test */
+	if (fsize == 0) {
+		mprintf("File is too small; at least one sector (512 B) should be present\n");
+		blkio_close(bio);
+		return false;
+	}
+	
+	if (fsize > UINT32_MAX) {
+		mprintf("File is too large; at most 4 GB can be accessed\n");
+		blkio_close(bio);
+		return false;
+	}
+	
+	/* Upgrade structures and reset the device */
+	ddisk_clean_up(dd);
+	dd->size = (uint32_t) fsize;
+	dd->disk_type = DISKT_FILE;
+	dd->bio = bio;
+	
+	return true;
+}
+
+/** Fill command implementation
+ *
+ * Fill the disk image with a specified character (byte).
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ *
+ * @return true if successful
+ *
+ */
+static bool ddisk_fill(parm_link_s *parm, device_s *dev)
+{
+	disk_data_s *dd = (disk_data_s *) dev->data;
+	unsigned char c;
+	
+	if (dd->disk_type == DISKT_FILE) {
+		mprintf("Not supported by the file backend\n");
+		return false;
+	}
+	
+	/* String/character */
+	if (parm_type(parm) == tt_str) {
+		if ((!parm_str(parm)[0]) || (parm_str(parm)[1])) {
+			mprintf("Invalid string parameter; exactly one character is necessary.\n");
+			return false;
+		}
+		
+		c = parm_str(parm)[0];
+	} else {
+		/* Number */
+		if (parm_int(parm) > 255) {
+			mprintf("Integer constant out of range 0..255\n");
+			return false;
+		}
+		
+		c = parm_int(parm);
+	}
+	
+	memset(dd->img, c, dd->size);
+	ddisk_mark_dirty(dd, 0, dd->size / 512);
+	
+	return true;
+}
+
+/** Load command implementation
+ *
+ * Load the content of the file "filename" to the disk image.
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ *
+ * @return true if successful
+ *
+ */
+static bool ddisk_load(parm_link_s *parm, device_s *dev)
+{
+	disk_data_s *dd = (disk_data_s *) dev->data;
+	const char *const path = parm_next_str(&parm);
+	bool delta = false;
+	
+	if (parm_type(parm) == tt_str) {
+		const char *const mode = parm_str(parm);
+		
+		if (strcmp(mode, "delta") == 0)
+			delta = true;
+		else if (strcmp(mode, "full") != 0) {
+			mprintf("Unknown mode, full or delta expected\n");
+			return false;
+		}
+	}
+	
+	if (dd->disk_type == DISKT_NONE) {
+		/* Illegal */
+		return false;
+	}
+	
+	if (dd->disk_type == DISKT_FILE) {
+		mprintf("Not supported by the file backend\n");
+		return false;
+	}
+	
+	if (delta)
+		return ddisk_load_delta(dd, path);
+	
+	/* Open file */
+	FILE *file = try_fopen(path, "rb");
+	if (file == NULL) {
+		mprintf(txt_file_open_err);
+		return false;
+	}
+	
+	/* Read the file directly */
+	size_t rd = fread(dd->img, 1, dd->size, file);
+	ddisk_mark_dirty(dd, 0, dd->size / 512);
+	if (rd < dd->size) {
+		io_error(path);
+		mprintf(txt_file_read_err);
+		try_soft_fclose(file, path);
+		return false;
+	}
+	
+	/* Close file */
+	if (!try_fclose(file, path)) {
+		mprintf(txt_file_close_err);
+		return false;
+	}
+	
+	/* The image matches the file now */
+	if (ddisk_save_track(dd, path))
+		memset(dd->dirty, 0, DIRTY_SIZE(dd->size));
+	
+	return true;
+}
+
+/** Save command implementation
+ *
+ * Save the disk content to the file specified.
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ *
+ * @return true if successful
+ *
+ */
+static bool ddisk_save(parm_link_s *parm, device_s *dev)
+{
+	disk_data_s *dd = (disk_data_s *) dev->data;
+	const char *const path = parm_next_str(&parm);
+	const char *const mode =
+	    (parm_type(parm) == tt_str) ? parm_str(parm) : "full";
+	
+	if ((strcmp(mode, "full") != 0) && (strcmp(mode, "dirty") != 0) &&
+	    (strcmp(mode, "delta") != 0)) {
+		mprintf("Unknown mode, full, dirty or delta expected\n");
+		return false;
+	}
+	
+	/* Do not write anything when
+	   the image is not initialized */
+	if (dd->disk_type == DISKT_NONE)
+		return true;
+	
+	if (dd->disk_type == DISKT_FILE) {
+		mprintf("Not supported by the file backend\n");
+		return false;
+	}
+	
+	/* Writing the base image in place would truncate it
+	   under the mappings of the overlays */
+	struct stat st_path;
+	struct stat st_base;
+	if ((dd->disk_type == DISKT_OVERLAY) && (stat(path, &st_path) == 0) &&
+	    (stat(dd->base, &st_base) == 0) &&
+	    (st_path.st_dev == st_base.st_dev) &&
+	    (st_path.st_ino == st_base.st_ino)) {
+		mprintf("Use the commit command to update the base image\n");
+		return false;
+	}
+	
+	bool dirty = (strcmp(mode, "dirty") == 0);
+	
+	/* The sectors written since the last save are updated in
+	   the image loaded or saved last if it has not changed,
+	   otherwise the whole image is saved */
+	if ((dirty) && (ddisk_save_match(dd, path))) {
+		if (!ddisk_write_dirty(dd, dd->dirty, path, false)) {
+			ddisk_save_forget(dd);
+			return false;
+		}
+		
+		if (ddisk_save_track(dd, path))
+			memset(dd->dirty, 0, DIRTY_SIZE(dd->size));
+		
+		return true;
+	}
+	
+	/* The next delta starts from here, the image
+	   saved last does not match anymore */
+	if (strcmp(mode, "delta") == 0) {
+		if (!ddisk_save_delta(dd, path))
+			return false;
+		
+		ddisk_save_forget(dd);
+		memset(dd->dirty, 0, DIRTY_SIZE(dd->size));
+		return true;
+	}
+	
+	/* A full save to another file keeps the dirty sectors
+	   of the image loaded or saved last, unless there is
+	   none or the dirty mode has been requested */
+	bool track = (dirty) || (dd->save_path == NULL) ||
+	    (strcmp(dd->save_path, path) == 0);
+	
+	/* Create file */
+	FILE *file = try_fopen(path, "wb");
+	if (file == NULL) {
+		io_error(path);
+		mprintf(txt_file_create_err);
+		return true;
+	}
+	
+	/* Write data */
+	size_t wr = fwrite(dd->img, 1, dd->size, file);
+	if (wr < dd->size) {
+		io_error(path);
+		mprintf(txt_file_write_err);
+		try_soft_fclose(file, path);
+		
+		if (track)
+			ddisk_save_forget(dd);
+		
+		return false;
+	}
+	
+	/* Close file */
+	if (!try_fclose(file, path)) {
+		mprintf(txt_file_close_err);
+		
+		if (track)
+			ddisk_save_forget(dd);
+		
+		return false;
+	}
+	
+	if ((track) && (ddisk_save_track(dd, path)))
+		memset(dd->dirty, 0, DIRTY_SIZE(dd->size));
+	
+	return true;
+}
+
+/** Route command implementation
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ *
+ * @return true if successful
+ *
+ */
+static bool ddisk_route(parm_link_s *parm, device_s *dev)
+{
+	disk_data_s *dd = (disk_data_s *) dev->data;
+	
+	return dcpu_route_set(&dd->route, parm);
+}
+
+/** DMA command implementation
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ *
+ * @return true if successful
+ *
+ */
+static bool ddisk_dma(parm_link_s *parm, device_s *dev)
+{
+	disk_data_s *dd = (disk_data_s *) dev->data;
+	const char *mode = parm_next_str(&parm);
+	
+	if (dd->action != ACTION_NONE) {
+		mprintf("Cannot change the transfer mode during a transfer\n");
+		return false;
+	}
+	
+	if (strcmp(mode, "word") == 0) {
+		dd->bulk = false;
+		return true;
+	}
+	
+	if (strcmp(mode, "bulk") != 0) {
+		mprintf("Unknown transfer mode (word or bulk expected)\n");
+		return false;
+	}
+	
+	dd->bulk = true;
+	dd->latency = (parm_type(parm) == tt_int) ? parm_int(parm) : 0;
+	
+	return true;
+}
+
+/** Dispose disk
+ *
+ * @param d Device pointer
+ *
+ */
+static void ddisk_done(device_s *d) {
+	disk_data_s *dd = (disk_data_s *) d->data;
+	
+	if ((dd->disk_type == DISKT_OVERLAY) && (dd->commit))
+		ddisk_commit_base(dd);
+	
+	ddisk_clean_up(dd);
+	
+	safe_free(d->name);
+	safe_free(d->data);
+}
+
+/** Raise the disk interrupt
+ *
+ * @param dd     Disk instance data structure
+ * @param status New value of the status register
+ *
+ */
+static void ddisk_interrupt(disk_data_s *dd, uint32_t status)
+{
+	dd->disk_status = status;
+	dcpu_route_up(&dd->route, dd->intno);
+	dd->ig = true;
+	dd->intrcount++;
+}
+
+/** Start a transfer
+ *
+ * @param dd     Disk instance data structure
+ * @param action Read or write
+ * @param secno  First sector
+ * @param count  Number of sectors
+ * @param addr   Physical memory address
+ *
+ * @return False if the sectors are out of the disk bounds
+ *         or the request is too large for the file backend.
+ *
+ */
+static bool ddisk_start(disk_data_s *dd, enum action_e action,
+    uint32_t secno, uint32_t count, uint32_t addr)
+{
+	/* Check bounds */
+	if ((count == 0) ||
+	    ((uint64_t) secno + count) * 512 > dd->size) {
+		dd->cmds_error++;
+		return false;
+	}
+	
+	/* The transfer buffer is allocated on the host */
+	if ((dd->disk_type == DISKT_FILE) && (count > FILE_MAX_COUNT)) {
+		dd->cmds_error++;
+		return false;
+	}
+	
+	dd->action = action;
+	dd->secno = secno;
+	dd->count = count;
+	dd->cnt = 0;
+	dd->disk_wptr = addr;
+	
+	if (dd->disk_type == DISKT_FILE) {
+		size_t size = (size_t) count * 512;
+		
+		if (dd->buf_size < size) {
+			safe_free(dd->buf);
+			dd->buf = (uint32_t *) safe_malloc(size);
+			dd->buf_size = size;
+		}
+		
+		dd->data = dd->buf;
+		
+		/* Fetch the sectors first */
+		if (action == ACTION_READ) {
+			blkio_submit(dd->bio, false, dd->buf, size,
+			    (uint64_t) secno * 512);
+			dd->io_pending = true;
+		}
+	} else
+		dd->data = &dd->img[secno * 128];
+	
+	if (action == ACTION_READ)
+		dd->cmds_read++;
+	else
+		dd->cmds_write++;
+	
+	return true;
+}
+
+/** Start the next request from the descriptor ring
+ *
+ * Descriptors which cannot be started are completed with an error.
+ * If the ring is empty, the completion interrupt is raised.
+ *
+ * @param dd Disk instance data structure
+ *
+ */
+static void ddisk_ring_next(disk_data_s *dd)
+{
+	while (dd->ring_tail != dd->ring_head) {
+		uint32_t desc[DESC_WORDS];
+		
+		dd->desc_addr = dd->ring_addr + dd->ring_tail * DESC_WORDS * 4;
+		mem_read_block(NULL, dd->desc_addr, desc, DESC_WORDS, true);
+		
+		enum action_e action = ACTION_NONE;
+		if (desc[DESC_COMMAND] == COMMAND_READ)
+			action = ACTION_READ;
+		else if (desc[DESC_COMMAND] == COMMAND_WRITE)
+			action = ACTION_WRITE;
+		
+		if ((action != ACTION_NONE) &&
+		    (ddisk_start(dd, action, desc[DESC_SECNO], desc[DESC_COUNT],
+		    desc[DESC_ADDR]))) {
+			dd->from_ring = true;
+			return;
+		}
+		
+		if (action == ACTION_NONE)
+			dd->cmds_error++;
+		
+		/* Complete the descriptor with an error */
+		mem_write(NULL, dd->desc_addr, DESC_DONE | STATUS_ERROR, BITS_32,
+		    true);
+		dd->ring_error = true;
+		dd->ring_tail = (dd->ring_tail + 1) % dd->ring_size;
+	}
+	
+	/* Ring is empty: single completion interrupt */
+	dd->from_ring = false;
+	ddisk_interrupt(dd, STATUS_INT | (dd->ring_error ? STATUS_ERROR : 0));
+	dd->ring_error = false;
+}
+
+/** Finish the current action
+ *
+ * A single command raises the completion interrupt, a request from
+ * the descriptor ring is marked as done and the next one is started.
+ *
+ * @param dd Disk instance data structure
+ * @param ok False if the action has failed
+ *
+ */
+static void ddisk_complete(disk_data_s *dd, bool ok)
+{
+	dd->action = ACTION_NONE;
+	
+	if (dd->from_ring) {
+		mem_write(NULL, dd->desc_addr, DESC_DONE | (ok ? 0 : STATUS_ERROR),
+		    BITS_32, true);
+		dd->ring_tail = (dd->ring_tail + 1) % dd->ring_size;
+		
+		if (!ok)
+			dd->ring_error = true;
+	} else {
+		ddisk_interrupt(dd, STATUS_INT | (ok ? 0 : STATUS_ERROR));
+		
+		/* Requests posted to the ring meanwhile */
+		if ((dd->ring_size == 0) || (dd->ring_tail == dd->ring_head))
+			return;
+	}
+	
+	ddisk_ring_next(dd);
+}
+
+/** Finish the memory transfer of the current action
+ *
+ * Sectors written to a host file are stored before the action
+ * is completed.
+ *
+ * @param dd Disk instance data structure
+ *
+ */
+static void ddisk_transfer_done(disk_data_s *dd)
+{
+	if ((dd->disk_type == DISKT_FILE) && (dd->action == ACTION_WRITE)) {
+		blkio_submit(dd->bio, true, dd->buf, (size_t) dd->count * 512,
+		    (uint64_t) dd->secno * 512);
+		dd->io_pending = true;
+		return;
+	}
+	
+	ddisk_complete(dd, true);
+}
+
+/** Wait for the host I/O of the current action
+ *
+ * @param dd Disk instance data structure
+ *
+ * @return True if the action can continue in this step.
+ *
+ */
+static bool ddisk_io_wait(disk_data_s *dd)
+{
+	bool ok;
+	
+	if (!blkio_done(dd->bio, &ok))
+		return false;
+	
+	dd->io_pending = false;
+	
+	/* Failed or the sectors are written */
+	if ((!ok) || (dd->action == ACTION_WRITE)) {
+		ddisk_complete(dd, ok);
+		return false;
+	}
+	
+	return true;
+}
+
+/** Read command implementation
+ *
+ * @param d    Ddisk device pointer
+ * @param addr Address of the read operation
+ * @param val  Readed (returned) value
+ *
+ */
+static void ddisk_read(cpu_t *cpu, device_s *dev, ptr_t addr,
+    uint32_t *val)
+{
+	disk_data_s *dd = (disk_data_s *) dev->data;
+	
+	/* Do nothing if the disk is not initialized. */
+	if (dd->disk_type == DISKT_NONE)
+		return;
+	
+	/* Read internal registers. */
+	if (addr == dd->addr + REGISTER_ADDR)
+		*val = dd->disk_wptr;
+	else if (addr == dd->addr + REGISTER_SECNO)
+		*val = dd->disk_secno;
 	else if (addr == dd->addr + REGISTER_STATUS)
 		*val = dd->disk_status;
 	else if (addr == dd->addr + REGISTER_SIZE)
 		*val = dd->size;
+	else if (dd->ext) {
+		if (addr == dd->ext_addr + REGISTER_EXT_COUNT)
+			*val = dd->disk_count;
+		else if (addr == dd->ext_addr + REGISTER_EXT_RING_ADDR)
+			*val = dd->ring_addr;
+		else if (addr == dd->ext_addr + REGISTER_EXT_RING_SIZE)
+			*val = dd->ring_size;
+		else if (addr == dd->ext_addr + REGISTER_EXT_RING_HEAD)
+			*val = dd->ring_head;
+		else if (addr == dd->ext_addr + REGISTER_EXT_RING_TAIL)
+			*val = dd->ring_tail;
+	}
+}
+
+/** Write to the extended registers
+ *
+ * @param dd   Disk instance data structure
+ * @param addr Written address
+ * @param val  Value to write
+ *
+ */
+static void ddisk_ext_write(disk_data_s *dd, ptr_t addr, uint32_t val)
+{
+	if (addr == dd->ext_addr + REGISTER_EXT_COUNT)
+		dd->disk_count = val;
+	else if ((addr == dd->ext_addr + REGISTER_EXT_RING_ADDR) ||
+	    (addr == dd->ext_addr + REGISTER_EXT_RING_SIZE)) {
+		/* Reconfiguration resets the ring */
+		if (dd->from_ring) {
+			dd->disk_status |= STATUS_ERROR;
+			dd->cmds_error++;
+			return;
+		}
+		
+		if (addr == dd->ext_addr + REGISTER_EXT_RING_ADDR)
+			dd->ring_addr = val;
+		else
+			dd->ring_size = val;
+		
+		dd->ring_head = 0;
+		dd->ring_tail = 0;
+	} else if (addr == dd->ext_addr + REGISTER_EXT_RING_HEAD) {
+		/* Doorbell */
+		if ((dd->ring_size == 0) || (val >= dd->ring_size)) {
+			dd->disk_status |= STATUS_ERROR;
+			dd->cmds_error++;
+			return;
+		}
+		
+		dd->ring_head = val;
+		
+		if ((dd->action == ACTION_NONE) && (dd->ring_tail != dd->ring_head))
+			ddisk_ring_next(dd);
+	}
 }
 
 /** Write command implementation
@@ -730,7 +1867,7 @@ static void ddisk_write(cpu_t *cpu, device_s *dev, ptr_t addr,
 		if (dd->disk_command & COMMAND_INT_ACK) {
 			dd->disk_status &= ~STATUS_INT;
 			dd->ig = false;
-			dcpu_interrupt_down(0, dd->intno);
+			dcpu_route_down(&dd->route, dd->intno);
 		}
 		
 		/* Check general errors */
@@ -750,46 +1887,58 @@ static void ddisk_write(cpu_t *cpu, device_s *dev, ptr_t addr,
 			return;
 		}
 		
-		/* Read command */
-		if (dd->disk_command & COMMAND_READ) {
-			/* Check bound */
-			if ((dd->disk_secno + 1) * 512 - 1 >= dd->size) {
-				/* Generate error & interrupt */
-				dd->disk_status = STATUS_INT | STATUS_ERROR;
-				dcpu_interrupt_up(0, dd->intno);
-				dd->ig = true;
-				dd->intrcount++;
-				dd->cmds_error++;
-				return;
-			}
-			
-			/* Initialize process of reading */
-			dd->action = ACTION_READ;
-			dd->cnt = 0;
-			dd->secno = dd->disk_secno;
-			dd->cmds_read++;
-		}
+		enum action_e action = ACTION_NONE;
+		if (dd->disk_command & COMMAND_READ)
+			action = ACTION_READ;
+		else if (dd->disk_command & COMMAND_WRITE)
+			action = ACTION_WRITE;
 		
-		/* Write command */
-		if (dd->disk_command & COMMAND_WRITE) {
-			/* Check bound */
-			if ((dd->disk_secno + 1) * 512 - 1 >= dd->size) {
-				/* Generate error & interrupt */
-				dd->disk_status = STATUS_INT | STATUS_ERROR;
-				dcpu_interrupt_up(0, dd->intno);
-				dd->ig = true;
-				dd->intrcount++;
-				dd->cmds_error++;
-				return;
-			}
+		if (action != ACTION_NONE) {
+			dd->from_ring = false;
 			
-			/* Initialize process of writting */
-			dd->action = ACTION_WRITE;
-			dd->cnt = 0;
-			dd->secno = dd->disk_secno;
-			dd->cmds_write++;
+			if (!ddisk_start(dd, action, dd->disk_secno, dd->disk_count,
+			    dd->disk_wptr))
+				/* Generate error & interrupt */
+				ddisk_interrupt(dd, STATUS_INT | STATUS_ERROR);
 		}
+	} else if (dd->ext)
+		ddisk_ext_write(dd, addr, val);
+}
+
+/** One step in the bulk transfer mode
+ *
+ * All sectors of the request are transferred in the first step,
+ * the request is completed after the configured latency per sector.
+ *
+ * @param dd Disk instance data structure
+ *
+ */
+static void ddisk_bulk_step(disk_data_s *dd)
+{
+	if (dd->action == ACTION_NONE)
+		return;
+	
+	if (dd->cnt == 0) {
+		if (dd->action == ACTION_READ)
+			mem_write_block(NULL, dd->disk_wptr, dd->data, dd->count * 128,
+			    true);
+		else {
+			mem_read_block(NULL, dd->disk_wptr, dd->data, dd->count * 128,
+			    true);
+			ddisk_mark_dirty(dd, dd->secno, dd->count);
+		}
+		
+		dd->disk_wptr += dd->count * 512;
+		dd->cnt = dd->count * 128;
+		dd->delay = (uint64_t) dd->latency * dd->count;
+	}
+	
+	if (dd->delay > 0) {
+		dd->delay--;
+		return;
 	}
+	
+	ddisk_transfer_done(dd);
 }
 
 /** One step implementation
@@ -801,34 +1950,35 @@ static void ddisk_step(device_s *d)
 {
 	disk_data_s *dd = (disk_data_s *) d->data;
 	
+	if ((dd->io_pending) && (!ddisk_io_wait(dd)))
+		return;
+	
+	if (dd->bulk) {
+		ddisk_bulk_step(dd);
+		return;
+	}
+	
 	/* Reading */
 	if (dd->action == ACTION_READ) {
-		uint32_t val = dd->img[dd->secno * 128 + dd->cnt];
+		uint32_t val = dd->data[dd->cnt];
 		mem_write(NULL, dd->disk_wptr, val, BITS_32, true);
 		dd->disk_wptr += 4;  /* Next word */
 		dd->cnt++;
 		
-		if (dd->cnt == 128) {
-			dd->action = ACTION_NONE;
-			dd->disk_status = STATUS_INT;
-			dcpu_interrupt_up(0, dd->intno);
-			dd->ig = true;
-			dd->intrcount++;
-		}
+		if (dd->cnt == dd->count * 128)
+			ddisk_transfer_done(dd);
 	} else if (dd->action == ACTION_WRITE) {  /* Writting */
 		uint32_t val;
 		val = mem_read(NULL, dd->disk_wptr, BITS_32, true);
-		dd->img[dd->secno * 128 + dd->cnt] = val;
+		dd->data[dd->cnt] = val;
+		
+		/* The sector is dirty as soon as its data change */
+		ddisk_mark_dirty(dd, dd->secno + dd->cnt / 128, 1);
 		
 		dd->disk_wptr += 4;  /* Next word */
 		dd->cnt++;
 		
-		if (dd->cnt == 128) {
-			dd->action = ACTION_NONE;
-			dd->disk_status = STATUS_INT;
-			dcpu_interrupt_up(0, dd->intno);
-			dd->ig = true;
-			dd->intrcount++;
-		}
+		if (dd->cnt == dd->count * 128)
+			ddisk_transfer_done(dd);
 	}
 }
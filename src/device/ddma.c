@@ -0,0 +1,577 @@
+/*
+ * Copyright (c) 2008 Martin Decky
+ * All rights reserved.
+ *
+ * Distributed under the terms of GPL.
+ *
+ *
+ *  DMA copy engine
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "ddma.h"
+
+#include "machine.h"
+#include "dcpu.h"
+#include "../fault.h"
+#include "../io/output.h"
+#include "../utils.h"
+
+/** \{ \name Register offsets */
+#define REGISTER_SRC      0   /**< Source address */
+#define REGISTER_DST      4   /**< Destination address */
+#define REGISTER_LENGTH   8   /**< Length in bytes */
+#define REGISTER_PATTERN  12  /**< Fill pattern */
+#define REGISTER_CHAIN    16  /**< Descriptor chain address */
+#define REGISTER_STATUS   20  /**< Status */
+#define REGISTER_COMMAND  20  /**< Command */
+#define REGISTER_LIMIT    24  /**< Size of register block */
+/* \} */
+
+/** \{ \name Chain descriptor words */
+#define DESC_COMMAND  0  /**< Command, completion status when done */
+#define DESC_SRC      1  /**< Source address */
+#define DESC_DST      2  /**< Destination address */
+#define DESC_LENGTH   3  /**< Length in bytes */
+#define DESC_PATTERN  4  /**< Fill pattern */
+#define DESC_NEXT     5  /**< Next descriptor address (0 terminates) */
+#define DESC_WORDS    6  /**< Descriptor size in words */
+/* \} */
+
+/** \{ \name Descriptor flags */
+#define DESC_DONE   0x80000000U
+#define DESC_ERROR  0x40000000U
+/* \} */
+
+/** \{ \name Status flags */
+#define STATUS_BUSY   0x01  /**< Operation in progress */
+#define STATUS_INT    0x04  /**< Interrupt pending */
+#define STATUS_ERROR  0x08  /**< Operation error */
+/* \} */
+
+/** \{ \name Command flags */
+#define COMMAND_COPY     0x01  /**< Copy the source to the destination */
+#define COMMAND_FILL     0x02  /**< Fill the destination with the pattern */
+#define COMMAND_CHAIN    0x04  /**< Execute the descriptor chain */
+#define COMMAND_INT_ACK  0x08  /**< Interrupt acknowledge */
+#define COMMAND_INT      0x10  /**< Interrupt on completion */
+/* \} */
+
+/*
+ * Device commands
+ */
+
+static bool ddma_init(parm_link_s *parm, device_s *dev);
+static bool ddma_info(parm_link_s *parm, device_s *dev);
+static bool ddma_stat(parm_link_s *parm, device_s *dev);
+static bool ddma_timing(parm_link_s *parm, device_s *dev);
+static bool ddma_route(parm_link_s *parm, device_s *dev);
+
+cmd_s ddma_cmds[] = {
+	{
+		"init",
+		(cmd_f) ddma_init,
+		DEFAULT,
+		DEFAULT,
+		"Initialization",
+		"Initialization",
+		REQ STR "name/device name" NEXT
+		REQ INT "addr/register block address" NEXT
+		REQ INT "intno/interrupt number within 0..6" END
+	},
+	{
+		"help",
+		(cmd_f) dev_generic_help,
+		DEFAULT,
+		DEFAULT,
+		"Display help",
+		"Display help",
+		OPT STR "cmd/command name" END
+	},
+	{
+		"info",
+		(cmd_f) ddma_info,
+		DEFAULT,
+		DEFAULT,
+		"Configuration information",
+		"Configuration information",
+		NOCMD
+	},
+	{
+		"stat",
+		(cmd_f) ddma_stat,
+		DEFAULT,
+		DEFAULT,
+		"Statistics",
+		"Statistics",
+		NOCMD
+	},
+	{
+		"timing",
+		(cmd_f) ddma_timing,
+		DEFAULT,
+		DEFAULT,
+		"Set the operation timing",
+		"Complete each operation after the latency in cycles plus "
+			"the length divided by the bandwidth in bytes per cycle "
+			"(0 is unlimited)",
+		REQ INT "latency/operation latency in cycles" NEXT
+		OPT INT "bandwidth/bytes per cycle" END
+	},
+	{
+		"route",
+		(cmd_f) ddma_route,
+		DEFAULT,
+		DEFAULT,
+		"Set the interrupt routing",
+		"Route the interrupt to a processor (cpu no), to processors "
+			"in a mask (mask mask) or round-robin to all processors (rr)",
+		REQ STR "mode/cpu, mask or rr" NEXT
+		OPT VAR "target/processor number, mask or list" END
+	},
+	LAST_CMD
+};
+
+/**< Name of the device as presented to the user */
+const char id_ddma[] = "ddma";
+
+static void ddma_done(device_s *dev);
+static void ddma_step(device_s *dev);
+static void ddma_read(cpu_t *cpu, device_s *dev, ptr_t addr, uint32_t *val);
+static void ddma_write(cpu_t *cpu, device_s *dev, ptr_t addr, uint32_t val);
+
+/**< Ddma object structure */
+device_type_s ddma = {
+	/* Type name and description */
+	.name = id_ddma,
+	.brief = "DMA copy engine",
+	.full = "DMA engine copying and filling memory blocks",
+	
+	/* Functions */
+	.done = ddma_done,
+	.step = ddma_step,
+	.read = ddma_read,
+	.write = ddma_write,
+	
+	/* Commands */
+	ddma_cmds
+};
+
+/** Ddma instance data structure */
+typedef struct {
+	/* Configuration */
+	uint32_t addr;          /**< Register block location */
+	int intno;              /**< Interrupt number */
+	intr_route_t route;     /**< Interrupt routing */
+	uint32_t latency;       /**< Operation latency */
+	uint32_t bandwidth;     /**< Bytes per cycle (0 is unlimited) */
+	
+	/* Registers */
+	uint32_t src;           /**< Source address */
+	uint32_t dst;           /**< Destination address */
+	uint32_t length;        /**< Length in bytes */
+	uint32_t pattern;       /**< Fill pattern */
+	uint32_t chain;         /**< Descriptor chain address */
+	uint32_t status;        /**< Status */
+	
+	/* Operation in progress */
+	bool busy;              /**< Operation in progress */
+	bool intr;              /**< Interrupt on completion */
+	uint32_t command;       /**< Current operation */
+	uint32_t op_src;        /**< Current source address */
+	uint32_t op_dst;        /**< Current destination address */
+	uint32_t op_length;     /**< Current length */
+	uint32_t op_pattern;    /**< Current fill pattern */
+	uint32_t desc_addr;     /**< Current descriptor (0 if none) */
+	uint64_t delay;         /**< Cycles to completion */
+	
+	/* Statistics */
+	uint64_t intrcount;     /**< Number of interrupts */
+	uint64_t copies;        /**< Copy operations */
+	uint64_t fills;         /**< Fill operations */
+	uint64_t bytes;         /**< Bytes written */
+	uint64_t errors;        /**< Failed operations */
+	uint64_t busy_cycles;   /**< Cycles spent by the operations */
+} dma_data_s;
+
+/** Start an operation
+ *
+ * The memory is written when the operation completes.
+ *
+ * @param dd Device instance data structure
+ *
+ */
+static void ddma_start(dma_data_s *dd)
+{
+	dd->delay = dd->latency;
+	if (dd->bandwidth != 0)
+		dd->delay += dd->op_length / dd->bandwidth;
+	
+	dd->busy = true;
+}
+
+/** Load the current chain descriptor
+ *
+ * @param dd Device instance data structure
+ *
+ */
+static void ddma_load_desc(dma_data_s *dd)
+{
+	uint32_t desc[DESC_WORDS];
+	mem_read_block(NULL, dd->desc_addr, desc, DESC_WORDS, true);
+	
+	dd->command = desc[DESC_COMMAND] & (COMMAND_COPY | COMMAND_FILL);
+	dd->op_src = desc[DESC_SRC];
+	dd->op_dst = desc[DESC_DST];
+	dd->op_length = desc[DESC_LENGTH];
+	dd->op_pattern = desc[DESC_PATTERN];
+	
+	ddma_start(dd);
+}
+
+/** Perform the current operation
+ *
+ * @param dd Device instance data structure
+ *
+ * @return true if successful
+ *
+ */
+static bool ddma_execute(dma_data_s *dd)
+{
+	if ((dd->op_length & 3) || (!addr_word_aligned(dd->op_dst)))
+		return false;
+	
+	switch (dd->command) {
+	case COMMAND_COPY:
+		if (!addr_word_aligned(dd->op_src))
+			return false;
+		
+		mem_copy_block(NULL, dd->op_dst, dd->op_src, dd->op_length / 4,
+		    true);
+		dd->copies++;
+		break;
+	case COMMAND_FILL:
+		mem_fill_block(NULL, dd->op_dst, dd->op_pattern, dd->op_length / 4,
+		    true);
+		dd->fills++;
+		break;
+	default:
+		return false;
+	}
+	
+	dd->bytes += dd->op_length;
+	return true;
+}
+
+/** Complete the current operation
+ *
+ * The next chain descriptor is started if there is one.
+ *
+ * @param dd Device instance data structure
+ *
+ */
+static void ddma_complete(dma_data_s *dd)
+{
+	bool ok = ddma_execute(dd);
+	
+	if (!ok) {
+		dd->errors++;
+		dd->status |= STATUS_ERROR;
+	}
+	
+	if (dd->desc_addr != 0) {
+		uint32_t next = mem_read(NULL, dd->desc_addr + DESC_NEXT * 4,
+		    BITS_32, true);
+		uint32_t cmd = mem_read(NULL, dd->desc_addr + DESC_COMMAND * 4,
+		    BITS_32, true);
+		
+		mem_write(NULL, dd->desc_addr + DESC_COMMAND * 4,
+		    cmd | DESC_DONE | (ok ? 0 : DESC_ERROR), BITS_32, true);
+		
+		if ((ok) && (next != 0) && (addr_word_aligned(next))) {
+			dd->desc_addr = next;
+			ddma_load_desc(dd);
+			return;
+		}
+		
+		dd->desc_addr = 0;
+	}
+	
+	dd->busy = false;
+	dd->status &= ~STATUS_BUSY;
+	
+	if ((dd->intr) && (!(dd->status & STATUS_INT))) {
+		dd->status |= STATUS_INT;
+		dd->intrcount++;
+		dcpu_route_up(&dd->route, dd->intno);
+	}
+}
+
+/** Execute a command written to the command register
+ *
+ * @param dd  Device instance data structure
+ * @param val Command
+ *
+ */
+static void ddma_command(dma_data_s *dd, uint32_t val)
+{
+	if ((val & COMMAND_INT_ACK) && (dd->status & STATUS_INT)) {
+		dd->status &= ~STATUS_INT;
+		dcpu_route_down(&dd->route, dd->intno);
+	}
+	
+	if ((dd->busy) || (!(val & (COMMAND_COPY | COMMAND_FILL | COMMAND_CHAIN))))
+		return;
+	
+	dd->status = (dd->status & STATUS_INT) | STATUS_BUSY;
+	dd->intr = ((val & COMMAND_INT) != 0);
+	
+	if (val & COMMAND_CHAIN) {
+		if ((dd->chain == 0) || (!addr_word_aligned(dd->chain))) {
+			dd->command = 0;
+			dd->op_length = 0;
+			ddma_start(dd);
+			return;
+		}
+		
+		dd->desc_addr = dd->chain;
+		ddma_load_desc(dd);
+		return;
+	}
+	
+	dd->command = val & (COMMAND_COPY | COMMAND_FILL);
+	dd->op_src = dd->src;
+	dd->op_dst = dd->dst;
+	dd->op_length = dd->length;
+	dd->op_pattern = dd->pattern;
+	ddma_start(dd);
+}
+
+/** Init command implementation
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ *
+ * @return true if successful
+ *
+ */
+static bool ddma_init(parm_link_s *parm, device_s *dev)
+{
+	dma_data_s *dd = (dma_data_s *) safe_malloc_t(dma_data_s);
+	memset(dd, 0, sizeof(dma_data_s));
+	dev->data = dd;
+	
+	parm_next(&parm);
+	dd->addr = parm_next_int(&parm);
+	dd->intno = parm_next_int(&parm);
+	dcpu_route_init(&dd->route);
+	
+	if (!addr_word_aligned(dd->addr)) {
+		mprintf("Device address must be 4-byte aligned\n");
+		free(dd);
+		return false;
+	}
+	
+	if ((uint64_t) dd->addr + (uint64_t) REGISTER_LIMIT > 0x100000000ull) {
+		mprintf("Invalid address; registers would exceed the 4 GB limit\n");
+		free(dd);
+		return false;
+	}
+	
+	if ((dd->intno < 0) || (dd->intno > 6)) {
+		mprintf("Interrupt number must be within 0..6\n");
+		free(dd);
+		return false;
+	}
+	
+	return true;
+}
+
+/** Info command implementation
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ *
+ * @return true; always successful
+ *
+ */
+static bool ddma_info(parm_link_s *parm, device_s *dev)
+{
+	dma_data_s *dd = (dma_data_s *) dev->data;
+	
+	mprintf("address:%#010" PRIx32 " intno:%d latency:%" PRIu32
+	    " bandwidth:%" PRIu32 " status:%#04" PRIx32 " route:", dd->addr,
+	    dd->intno, dd->latency, dd->bandwidth, dd->status);
+	dcpu_route_print(&dd->route);
+	mprintf("\n");
+	
+	return true;
+}
+
+/** Stat command implementation
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ *
+ * @return true; always successful
+ *
+ */
+static bool ddma_stat(parm_link_s *parm, device_s *dev)
+{
+	dma_data_s *dd = (dma_data_s *) dev->data;
+	
+	mprintf("Interrupts           Copies               Fills                Errors\n");
+	mprintf("-------------------- -------------------- -------------------- --------------------\n");
+	mprintf("%20" PRIu64 " %20" PRIu64 " %20" PRIu64 " %20" PRIu64 "\n",
+	    dd->intrcount, dd->copies, dd->fills, dd->errors);
+	
+	mprintf("Bytes                Busy cycles\n");
+	mprintf("-------------------- --------------------\n");
+	mprintf("%20" PRIu64 " %20" PRIu64 "\n", dd->bytes, dd->busy_cycles);
+	
+	return true;
+}
+
+/** Timing command implementation
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ *
+ * @return true; always successful
+ *
+ */
+static bool ddma_timing(parm_link_s *parm, device_s *dev)
+{
+	dma_data_s *dd = (dma_data_s *) dev->data;
+	
+	dd->latency = parm_int(parm);
+	parm_next(&parm);
+	dd->bandwidth = (parm_type(parm) == tt_int) ? parm_int(parm) : 0;
+	
+	return true;
+}
+
+/** Route command implementation
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ *
+ * @return true if successful
+ *
+ */
+static bool ddma_route(parm_link_s *parm, device_s *dev)
+{
+	dma_data_s *dd = (dma_data_s *) dev->data;
+	
+	return dcpu_route_set(&dd->route, parm);
+}
+
+/** Dispose the device
+ *
+ * @param dev Device instance structure
+ *
+ */
+static void ddma_done(device_s *dev)
+{
+	safe_free(dev->name);
+	safe_free(dev->data);
+}
+
+/** One step implementation
+ *
+ * @param dev Device instance structure
+ *
+ */
+static void ddma_step(device_s *dev)
+{
+	dma_data_s *dd = (dma_data_s *) dev->data;
+	
+	if (!dd->busy)
+		return;
+	
+	dd->busy_cycles++;
+	
+	if (dd->delay > 0)
+		dd->delay--;
+	else
+		ddma_complete(dd);
+}
+
+/** Read command implementation
+ *
+ * @param cpu  Processor which reads (or NULL)
+ * @param dev  Device instance structure
+ * @param addr Address of the read operation
+ * @param val  Read (returned) value
+ *
+ */
+static void ddma_read(cpu_t *cpu, device_s *dev, ptr_t addr, uint32_t *val)
+{
+	dma_data_s *dd = (dma_data_s *) dev->data;
+	
+	if ((addr < dd->addr) || (addr >= dd->addr + REGISTER_LIMIT))
+		return;
+	
+	switch (addr - dd->addr) {
+	case REGISTER_SRC:
+		*val = dd->src;
+		break;
+	case REGISTER_DST:
+		*val = dd->dst;
+		break;
+	case REGISTER_LENGTH:
+		*val = dd->length;
+		break;
+	case REGISTER_PATTERN:
+		*val = dd->pattern;
+		break;
+	case REGISTER_CHAIN:
+		*val = dd->chain;
+		break;
+	case REGISTER_STATUS:
+		*val = dd->status;
+		break;
+	}
+}
+
+/** Write command implementation
+ *
+ * @param cpu  Processor which writes (or NULL)
+ * @param dev  Device instance structure
+ * @param addr Address of the write operation
+ * @param val  Value to write
+ *
+ */
+static void ddma_write(cpu_t *cpu, device_s *dev, ptr_t addr, uint32_t val)
+{
+	dma_data_s *dd = (dma_data_s *) dev->data;
+	
+	if ((addr < dd->addr) || (addr >= dd->addr + REGISTER_LIMIT))
+		return;
+	
+	switch (addr - dd->addr) {
+	case REGISTER_SRC:
+		dd->src = val;
+		break;
+	case REGISTER_DST:
+		dd->dst = val;
+		break;
+	case REGISTER_LENGTH:
+		dd->length = val;
+		break;
+	case REGISTER_PATTERN:
+		dd->pattern = val;
+		break;
+	case REGISTER_CHAIN:
+		dd->chain = val;
+		break;
+	case REGISTER_COMMAND:
+		ddma_command(dd, val);
+		break;
+	}
+}
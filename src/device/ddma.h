@@ -0,0 +1,19 @@
+/*
+ * Copyright (c) 2008 Martin Decky
+ * All rights reserved.
+ *
+ * Distributed under the terms of GPL.
+ *
+ *
+ *  DMA copy engine
+ *
+ */
+
+#ifndef DDMA_H_
+#define DDMA_H_
+
+#include "device.h"
+
+extern device_type_s ddma;
+
+#endif /* DDMA_H_ */
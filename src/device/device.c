@@ -30,10 +30,17 @@
 #include "ddisk.h"
 #include "dprinter.h"
 #include "dtime.h"
+#include "dnet.h"
+#include "dserial.h"
+#include "ddma.h"
+#include "dshm.h"
+#include "dtimer.h"
+#include "dcycle.h"
+#include "dvblk.h"
 #include "device.h"
 
 /** Count of device types */
-#define DEVICE_TYPE_COUNT  8
+#define DEVICE_TYPE_COUNT  15
 
 /* Implemented peripheral list */
 const device_type_s *device_types[DEVICE_TYPE_COUNT] = {
@@ -44,16 +51,44 @@ const device_type_s *device_types[DEVICE_TYPE_COUNT] = {
 	&dorder,
 	&dkeyboard,
 	&ddisk,
-	&dtime
+	&dtime,
+	&dvblk,
+	&dnet,
+	&dserial,
+	&ddma,
+	&dshm,
+	&dtimer,
+	&dcycle
 };
 
 /* List of all devices */
 list_t device_list;
 
+/** Array of devices matching a filter
+ *
+ * The arrays are rebuilt whenever the device list changes so that
+ * the main loop does not need to walk and filter the whole device
+ * list in every machine cycle.
+ *
+ */
+typedef struct {
+	device_s **devices;  /**< Matching devices */
+	size_t count;        /**< Number of matching devices */
+} dev_cache_t;
+
+/* Cached device arrays indexed by the filter */
+static dev_cache_t dev_cache[DEVICE_FILTER_COUNT];
+
 /** Initialize internal global variables. */
 void dev_init_framework(void)
 {
 	list_init(&device_list);
+	
+	unsigned int i;
+	for (i = 0; i < DEVICE_FILTER_COUNT; i++) {
+		dev_cache[i].devices = NULL;
+		dev_cache[i].count = 0;
+	}
 }
 
 /** Search for device type and allocates device structure
@@ -269,6 +304,57 @@ device_s *dev_by_name(const char *searched_name)
 	return device;
 }
 
+/** Rebuild the cached device arrays
+ *
+ * Called whenever the device list changes.
+ *
+ */
+static void dev_cache_rebuild(void)
+{
+	unsigned int i;
+	for (i = 0; i < DEVICE_FILTER_COUNT; i++) {
+		dev_cache_t *cache = &dev_cache[i];
+		size_t count = 0;
+		device_s *device = NULL;
+		
+		while (dev_next(&device, (device_filter_t) i))
+			count++;
+		
+		safe_free(cache->devices);
+		cache->count = count;
+		
+		if (count == 0)
+			continue;
+		
+		cache->devices = (device_s **) safe_malloc(sizeof(device_s *) * count);
+		
+		count = 0;
+		device = NULL;
+		while (dev_next(&device, (device_filter_t) i))
+			cache->devices[count++] = device;
+	}
+}
+
+/** Get the array of devices matching the given filter
+ *
+ * The array is valid until the next change of the device list.
+ *
+ * @param filter Condition for filtering.
+ * @param count  Number of devices in the array is returned
+ *               through this parameter.
+ *
+ * @return Array of matching devices (NULL if there is none).
+ *
+ */
+device_s *const *dev_cached(device_filter_t filter, size_t *count)
+{
+	PRE(filter < DEVICE_FILTER_COUNT);
+	PRE(count != NULL);
+	
+	*count = dev_cache[filter].count;
+	return dev_cache[filter].devices;
+}
+
 /** Add a new device to the machine.
  *
  * @param device Device to be added.
@@ -277,6 +363,7 @@ device_s *dev_by_name(const char *searched_name)
 void dev_add(device_s *device)
 {
 	list_append(&device_list, &device->item);
+	dev_cache_rebuild();
 }
 
 /** Remove a device from the machine.
@@ -287,6 +374,7 @@ void dev_add(device_s *device)
 void dev_remove(device_s *device)
 {
 	list_remove(&device_list, &device->item);
+	dev_cache_rebuild();
 }
 
 /** Generic help generation
@@ -73,6 +73,7 @@ typedef enum {
 	DEVICE_FILTER_STEP4,
 	DEVICE_FILTER_MEMORY,
 	DEVICE_FILTER_PROCESSOR,
+	DEVICE_FILTER_COUNT  /**< Number of filters (not a filter) */
 } device_filter_t;
 
 /**
@@ -98,6 +99,7 @@ extern size_t dev_count_by_partial_name(const char *prefix_name,
     device_s **device);
 extern device_s *dev_by_name(const char *s);
 extern bool dev_next(device_s **device, device_filter_t filter);
+extern device_s *const *dev_cached(device_filter_t filter, size_t *count);
 
 /*
  * Link/unlink device functions
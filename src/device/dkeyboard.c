@@ -9,6 +9,7 @@
  *
  */
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
@@ -20,6 +21,10 @@
 #include "dkeyboard.h"
 #include "device.h"
 #include "dcpu.h"
+#include "dprinter.h"
+#include "machine.h"
+#include "../text.h"
+#include "../fault.h"
 #include "../io/output.h"
 #include "../utils.h"
 
@@ -30,6 +35,25 @@
 /* Step skip constant */
 #define CYCLE_SKIP 4096
 
+/* Maximal length of a replay script line */
+#define REPLAY_LINE 1024
+
+/* Replay event triggers */
+enum replay_type_e {
+	REPLAY_AT,      /* At an absolute machine cycle */
+	REPLAY_AFTER,   /* Cycles after the previous event */
+	REPLAY_EXPECT   /* Printer output contains a pattern */
+};
+
+/* Replay event */
+typedef struct {
+	enum replay_type_e type;
+	uint64_t cycle;		/* Cycle or delay */
+	char *pattern;		/* Output pattern */
+	char *text;		/* Keys to inject */
+	size_t len;		/* Number of keys */
+} replay_event_s;
+
 /*
  * Device commands
  */
@@ -38,6 +62,8 @@ static bool dkeyboard_init(parm_link_s *parm, device_s *dev);
 static bool dkeyboard_info(parm_link_s *parm, device_s *dev);
 static bool dkeyboard_stat(parm_link_s *parm, device_s *dev);
 static bool dkeyboard_gen(parm_link_s *parm, device_s *dev);
+static bool dkeyboard_route(parm_link_s *parm, device_s *dev);
+static bool dkeyboard_replay(parm_link_s *parm, device_s *dev);
 
 cmd_s keyboard_cmds[] = {
 	{
@@ -87,6 +113,27 @@ cmd_s keyboard_cmds[] = {
 		"Generate a key press with specified code",
 		REQ VAR "key code" END
 	},
+	{
+		"route",
+		(cmd_f) dkeyboard_route,
+		DEFAULT,
+		DEFAULT,
+		"Set the interrupt routing",
+		"Route the interrupt to a processor (cpu no), to processors "
+			"in a mask (mask mask) or round-robin to all processors (rr)",
+		REQ STR "mode/cpu, mask or rr" NEXT
+		OPT VAR "target/processor number, mask or list" END
+	},
+	{
+		"replay",
+		(cmd_f) dkeyboard_replay,
+		DEFAULT,
+		DEFAULT,
+		"Replay keys from the script specified",
+		"Inject the keys from the script specified at given machine "
+			"cycles or when the printer output matches a pattern",
+		REQ STR "filename/replay script" END
+	},
 	LAST_CMD
 };
 
@@ -116,12 +163,23 @@ device_type_s dkeyboard = {
 struct keyboard_data_s {
 	uint32_t addr;		/* Dkeyboard register address. */
 	int intno;		/* Interrupt number */
+	intr_route_t route;	/* Interrupt routing */
 	char incomming;		/* Character buffer */
 	
 	bool ig;		/* Interrupt pending flag */
 	uint64_t intrcount;		/* Number of interrupts asserted */
 	uint64_t keycount;		/* Number of keys acquired */
 	uint64_t overrun;		/* Number of overwritten characters in the buffer. */
+	
+	replay_event_s *replay;	/* Replay script */
+	size_t replay_count;		/* Number of replay events */
+	size_t replay_next;		/* Current replay event */
+	bool replay_armed;		/* Current event is waiting for its trigger */
+	bool replay_fired;		/* Current event is injecting its keys */
+	uint64_t replay_deadline;	/* Cycle of a timed trigger */
+	uint64_t replay_since;		/* Output count of a pattern trigger */
+	uint64_t replay_mark;		/* Output count when the last event fired */
+	size_t replay_pos;		/* Next key of the current event */
 };
 typedef struct keyboard_data_s keyboard_data_s;
 
@@ -141,7 +199,7 @@ static void gen_key(device_s *dev, char k)
 	if (!kd->ig) {
 		kd->ig = true;
 		kd->intrcount++;
-		dcpu_interrupt_up(0, kd->intno);
+		dcpu_route_up(&kd->route, kd->intno);
 	} else
 		/* Increase the number of overrun characters */
 		kd->overrun++;
@@ -161,11 +219,16 @@ static bool dkeyboard_init(parm_link_s *parm, device_s *dev)
 	parm_next( &parm);
 	kd->addr = parm_next_int(&parm);
 	kd->intno = parm_next_int(&parm);
+	dcpu_route_init(&kd->route);
 	
 	kd->ig = false;
 	kd->intrcount = 0;
 	kd->keycount = 0;
 	kd->overrun = 0;
+	
+	kd->replay = NULL;
+	kd->replay_count = 0;
+	kd->replay_next = 0;
 
 	/* Checks */
 
@@ -177,7 +240,7 @@ static bool dkeyboard_init(parm_link_s *parm, device_s *dev)
 	}
 
 	/* Interrupt no */
-	if (kd->intno > 6) {
+	if ((kd->intno < 0) || (kd->intno > 6)) {
 		mprintf("Interrupt number must be within 0..6\n");
 		free(kd);
 		return false;
@@ -199,6 +262,14 @@ static bool dkeyboard_info(parm_link_s *parm, device_s *dev)
 	mprintf("%#08x %-6u %#02x %u\n",
 		kb->addr, kb->intno, kb->incomming, kb->ig);
 	
+	mprintf("Route: ");
+	dcpu_route_print(&kb->route);
+	mprintf("\n");
+	
+	if (kb->replay != NULL)
+		mprintf("Replay: event %zu of %zu\n",
+		    kb->replay_next, kb->replay_count);
+	
 	return true;
 }
 
@@ -253,11 +324,288 @@ static bool dkeyboard_gen(parm_link_s *parm, device_s *dev)
 }
 
 
+/** Route command implementation
+ *
+ */
+static bool dkeyboard_route(parm_link_s *parm, device_s *dev)
+{
+	keyboard_data_s *kd = (keyboard_data_s *) dev->data;
+	
+	return dcpu_route_set(&kd->route, parm);
+}
+
+
+/** Free the replay script
+ *
+ */
+static void replay_free(keyboard_data_s *kd)
+{
+	size_t i;
+	
+	for (i = 0; i < kd->replay_count; i++) {
+		safe_free(kd->replay[i].pattern);
+		safe_free(kd->replay[i].text);
+	}
+	
+	safe_free(kd->replay);
+	kd->replay_count = 0;
+	kd->replay_next = 0;
+}
+
+
+/** Parse a quoted replay string
+ *
+ * The escape sequences \n, \r, \t, \\, \" and \xHH are recognized.
+ *
+ * @param str Current position in the line, updated.
+ * @param len Length of the string is returned through this parameter.
+ *
+ * @return Allocated string or NULL on a syntax error.
+ *
+ */
+static char *replay_string(const char **str, size_t *len)
+{
+	const char *c = *str;
+	
+	while ((*c == ' ') || (*c == '\t'))
+		c++;
+	
+	if (*c != '"')
+		return NULL;
+	
+	c++;
+	
+	char *out = (char *) safe_malloc(strlen(c) + 1);
+	size_t n = 0;
+	
+	while (*c != '"') {
+		if ((*c == 0) || (*c == '\n')) {
+			free(out);
+			return NULL;
+		}
+		
+		if (*c != '\\') {
+			out[n++] = *c++;
+			continue;
+		}
+		
+		c++;
+		switch (*c) {
+		case 'n':
+			out[n++] = '\n';
+			break;
+		case 'r':
+			out[n++] = '\r';
+			break;
+		case 't':
+			out[n++] = '\t';
+			break;
+		case 'x':
+			if ((!hexadecimal(c[1])) || (!hexadecimal(c[2]))) {
+				free(out);
+				return NULL;
+			}
+			
+			out[n++] = (char) (hex2int(c[1]) * 16 + hex2int(c[2]));
+			c += 2;
+			break;
+		case '\\':
+		case '"':
+			out[n++] = *c;
+			break;
+		default:
+			free(out);
+			return NULL;
+		}
+		
+		c++;
+	}
+	
+	out[n] = 0;
+	*str = c + 1;
+	*len = n;
+	
+	return out;
+}
+
+
+/** Parse a replay script line
+ *
+ * @return False on a syntax error.
+ *
+ */
+static bool replay_parse(const char *line, replay_event_s *ev)
+{
+	char keyword[16];
+	int skip;
+	size_t len;
+	
+	ev->pattern = NULL;
+	ev->text = NULL;
+	ev->cycle = 0;
+	
+	if (sscanf(line, "%15s%n", keyword, &skip) != 1)
+		return false;
+	
+	line += skip;
+	
+	if ((strcmp(keyword, "at") == 0) || (strcmp(keyword, "after") == 0)) {
+		ev->type = (keyword[1] == 't') ? REPLAY_AT : REPLAY_AFTER;
+		
+		if (sscanf(line, "%" SCNu64 "%n", &ev->cycle, &skip) != 1)
+			return false;
+		
+		line += skip;
+	} else if (strcmp(keyword, "expect") == 0) {
+		ev->type = REPLAY_EXPECT;
+		ev->pattern = replay_string(&line, &len);
+		
+		if ((ev->pattern == NULL) || (len == 0))
+			return false;
+	} else
+		return false;
+	
+	ev->text = replay_string(&line, &ev->len);
+	return (ev->text != NULL);
+}
+
+
+/** Replay command implementation
+ *
+ * Each line of the script is one of
+ *   at <cycle> "keys"
+ *   after <cycles> "keys"
+ *   expect "pattern" "keys"
+ * Empty lines and lines starting with # are ignored.
+ *
+ */
+static bool dkeyboard_replay(parm_link_s *parm, device_s *dev)
+{
+	keyboard_data_s *kd = (keyboard_data_s *) dev->data;
+	const char *const filename = parm_str(parm);
+	
+	FILE *file = fopen(filename, "r");
+	if (file == NULL) {
+		io_error(filename);
+		mprintf(txt_file_open_err);
+		return false;
+	}
+	
+	replay_free(kd);
+	
+	char line[REPLAY_LINE];
+	size_t lineno = 0;
+	size_t size = 0;
+	
+	while (fgets(line, REPLAY_LINE, file) != NULL) {
+		lineno++;
+		
+		const char *c = line;
+		while ((*c == ' ') || (*c == '\t'))
+			c++;
+		
+		if ((*c == '#') || (*c == '\n') || (*c == '\r') || (*c == 0))
+			continue;
+		
+		if (kd->replay_count == size) {
+			size = (size == 0) ? 16 : size * 2;
+			kd->replay = (replay_event_s *) realloc(kd->replay,
+			    size * sizeof(replay_event_s));
+			if (kd->replay == NULL)
+				die(ERR_MEM, "Not enough memory");
+		}
+		
+		replay_event_s *ev = &kd->replay[kd->replay_count];
+		if (!replay_parse(c, ev)) {
+			safe_free(ev->pattern);
+			mprintf("%s:%zu: Invalid replay event\n", filename, lineno);
+			fclose(file);
+			replay_free(kd);
+			return false;
+		}
+		
+		kd->replay_count++;
+	}
+	
+	fclose(file);
+	
+	kd->replay_next = 0;
+	kd->replay_armed = false;
+	kd->replay_mark = dprinter_output_count();
+	
+	return true;
+}
+
+
+/** Next key of the replay script
+ *
+ * @return True if a key should be injected.
+ *
+ */
+static bool replay_key(keyboard_data_s *kd, char *key)
+{
+	if (kd->replay_next >= kd->replay_count)
+		return false;
+	
+	replay_event_s *ev = &kd->replay[kd->replay_next];
+	
+	if (!kd->replay_armed) {
+		kd->replay_armed = true;
+		kd->replay_fired = false;
+		kd->replay_pos = 0;
+		kd->replay_deadline = (ev->type == REPLAY_AT) ?
+		    ev->cycle : msteps + ev->cycle;
+		kd->replay_since = kd->replay_mark;
+		
+		/* The pattern has to end after the last event fired */
+		if (ev->type == REPLAY_EXPECT) {
+			size_t len = strlen(ev->pattern);
+			kd->replay_since = (kd->replay_mark >= len) ?
+			    kd->replay_mark - len + 1 : 0;
+		}
+	}
+	
+	if (!kd->replay_fired) {
+		if (ev->type == REPLAY_EXPECT) {
+			if (!dprinter_output_match(ev->pattern, kd->replay_since)) {
+				/* Do not search the same output again */
+				uint64_t count = dprinter_output_count();
+				size_t len = strlen(ev->pattern);
+				
+				if (count >= len)
+					kd->replay_since = count - len + 1;
+				
+				return false;
+			}
+		} else if (msteps < kd->replay_deadline)
+			return false;
+		
+		kd->replay_fired = true;
+		kd->replay_mark = dprinter_output_count();
+	}
+	
+	bool inject = (kd->replay_pos < ev->len);
+	if (inject) {
+		*key = ev->text[kd->replay_pos];
+		kd->replay_pos++;
+	}
+	
+	if (kd->replay_pos == ev->len) {
+		kd->replay_next++;
+		kd->replay_armed = false;
+	}
+	
+	return inject;
+}
+
+
 /** Clean up the device
  *
  */
 static void keyboard_done(device_s *d)
 {
+	replay_free((keyboard_data_s *) d->data);
+	
 	safe_free(d->name);
 	safe_free(d->data);
 }
@@ -278,7 +626,7 @@ static void keyboard_read(cpu_t *cpu, device_s *dev, ptr_t addr, uint32_t *val)
 		kd->incomming = 0;
 		if (kd->ig) {
 			kd->ig = false;
-			dcpu_interrupt_down(0, kd->intno);
+			dcpu_route_down(&kd->route, kd->intno);
 		}
 	}
 }
@@ -289,8 +637,15 @@ static void keyboard_read(cpu_t *cpu, device_s *dev, ptr_t addr, uint32_t *val)
  */
 static void keyboard_step4(device_s *dev)
 {
+	keyboard_data_s *kd = (keyboard_data_s *) dev->data;
 	char buf;
 	
-	if (stdin_poll(&buf))
+	/* Keep the input buffered until the last key is read */
+	if (kd->ig)
+		return;
+	
+	if (replay_key(kd, &buf))
+		gen_key(dev, buf);
+	else if (stdin_poll(&buf))
 		gen_key(dev, buf);
 }
@@ -0,0 +1,1083 @@
+/*
+ * Copyright (c) 2008 Martin Decky
+ * All rights reserved.
+ *
+ * Distributed under the terms of GPL.
+ *
+ *
+ *  Network interface
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#ifndef __WIN32__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#include "dnet.h"
+
+#include "../text.h"
+#include "machine.h"
+#include "dcpu.h"
+#include "../fault.h"
+#include "../io/output.h"
+#include "../utils.h"
+
+/** \{ \name Register offsets */
+#define REGISTER_STATUS    0   /**< Interrupt status (read acknowledges) */
+#define REGISTER_TX_ADDR   4   /**< Transmit ring address */
+#define REGISTER_TX_SIZE   8   /**< Number of transmit descriptors */
+#define REGISTER_TX_HEAD   12  /**< Transmit producer index (doorbell) */
+#define REGISTER_TX_TAIL   16  /**< Transmit consumer index */
+#define REGISTER_RX_ADDR   20  /**< Receive ring address */
+#define REGISTER_RX_SIZE   24  /**< Number of receive descriptors */
+#define REGISTER_RX_HEAD   28  /**< Receive producer index */
+#define REGISTER_RX_TAIL   32  /**< Receive consumer index */
+#define REGISTER_COALESCE  36  /**< Frames per interrupt */
+#define REGISTER_DELAY     40  /**< Maximal interrupt delay in cycles */
+#define REGISTER_LIMIT     44  /**< Size of register block */
+/* \} */
+
+/** \{ \name Status bits */
+#define STATUS_TX     0x01  /**< Frames transmitted */
+#define STATUS_RX     0x02  /**< Frames received */
+#define STATUS_ERROR  0x04  /**< Descriptor error */
+/* \} */
+
+/** \{ \name Descriptor words */
+#define DESC_FLAGS   0  /**< Completion flags */
+#define DESC_LENGTH  1  /**< Frame length or buffer size */
+#define DESC_ADDR    2  /**< Physical memory address */
+#define DESC_WORDS   4  /**< Descriptor size in words */
+/* \} */
+
+/** \{ \name Descriptor flags */
+#define DESC_DONE   0x80000000U
+#define DESC_ERROR  0x00000001U
+/* \} */
+
+/** Maximal frame size */
+#define FRAME_MAX  2048
+
+/** Number of frames waiting for receive buffers */
+#define BACKLOG_SIZE  64
+
+/** Capture file buffer size */
+#define CAPTURE_BUFFER  (1024 * 1024)
+
+/** \{ \name Pcap file format */
+#define PCAP_MAGIC     0xa1b2c3d4
+#define PCAP_ETHERNET  1
+/* \} */
+
+/** Network backends */
+enum net_backend_e {
+	BACKEND_LOOPBACK,  /**< Transmitted frames are received back */
+	BACKEND_SOCKET,    /**< Unix datagram socket */
+	BACKEND_PCAP       /**< Frames received from a pcap file */
+};
+
+/*
+ * Device commands
+ */
+
+static bool dnet_init(parm_link_s *parm, device_s *dev);
+static bool dnet_info(parm_link_s *parm, device_s *dev);
+static bool dnet_stat(parm_link_s *parm, device_s *dev);
+static bool dnet_loopback(parm_link_s *parm, device_s *dev);
+static bool dnet_socket(parm_link_s *parm, device_s *dev);
+static bool dnet_pcap(parm_link_s *parm, device_s *dev);
+static bool dnet_capture(parm_link_s *parm, device_s *dev);
+static bool dnet_route(parm_link_s *parm, device_s *dev);
+
+cmd_s dnet_cmds[] = {
+	{
+		"init",
+		(cmd_f) dnet_init,
+		DEFAULT,
+		DEFAULT,
+		"Initialization",
+		"Initialization",
+		REQ STR "name/device name" NEXT
+		REQ INT "addr/register block address" NEXT
+		REQ INT "intno/interrupt number within 0..6" END
+	},
+	{
+		"help",
+		(cmd_f) dev_generic_help,
+		DEFAULT,
+		DEFAULT,
+		"Display help",
+		"Display help",
+		OPT STR "cmd/command name" END
+	},
+	{
+		"info",
+		(cmd_f) dnet_info,
+		DEFAULT,
+		DEFAULT,
+		"Configuration information",
+		"Configuration information",
+		NOCMD
+	},
+	{
+		"stat",
+		(cmd_f) dnet_stat,
+		DEFAULT,
+		DEFAULT,
+		"Statistics",
+		"Statistics",
+		NOCMD
+	},
+	{
+		"loopback",
+		(cmd_f) dnet_loopback,
+		DEFAULT,
+		DEFAULT,
+		"Receive the transmitted frames back",
+		"Receive the transmitted frames back (default)",
+		NOCMD
+	},
+	{
+		"socket",
+		(cmd_f) dnet_socket,
+		DEFAULT,
+		DEFAULT,
+		"Exchange frames over a Unix datagram socket",
+		"Bind a Unix datagram socket to the local path and send "
+			"the transmitted frames to the remote path",
+		REQ STR "local/local socket path" NEXT
+		REQ STR "remote/remote socket path" END
+	},
+	{
+		"pcap",
+		(cmd_f) dnet_pcap,
+		DEFAULT,
+		DEFAULT,
+		"Receive frames from a pcap file",
+		"Receive frames from a pcap file, the transmitted frames "
+			"are discarded",
+		REQ STR "fname/file name" END
+	},
+	{
+		"capture",
+		(cmd_f) dnet_capture,
+		DEFAULT,
+		DEFAULT,
+		"Capture frames into a pcap file",
+		"Capture all transmitted and received frames into a pcap "
+			"file, stop capturing if no file is specified",
+		OPT STR "fname/file name" END
+	},
+	{
+		"route",
+		(cmd_f) dnet_route,
+		DEFAULT,
+		DEFAULT,
+		"Set the interrupt routing",
+		"Route the interrupt to a processor (cpu no), to processors "
+			"in a mask (mask mask) or round-robin to all processors (rr)",
+		REQ STR "mode/cpu, mask or rr" NEXT
+		OPT VAR "target/processor number, mask or list" END
+	},
+	LAST_CMD
+};
+
+/**< Name of the device as presented to the user */
+const char id_dnet[] = "dnet";
+
+static void dnet_done(device_s *dev);
+static void dnet_step(device_s *dev);
+static void dnet_step4(device_s *dev);
+static void dnet_read(cpu_t *cpu, device_s *dev, ptr_t addr, uint32_t *val);
+static void dnet_write(cpu_t *cpu, device_s *dev, ptr_t addr, uint32_t val);
+
+/**< Dnet object structure */
+device_type_s dnet = {
+	/* Type name and description */
+	.name = id_dnet,
+	.brief = "Network interface",
+	.full = "Network interface with transmit and receive descriptor "
+		"rings in the memory and a local backend",
+	
+	/* Functions */
+	.done = dnet_done,
+	.step = dnet_step,
+	.step4 = dnet_step4,
+	.read = dnet_read,
+	.write = dnet_write,
+	
+	/* Commands */
+	dnet_cmds
+};
+
+/** Descriptor ring */
+typedef struct {
+	uint32_t addr;  /**< Ring address */
+	uint32_t size;  /**< Number of descriptors */
+	uint32_t head;  /**< Producer index */
+	uint32_t tail;  /**< Consumer index */
+} ring_s;
+
+/** Frame waiting for a receive buffer */
+typedef struct {
+	uint32_t data[FRAME_MAX / 4];  /**< Frame data */
+	uint32_t len;                  /**< Frame length */
+} frame_s;
+
+/** Dnet instance data structure */
+typedef struct {
+	/* Configuration */
+	uint32_t addr;               /**< Register block location */
+	int intno;                   /**< Interrupt number */
+	intr_route_t route;          /**< Interrupt routing */
+	
+	/* Rings */
+	ring_s tx;                   /**< Transmit ring */
+	ring_s rx;                   /**< Receive ring */
+	bool tx_notified;            /**< Transmit doorbell rung */
+	
+	/* Interrupt coalescing */
+	uint32_t coalesce;           /**< Frames per interrupt */
+	uint32_t delay;              /**< Maximal interrupt delay */
+	uint32_t pending;            /**< Frames since the last interrupt */
+	uint32_t held;               /**< Cycles since the first pending frame */
+	uint32_t pending_status;     /**< Status of the pending frames */
+	uint32_t status;             /**< Interrupt status */
+	
+	/* Backend */
+	enum net_backend_e backend;  /**< Backend type */
+	int fd;                      /**< Socket */
+	char *local;                 /**< Local socket path */
+#ifndef __WIN32__
+	struct sockaddr_un remote;   /**< Remote socket address */
+#endif
+	FILE *pcap;                  /**< Received pcap file */
+	
+	/* Capture */
+	FILE *capture;               /**< Capture pcap file */
+	char *capture_buf;           /**< Capture file buffer */
+	
+	/* Received frames */
+	frame_s *backlog;            /**< Frames waiting for buffers */
+	unsigned int backlog_head;   /**< First waiting frame */
+	unsigned int backlog_count;  /**< Number of waiting frames */
+	
+	/* Statistics */
+	uint64_t intrcount;          /**< Number of interrupts */
+	uint64_t tx_frames;          /**< Transmitted frames */
+	uint64_t tx_bytes;           /**< Transmitted bytes */
+	uint64_t rx_frames;          /**< Received frames */
+	uint64_t rx_bytes;           /**< Received bytes */
+	uint64_t drops;              /**< Dropped frames */
+} net_data_s;
+
+/** Pcap file header */
+typedef struct {
+	uint32_t magic;
+	uint16_t version_major;
+	uint16_t version_minor;
+	int32_t thiszone;
+	uint32_t sigfigs;
+	uint32_t snaplen;
+	uint32_t network;
+} pcap_header_s;
+
+/** Pcap record header */
+typedef struct {
+	uint32_t ts_sec;
+	uint32_t ts_usec;
+	uint32_t incl_len;
+	uint32_t orig_len;
+} pcap_record_s;
+
+/** Close the backend
+ *
+ * @param nd Device instance data structure
+ *
+ */
+static void dnet_backend_close(net_data_s *nd)
+{
+#ifndef __WIN32__
+	if (nd->fd != -1) {
+		close(nd->fd);
+		unlink(nd->local);
+		nd->fd = -1;
+	}
+#endif
+	
+	safe_free(nd->local);
+	
+	if (nd->pcap != NULL) {
+		fclose(nd->pcap);
+		nd->pcap = NULL;
+	}
+	
+	nd->backend = BACKEND_LOOPBACK;
+}
+
+/** Close the capture file
+ *
+ * @param nd Device instance data structure
+ *
+ * @return true if successful
+ *
+ */
+static bool dnet_capture_close(net_data_s *nd)
+{
+	bool ok = true;
+	
+	if (nd->capture != NULL) {
+		if (fclose(nd->capture) != 0) {
+			io_error(NULL);
+			ok = false;
+		}
+		
+		nd->capture = NULL;
+	}
+	
+	safe_free(nd->capture_buf);
+	return ok;
+}
+
+/** Write a frame into the capture file
+ *
+ * The record is only copied into the file buffer, which is
+ * large enough to keep the write calls infrequent.
+ * The timestamp is the machine cycle counter in microseconds.
+ *
+ * @param nd    Device instance data structure
+ * @param frame Frame data
+ * @param len   Frame length
+ *
+ */
+static void dnet_capture_frame(net_data_s *nd, const uint32_t *frame,
+    uint32_t len)
+{
+	pcap_record_s record = {
+		.ts_sec = msteps / 1000000,
+		.ts_usec = msteps % 1000000,
+		.incl_len = len,
+		.orig_len = len
+	};
+	
+	fwrite(&record, sizeof(record), 1, nd->capture);
+	fwrite(frame, 1, len, nd->capture);
+}
+
+/** Queue a received frame
+ *
+ * @param nd Device instance data structure
+ *
+ * @return Frame structure or NULL if the backlog is full.
+ *
+ */
+static frame_s *dnet_backlog_alloc(net_data_s *nd)
+{
+	if (nd->backlog_count == BACKLOG_SIZE)
+		return NULL;
+	
+	unsigned int slot = (nd->backlog_head + nd->backlog_count) % BACKLOG_SIZE;
+	nd->backlog_count++;
+	
+	return &nd->backlog[slot];
+}
+
+/** Read frames from the pcap file into the backlog
+ *
+ * The file is closed at its end.
+ *
+ * @param nd Device instance data structure
+ *
+ */
+static void dnet_pcap_fill(net_data_s *nd)
+{
+	while (true) {
+		if (nd->backlog_count == BACKLOG_SIZE)
+			return;
+		
+		pcap_record_s record;
+		
+		if (fread(&record, sizeof(record), 1, nd->pcap) < 1)
+			break;
+		
+		if (record.incl_len > FRAME_MAX) {
+			nd->drops++;
+			if (fseek(nd->pcap, record.incl_len, SEEK_CUR) != 0)
+				break;
+			continue;
+		}
+		
+		frame_s *frame = dnet_backlog_alloc(nd);
+		if (fread(frame->data, 1, record.incl_len, nd->pcap) <
+		    record.incl_len) {
+			nd->backlog_count--;
+			break;
+		}
+		
+		frame->len = record.incl_len;
+	}
+	
+	fclose(nd->pcap);
+	nd->pcap = NULL;
+}
+
+/** Receive frames from the socket into the backlog
+ *
+ * @param nd Device instance data structure
+ *
+ */
+static void dnet_socket_fill(net_data_s *nd)
+{
+#ifndef __WIN32__
+	while (nd->backlog_count < BACKLOG_SIZE) {
+		frame_s *frame = dnet_backlog_alloc(nd);
+		ssize_t len = recv(nd->fd, frame->data, FRAME_MAX, 0);
+		
+		if (len <= 0) {
+			nd->backlog_count--;
+			break;
+		}
+		
+		frame->len = len;
+	}
+#endif
+}
+
+/** Send a transmitted frame to the backend
+ *
+ * @param nd    Device instance data structure
+ * @param frame Frame data
+ * @param len   Frame length
+ *
+ */
+static void dnet_backend_send(net_data_s *nd, const uint32_t *frame,
+    uint32_t len)
+{
+	frame_s *loop;
+	
+	switch (nd->backend) {
+	case BACKEND_LOOPBACK:
+		loop = dnet_backlog_alloc(nd);
+		if (loop == NULL) {
+			nd->drops++;
+			break;
+		}
+		
+		memcpy(loop->data, frame, len);
+		loop->len = len;
+		break;
+	case BACKEND_SOCKET:
+#ifndef __WIN32__
+		if (sendto(nd->fd, frame, len, 0,
+		    (struct sockaddr *) &nd->remote, sizeof(nd->remote)) == -1)
+			nd->drops++;
+#endif
+		break;
+	case BACKEND_PCAP:
+		break;
+	}
+}
+
+/** Complete a descriptor
+ *
+ * @param nd     Device instance data structure
+ * @param ring   Descriptor ring
+ * @param desc   Descriptor
+ * @param status Status bit of the ring
+ * @param ok     Request completed successfully
+ *
+ */
+static void dnet_complete(net_data_s *nd, ring_s *ring, uint32_t *desc,
+    uint32_t status, bool ok)
+{
+	/* Write back the flags and the length */
+	desc[DESC_FLAGS] = DESC_DONE | (ok ? 0 : DESC_ERROR);
+	mem_write_block(NULL, ring->addr + ring->tail * DESC_WORDS * 4, desc,
+	    DESC_LENGTH + 1, true);
+	
+	ring->tail = (ring->tail + 1) % ring->size;
+	
+	nd->pending++;
+	nd->pending_status |= status | (ok ? 0 : STATUS_ERROR);
+}
+
+/** Transmit all frames posted to the transmit ring
+ *
+ * @param nd Device instance data structure
+ *
+ */
+static void dnet_transmit(net_data_s *nd)
+{
+	uint32_t frame[FRAME_MAX / 4];
+	
+	while ((nd->tx.size != 0) && (nd->tx.tail != nd->tx.head)) {
+		uint32_t desc[DESC_WORDS];
+		mem_read_block(NULL, nd->tx.addr + nd->tx.tail * DESC_WORDS * 4,
+		    desc, DESC_WORDS, true);
+		
+		uint32_t len = desc[DESC_LENGTH];
+		if ((len == 0) || (len > FRAME_MAX) ||
+		    (!addr_word_aligned(desc[DESC_ADDR]))) {
+			dnet_complete(nd, &nd->tx, desc, STATUS_TX, false);
+			continue;
+		}
+		
+		mem_read_block(NULL, desc[DESC_ADDR], frame, ALIGN_UP(len, 4) / 4,
+		    true);
+		
+		if (nd->capture != NULL)
+			dnet_capture_frame(nd, frame, len);
+		
+		dnet_backend_send(nd, frame, len);
+		
+		nd->tx_frames++;
+		nd->tx_bytes += len;
+		dnet_complete(nd, &nd->tx, desc, STATUS_TX, true);
+	}
+}
+
+/** Move the waiting frames into the posted receive buffers
+ *
+ * @param nd Device instance data structure
+ *
+ */
+static void dnet_receive(net_data_s *nd)
+{
+	while ((nd->backlog_count > 0) && (nd->rx.size != 0) &&
+	    (nd->rx.tail != nd->rx.head)) {
+		uint32_t desc[DESC_WORDS];
+		mem_read_block(NULL, nd->rx.addr + nd->rx.tail * DESC_WORDS * 4,
+		    desc, DESC_WORDS, true);
+		
+		frame_s *frame = &nd->backlog[nd->backlog_head];
+		uint32_t words = ALIGN_UP(frame->len, 4) / 4;
+		
+		if ((desc[DESC_LENGTH] < words * 4) ||
+		    (!addr_word_aligned(desc[DESC_ADDR]))) {
+			/* Keep the frame for the next buffer */
+			dnet_complete(nd, &nd->rx, desc, STATUS_RX, false);
+			continue;
+		}
+		
+		mem_write_block(NULL, desc[DESC_ADDR], frame->data, words, true);
+		
+		if (nd->capture != NULL)
+			dnet_capture_frame(nd, frame->data, frame->len);
+		
+		nd->rx_frames++;
+		nd->rx_bytes += frame->len;
+		
+		desc[DESC_LENGTH] = frame->len;
+		dnet_complete(nd, &nd->rx, desc, STATUS_RX, true);
+		
+		nd->backlog_head = (nd->backlog_head + 1) % BACKLOG_SIZE;
+		nd->backlog_count--;
+	}
+}
+
+/** Raise the interrupt for the pending frames
+ *
+ * @param nd Device instance data structure
+ *
+ */
+static void dnet_interrupt(net_data_s *nd)
+{
+	if (nd->status == 0) {
+		dcpu_route_up(&nd->route, nd->intno);
+		nd->intrcount++;
+	}
+	
+	nd->status |= nd->pending_status;
+	nd->pending_status = 0;
+	nd->pending = 0;
+	nd->held = 0;
+}
+
+/** Init command implementation
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ *
+ * @return true if successful
+ *
+ */
+static bool dnet_init(parm_link_s *parm, device_s *dev)
+{
+	net_data_s *nd = (net_data_s *) safe_malloc_t(net_data_s);
+	memset(nd, 0, sizeof(net_data_s));
+	dev->data = nd;
+	
+	parm_next(&parm);
+	nd->addr = parm_next_int(&parm);
+	nd->intno = parm_next_int(&parm);
+	dcpu_route_init(&nd->route);
+	
+	nd->coalesce = 1;
+	nd->backend = BACKEND_LOOPBACK;
+	nd->fd = -1;
+	
+	if (!addr_word_aligned(nd->addr)) {
+		mprintf("Device address must be 4-byte aligned\n");
+		free(nd);
+		return false;
+	}
+	
+	if ((uint64_t) nd->addr + (uint64_t) REGISTER_LIMIT > 0x100000000ull) {
+		mprintf("Invalid address; registers would exceed the 4 GB limit\n");
+		free(nd);
+		return false;
+	}
+	
+	if ((nd->intno < 0) || (nd->intno > 6)) {
+		mprintf("Interrupt number must be within 0..6\n");
+		free(nd);
+		return false;
+	}
+	
+	nd->backlog = (frame_s *) safe_malloc(BACKLOG_SIZE * sizeof(frame_s));
+	
+	return true;
+}
+
+/** Info command implementation
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ *
+ * @return true; always successful
+ *
+ */
+static bool dnet_info(parm_link_s *parm, device_s *dev)
+{
+	net_data_s *nd = (net_data_s *) dev->data;
+	const char *backend = "loopback";
+	
+	if (nd->backend == BACKEND_SOCKET)
+		backend = "socket";
+	else if (nd->backend == BACKEND_PCAP)
+		backend = "pcap";
+	
+	mprintf("address:%#010" PRIx32 " intno:%d backend:%s capture:%s "
+	    "coalesce:%" PRIu32 " delay:%" PRIu32 "\n", nd->addr, nd->intno,
+	    backend, (nd->capture != NULL) ? "on" : "off", nd->coalesce,
+	    nd->delay);
+	
+	mprintf("tx:%#010" PRIx32 "/%" PRIu32 " head:%" PRIu32 " tail:%" PRIu32
+	    " rx:%#010" PRIx32 "/%" PRIu32 " head:%" PRIu32 " tail:%" PRIu32
+	    " backlog:%u\n", nd->tx.addr, nd->tx.size, nd->tx.head, nd->tx.tail,
+	    nd->rx.addr, nd->rx.size, nd->rx.head, nd->rx.tail,
+	    nd->backlog_count);
+	
+	mprintf("route:");
+	dcpu_route_print(&nd->route);
+	mprintf("\n");
+	
+	return true;
+}
+
+/** Stat command implementation
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ *
+ * @return true; always successful
+ *
+ */
+static bool dnet_stat(parm_link_s *parm, device_s *dev)
+{
+	net_data_s *nd = (net_data_s *) dev->data;
+	
+	mprintf("Interrupts           TX frames            TX bytes\n");
+	mprintf("-------------------- -------------------- --------------------\n");
+	mprintf("%20" PRIu64 " %20" PRIu64 " %20" PRIu64 "\n",
+	    nd->intrcount, nd->tx_frames, nd->tx_bytes);
+	
+	mprintf("Dropped              RX frames            RX bytes\n");
+	mprintf("-------------------- -------------------- --------------------\n");
+	mprintf("%20" PRIu64 " %20" PRIu64 " %20" PRIu64 "\n",
+	    nd->drops, nd->rx_frames, nd->rx_bytes);
+	
+	return true;
+}
+
+/** Loopback command implementation
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ *
+ * @return true; always successful
+ *
+ */
+static bool dnet_loopback(parm_link_s *parm, device_s *dev)
+{
+	net_data_s *nd = (net_data_s *) dev->data;
+	
+	dnet_backend_close(nd);
+	return true;
+}
+
+/** Socket command implementation
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ *
+ * @return true if successful
+ *
+ */
+static bool dnet_socket(parm_link_s *parm, device_s *dev)
+{
+#ifdef __WIN32__
+	mprintf("Unix sockets are not supported on this platform\n");
+	return false;
+#else
+	net_data_s *nd = (net_data_s *) dev->data;
+	const char *const local = parm_str(parm);
+	parm_next(&parm);
+	const char *const remote = parm_str(parm);
+	struct sockaddr_un sa;
+	
+	if ((strlen(local) >= sizeof(sa.sun_path)) ||
+	    (strlen(remote) >= sizeof(sa.sun_path))) {
+		mprintf("Socket path too long\n");
+		return false;
+	}
+	
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	strcpy(sa.sun_path, local);
+	
+	int fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+	if (fd == -1) {
+		io_error(local);
+		return false;
+	}
+	
+	unlink(local);
+	if ((bind(fd, (struct sockaddr *) &sa, sizeof(sa)) == -1) ||
+	    (fcntl(fd, F_SETFL, O_NONBLOCK) == -1)) {
+		io_error(local);
+		close(fd);
+		return false;
+	}
+	
+	dnet_backend_close(nd);
+	
+	nd->backend = BACKEND_SOCKET;
+	nd->fd = fd;
+	nd->local = safe_strdup(local);
+	
+	memset(&nd->remote, 0, sizeof(nd->remote));
+	nd->remote.sun_family = AF_UNIX;
+	strcpy(nd->remote.sun_path, remote);
+	
+	return true;
+#endif
+}
+
+/** Pcap command implementation
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ *
+ * @return true if successful
+ *
+ */
+static bool dnet_pcap(parm_link_s *parm, device_s *dev)
+{
+	net_data_s *nd = (net_data_s *) dev->data;
+	const char *const path = parm_str(parm);
+	pcap_header_s header;
+	
+	FILE *file = try_fopen(path, "rb");
+	if (file == NULL) {
+		mprintf(txt_file_open_err);
+		return false;
+	}
+	
+	if (fread(&header, sizeof(header), 1, file) < 1) {
+		io_error(path);
+		mprintf(txt_file_read_err);
+		try_soft_fclose(file, path);
+		return false;
+	}
+	
+	if ((header.magic != PCAP_MAGIC) || (header.network != PCAP_ETHERNET)) {
+		mprintf("Unsupported pcap file\n");
+		try_soft_fclose(file, path);
+		return false;
+	}
+	
+	dnet_backend_close(nd);
+	
+	nd->backend = BACKEND_PCAP;
+	nd->pcap = file;
+	
+	return true;
+}
+
+/** Capture command implementation
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ *
+ * @return true if successful
+ *
+ */
+static bool dnet_capture(parm_link_s *parm, device_s *dev)
+{
+	net_data_s *nd = (net_data_s *) dev->data;
+	
+	if (parm_type(parm) == tt_end)
+		return dnet_capture_close(nd);
+	
+	const char *const path = parm_str(parm);
+	
+	FILE *file = try_fopen(path, "wb");
+	if (file == NULL) {
+		mprintf(txt_file_create_err);
+		return false;
+	}
+	
+	char *buf = (char *) safe_malloc(CAPTURE_BUFFER);
+	setvbuf(file, buf, _IOFBF, CAPTURE_BUFFER);
+	
+	pcap_header_s header = {
+		.magic = PCAP_MAGIC,
+		.version_major = 2,
+		.version_minor = 4,
+		.thiszone = 0,
+		.sigfigs = 0,
+		.snaplen = FRAME_MAX,
+		.network = PCAP_ETHERNET
+	};
+	
+	if (fwrite(&header, sizeof(header), 1, file) < 1) {
+		io_error(path);
+		mprintf(txt_file_write_err);
+		try_soft_fclose(file, path);
+		free(buf);
+		return false;
+	}
+	
+	if (!dnet_capture_close(nd)) {
+		try_soft_fclose(file, path);
+		free(buf);
+		return false;
+	}
+	
+	nd->capture = file;
+	nd->capture_buf = buf;
+	
+	return true;
+}
+
+/** Route command implementation
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ *
+ * @return true if successful
+ *
+ */
+static bool dnet_route(parm_link_s *parm, device_s *dev)
+{
+	net_data_s *nd = (net_data_s *) dev->data;
+	
+	return dcpu_route_set(&nd->route, parm);
+}
+
+/** Dispose the device
+ *
+ * @param dev Device instance structure
+ *
+ */
+static void dnet_done(device_s *dev)
+{
+	net_data_s *nd = (net_data_s *) dev->data;
+	
+	dnet_backend_close(nd);
+	dnet_capture_close(nd);
+	
+	safe_free(nd->backlog);
+	safe_free(dev->name);
+	safe_free(dev->data);
+}
+
+/** One step implementation
+ *
+ * The posted frames are transmitted in the cycle after the doorbell,
+ * the waiting frames are received as soon as there are free buffers.
+ * The interrupt is raised when enough frames have completed or when
+ * the first completed frame has waited for the maximal delay (or
+ * when no more frames are waiting if there is no delay).
+ *
+ * @param dev Device instance structure
+ *
+ */
+static void dnet_step(device_s *dev)
+{
+	net_data_s *nd = (net_data_s *) dev->data;
+	
+	if (nd->tx_notified) {
+		nd->tx_notified = false;
+		dnet_transmit(nd);
+	}
+	
+	if ((nd->pcap != NULL) && (nd->backlog_count == 0))
+		dnet_pcap_fill(nd);
+	
+	if (nd->backlog_count > 0)
+		dnet_receive(nd);
+	
+	if (nd->pending > 0) {
+		nd->held++;
+		
+		/* Without a delay a partial batch is raised as soon
+		   as no more frames are waiting to be received */
+		bool expired = (nd->delay == 0) ? (nd->backlog_count == 0) :
+		    (nd->held >= nd->delay);
+		
+		if ((nd->pending >= nd->coalesce) || (expired))
+			dnet_interrupt(nd);
+	}
+}
+
+/** One step4 implementation
+ *
+ * The socket is polled only here to keep the system
+ * calls out of the fast path.
+ *
+ * @param dev Device instance structure
+ *
+ */
+static void dnet_step4(device_s *dev)
+{
+	net_data_s *nd = (net_data_s *) dev->data;
+	
+	if (nd->backend == BACKEND_SOCKET)
+		dnet_socket_fill(nd);
+}
+
+/** Read command implementation
+ *
+ * @param cpu  Processor which reads (or NULL)
+ * @param dev  Device instance structure
+ * @param addr Address of the read operation
+ * @param val  Read (returned) value
+ *
+ */
+static void dnet_read(cpu_t *cpu, device_s *dev, ptr_t addr, uint32_t *val)
+{
+	net_data_s *nd = (net_data_s *) dev->data;
+	
+	if ((addr < nd->addr) || (addr >= nd->addr + REGISTER_LIMIT))
+		return;
+	
+	switch (addr - nd->addr) {
+	case REGISTER_STATUS:
+		/* Reading acknowledges the interrupt */
+		*val = nd->status;
+		if (nd->status != 0) {
+			nd->status = 0;
+			dcpu_route_down(&nd->route, nd->intno);
+		}
+		break;
+	case REGISTER_TX_ADDR:
+		*val = nd->tx.addr;
+		break;
+	case REGISTER_TX_SIZE:
+		*val = nd->tx.size;
+		break;
+	case REGISTER_TX_HEAD:
+		*val = nd->tx.head;
+		break;
+	case REGISTER_TX_TAIL:
+		*val = nd->tx.tail;
+		break;
+	case REGISTER_RX_ADDR:
+		*val = nd->rx.addr;
+		break;
+	case REGISTER_RX_SIZE:
+		*val = nd->rx.size;
+		break;
+	case REGISTER_RX_HEAD:
+		*val = nd->rx.head;
+		break;
+	case REGISTER_RX_TAIL:
+		*val = nd->rx.tail;
+		break;
+	case REGISTER_COALESCE:
+		*val = nd->coalesce;
+		break;
+	case REGISTER_DELAY:
+		*val = nd->delay;
+		break;
+	}
+}
+
+/** Write command implementation
+ *
+ * Setting the ring address or size resets the ring indices.
+ * The producer index must lie within the ring.
+ *
+ * @param cpu  Processor which writes (or NULL)
+ * @param dev  Device instance structure
+ * @param addr Address of the write operation
+ * @param val  Value to write
+ *
+ */
+static void dnet_write(cpu_t *cpu, device_s *dev, ptr_t addr, uint32_t val)
+{
+	net_data_s *nd = (net_data_s *) dev->data;
+	
+	if ((addr < nd->addr) || (addr >= nd->addr + REGISTER_LIMIT))
+		return;
+	
+	switch (addr - nd->addr) {
+	case REGISTER_TX_ADDR:
+		nd->tx.addr = val;
+		nd->tx.head = 0;
+		nd->tx.tail = 0;
+		break;
+	case REGISTER_TX_SIZE:
+		nd->tx.size = val;
+		nd->tx.head = 0;
+		nd->tx.tail = 0;
+		break;
+	case REGISTER_TX_HEAD:
+		if (val < nd->tx.size) {
+			nd->tx.head = val;
+			nd->tx_notified = true;
+		}
+		break;
+	case REGISTER_RX_ADDR:
+		nd->rx.addr = val;
+		nd->rx.head = 0;
+		nd->rx.tail = 0;
+		break;
+	case REGISTER_RX_SIZE:
+		nd->rx.size = val;
+		nd->rx.head = 0;
+		nd->rx.tail = 0;
+		break;
+	case REGISTER_RX_HEAD:
+		if (val < nd->rx.size)
+			nd->rx.head = val;
+		break;
+	case REGISTER_COALESCE:
+		nd->coalesce = (val == 0) ? 1 : val;
+		break;
+	case REGISTER_DELAY:
+		nd->delay = val;
+		break;
+	}
+}
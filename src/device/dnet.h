@@ -0,0 +1,19 @@
+/*
+ * Copyright (c) 2008 Martin Decky
+ * All rights reserved.
+ *
+ * Distributed under the terms of GPL.
+ *
+ *
+ *  Network interface
+ *
+ */
+
+#ifndef DNET_H_
+#define DNET_H_
+
+#include "device.h"
+
+extern device_type_s dnet;
+
+#endif /* DNET_H_ */
@@ -19,6 +19,7 @@
 #include "device.h"
 #include "machine.h"
 #include "dcpu.h"
+#include "../main.h"
 #include "../io/output.h"
 #include "../parser.h"
 #include "../utils.h"
@@ -30,6 +31,19 @@
 #define REGISTER_LIMIT    8  /**< Register block size */
 /* \} */
 
+/** Number of 32-bit mask words covering all processors */
+#define MASK_WORDS  ((MAX_CPU + 31) / 32)
+
+/** \{ \name Extended registers (optional block) */
+#define REGISTER_EXT_UP_CPU     0  /**< Assert interrupt on a processor */
+#define REGISTER_EXT_DOWN_CPU   4  /**< Deassert interrupt on a processor */
+#define REGISTER_EXT_UP_MASK    8  /**< Assert interrupts (mask words) */
+#define REGISTER_EXT_DOWN_MASK  (REGISTER_EXT_UP_MASK + 4 * MASK_WORDS)
+                                   /**< Deassert interrupts (mask words) */
+#define REGISTER_EXT_LIMIT      (REGISTER_EXT_DOWN_MASK + 4 * MASK_WORDS)
+                                   /**< Extended register block size */
+/* \} */
+
 /*
  * Device commands
  */
@@ -51,7 +65,8 @@ cmd_s dorder_cmds[] = {
 		"Initialization",
 		REQ STR "name/order name" NEXT
 		REQ INT "addr/order register address" NEXT
-		REQ INT "int_no/interrupt number within 0..6" END
+		REQ INT "int_no/interrupt number within 0..6" NEXT
+		OPT INT "ext_addr/extended register block address" END
 	},
 	{
 		"help",
@@ -131,45 +146,74 @@ device_type_s dorder = {
 
 /** Dorder instance data structure */
 typedef struct {
-	uint32_t addr;  /**< Dorder address */
-	int intno;      /**< Interrupt number */
+	uint32_t addr;      /**< Dorder address */
+	int intno;          /**< Interrupt number */
+	bool ext;           /**< Extended register block present */
+	uint32_t ext_addr;  /**< Extended register block address */
 	
 	uint64_t cmds;  /**< Total number of commands */
 } dorder_data_s;
 
 /** Write to the synchronisation register - generate interrupts.
  *
- * @param od Dorder instance data structure
- * @param val A value (mask) which identifies processors
+ * @param od   Dorder instance data structure
+ * @param word Index of the mask word (processors 32 * word and above)
+ * @param val  A value (mask) which identifies processors
  *
  */
-static void sync_up_write(dorder_data_s *od, uint32_t val)
+static void sync_up_write(dorder_data_s *od, unsigned int word, uint32_t val)
 {
 	unsigned int i;
 	od->cmds++;
 	
-	for (i = 0; i < 32; i++, val >>= 1)
+	for (i = word * 32; val != 0; i++, val >>= 1)
 		if (val & 1)
 			dcpu_interrupt_up(i, od->intno);
 }
 
 /** Write to the interrupt-down register - disable pending interrupts.
  *
- * @param od  Dorder instance data structure
- * @param val A value (mask) which identifies processors
+ * @param od   Dorder instance data structure
+ * @param word Index of the mask word (processors 32 * word and above)
+ * @param val  A value (mask) which identifies processors
  *
  */
-static void sync_down_write(dorder_data_s *od, uint32_t val)
+static void sync_down_write(dorder_data_s *od, unsigned int word,
+    uint32_t val)
 {
 	unsigned int i;
 	
 	od->cmds++;
 	
-	for (i = 0; i < 32; i++, val >>= 1)
+	for (i = word * 32; val != 0; i++, val >>= 1)
 		if (val & 1)
 			dcpu_interrupt_down(i, od->intno);
 }
 
+/** Read the pending state of the dorder interrupt
+ *
+ * @param od   Dorder instance data structure
+ * @param word Index of the mask word (processors 32 * word and above)
+ *
+ * @return Mask of processors with the interrupt pending.
+ *
+ */
+static uint32_t sync_pending_read(dorder_data_s *od, unsigned int word)
+{
+	uint32_t mask = 0;
+	unsigned int i;
+	
+	for (i = 0; i < 32; i++) {
+		cpu_t *cpu = dcpu_find_no(word * 32 + i);
+		
+		if ((cpu != NULL) &&
+		    (cp0_cause(cpu) & (1 << (cp0_cause_ip0_shift + od->intno))))
+			mask |= 1 << i;
+	}
+	
+	return mask;
+}
+
 /** Init command implementation
  *
  * @param parm Command-line parameters
@@ -188,6 +232,9 @@ static bool dorder_init(parm_link_s *parm, device_s *dev)
 	od->addr = parm_next_int(&parm);
 	od->intno = parm_next_int(&parm);
 	od->cmds = 0;
+	
+	od->ext = (parm_type(parm) == tt_int);
+	od->ext_addr = od->ext ? parm_int(parm) : 0;
 
 	/* Checks */
 
@@ -201,8 +248,32 @@ static bool dorder_init(parm_link_s *parm, device_s *dev)
 	/* Address limit */
 	if ((uint64_t) od->addr + (uint64_t) REGISTER_LIMIT > 0x100000000ull) {
 		mprintf("Invalid address; registers would exceed the 4 GB limit\n");
+		safe_free(od);
 		return false;
 	}
+	
+	/* Extended register block */
+	if (od->ext) {
+		if (!addr_word_aligned(od->ext_addr)) {
+			mprintf("Dorder extended address must be 4-byte aligned\n");
+			safe_free(od);
+			return false;
+		}
+		
+		if ((uint64_t) od->ext_addr + (uint64_t) REGISTER_EXT_LIMIT
+		    > 0x100000000ull) {
+			mprintf("Invalid address; registers would exceed the 4 GB limit\n");
+			safe_free(od);
+			return false;
+		}
+		
+		if ((od->ext_addr < od->addr + REGISTER_LIMIT) &&
+		    (od->addr < od->ext_addr + REGISTER_EXT_LIMIT)) {
+			mprintf("Extended registers overlap the basic registers\n");
+			safe_free(od);
+			return false;
+		}
+	}
 
 	/* Interrupt number */
 	if ((od->intno < 0) || (od->intno > 6)) {
@@ -226,9 +297,14 @@ static bool dorder_info(parm_link_s *parm, device_s *dev)
 {
 	dorder_data_s *od = (dorder_data_s *) dev->data;
 	
-	mprintf("Address    Int no\n");
-	mprintf("---------- ------\n");
-	mprintf("%#10" PRIx64 " %d\n", od->addr, od->intno);
+	mprintf("Address    Int no Extended\n");
+	mprintf("---------- ------ ----------\n");
+	mprintf("%#10" PRIx32 " %-6d ", od->addr, od->intno);
+	
+	if (od->ext)
+		mprintf("%#10" PRIx32 "\n", od->ext_addr);
+	else
+		mprintf("no\n");
 
 	return true;
 }
@@ -262,7 +338,7 @@ static bool dorder_stat(parm_link_s *parm, device_s *dev)
  */
 static bool dorder_synchup(parm_link_s *parm, device_s *dev)
 {
-	sync_up_write((dorder_data_s *) dev->data, parm->token.tval.i);
+	sync_up_write((dorder_data_s *) dev->data, 0, parm->token.tval.i);
 	return true;
 }
 
@@ -276,7 +352,7 @@ static bool dorder_synchup(parm_link_s *parm, device_s *dev)
  */
 static bool dorder_synchdown(parm_link_s *parm, device_s *dev)
 {
-	sync_down_write((dorder_data_s *) dev->data, parm->token.tval.i);
+	sync_down_write((dorder_data_s *) dev->data, 0, parm->token.tval.i);
 	return true;
 }
 
@@ -311,6 +387,18 @@ static void dorder_read(cpu_t *cpu, device_s *dev, ptr_t addr, uint32_t *val)
 			*val = (uint32_t) -1;
 	} else if (addr == od->addr + REGISTER_INT_DOWN)
 		*val = 0;
+	else if ((od->ext) && (addr_word_aligned(addr)) &&
+	    (addr >= od->ext_addr) &&
+	    (addr < od->ext_addr + REGISTER_EXT_LIMIT)) {
+		ptr_t offset = addr - od->ext_addr;
+		
+		if ((offset >= REGISTER_EXT_UP_MASK) &&
+		    (offset < REGISTER_EXT_DOWN_MASK))
+			*val = sync_pending_read(od,
+			    (offset - REGISTER_EXT_UP_MASK) / 4);
+		else
+			*val = 0;
+	}
 }
 
 
@@ -326,7 +414,23 @@ void dorder_write(cpu_t *cpu, device_s *dev, ptr_t addr, uint32_t val)
 	dorder_data_s *od = (dorder_data_s *) dev->data;
 	
 	if (addr == od->addr + REGISTER_INT_UP)
-		sync_up_write(od, val);
+		sync_up_write(od, 0, val);
 	else if (addr == od->addr + REGISTER_INT_DOWN)
-		sync_down_write(od, val);
+		sync_down_write(od, 0, val);
+	else if ((od->ext) && (addr_word_aligned(addr)) &&
+	    (addr >= od->ext_addr) &&
+	    (addr < od->ext_addr + REGISTER_EXT_LIMIT)) {
+		ptr_t offset = addr - od->ext_addr;
+		
+		if (offset == REGISTER_EXT_UP_CPU) {
+			od->cmds++;
+			dcpu_interrupt_up(val, od->intno);
+		} else if (offset == REGISTER_EXT_DOWN_CPU) {
+			od->cmds++;
+			dcpu_interrupt_down(val, od->intno);
+		} else if (offset < REGISTER_EXT_DOWN_MASK)
+			sync_up_write(od, (offset - REGISTER_EXT_UP_MASK) / 4, val);
+		else
+			sync_down_write(od, (offset - REGISTER_EXT_DOWN_MASK) / 4, val);
+	}
 }
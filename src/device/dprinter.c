@@ -14,6 +14,17 @@
 #include <string.h>
 #include <stdbool.h>
 #include <inttypes.h>
+#include <errno.h>
+
+#ifndef __WIN32__
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+	#define MSG_NOSIGNAL  0
+#endif
 
 #include "dprinter.h"
 
@@ -28,6 +39,20 @@
 #define REGISTER_CHAR  0  /* Outpu character */
 #define REGISTER_LIMIT 4  /* Size of the register block */
 
+/* Default output buffer size */
+#define BUFFER_SIZE  4096
+
+/* Size of the recent output history (all printers) */
+#define HISTORY_SIZE  1024
+
+/* Output sinks */
+enum sink_e {
+	SINK_STDOUT,   /* Standard output */
+	SINK_FILE,     /* File or FIFO */
+	SINK_SOCKET,   /* Unix socket */
+	SINK_CAPTURE   /* In-memory capture */
+};
+
 
 /*
  * Device commands
@@ -38,6 +63,10 @@ static bool dprinter_info(parm_link_s *parm, device_s *dev);
 static bool dprinter_stat(parm_link_s *parm, device_s *dev);
 static bool dprinter_redir(parm_link_s *parm, device_s *dev);
 static bool dprinter_stdout(parm_link_s *parm, device_s *dev);
+static bool dprinter_socket(parm_link_s *parm, device_s *dev);
+static bool dprinter_capture(parm_link_s *parm, device_s *dev);
+static bool dprinter_dump(parm_link_s *parm, device_s *dev);
+static bool dprinter_buffer(parm_link_s *parm, device_s *dev);
 
 cmd_s printer_cmds[] = {
 	{
@@ -83,7 +112,7 @@ cmd_s printer_cmds[] = {
 		DEFAULT,
 		DEFAULT,
 		"Redirect output to the specified file",
-		"Redirect output to the specified file",
+		"Redirect output to the specified file or FIFO",
 		REQ STR "filename/output file name" END
 	},
 	{
@@ -95,6 +124,44 @@ cmd_s printer_cmds[] = {
 		"Redirect output to the standard output",
 		NOCMD
 	},
+	{
+		"socket",
+		(cmd_f) dprinter_socket,
+		DEFAULT,
+		DEFAULT,
+		"Redirect output to the specified Unix socket",
+		"Redirect output to a listening Unix socket",
+		REQ STR "path/socket path" END
+	},
+	{
+		"capture",
+		(cmd_f) dprinter_capture,
+		DEFAULT,
+		DEFAULT,
+		"Capture output in memory",
+		"Capture output in memory, use dump to read it",
+		NOCMD
+	},
+	{
+		"dump",
+		(cmd_f) dprinter_dump,
+		DEFAULT,
+		DEFAULT,
+		"Print the captured output",
+		"Print the captured output or write it to the specified file",
+		OPT STR "filename/output file name" END
+	},
+	{
+		"buffer",
+		(cmd_f) dprinter_buffer,
+		DEFAULT,
+		DEFAULT,
+		"Set the output buffering",
+		"Set the output buffer size in bytes and the flush interval "
+			"in units of 4096 cycles",
+		REQ INT "size/buffer size" NEXT
+		OPT INT "interval/flush interval" END
+	},
 	LAST_CMD
 };
 
@@ -126,12 +193,25 @@ struct printer_data_s {
 	uint32_t addr;		/* Printer register address */
 	bool flush;		/* Flush-the-output flag (flush is necessary and it slow) */
 	
+	enum sink_e sink;	/* Output sink */
 	FILE *output_file;	/* Output file */
+	string_t capture;	/* Captured output */
+	
+	char *buf;		/* Output buffer */
+	size_t size;		/* Output buffer size */
+	size_t pos;		/* Buffered characters */
+	uint32_t interval;	/* Flush interval (in step4 periods) */
+	uint32_t ticks;		/* Step4 periods since the last flush */
 	
 	uint64_t count;		/* Number of output characters */
+	uint64_t writes;	/* Number of output flushes */
 };
 typedef struct printer_data_s printer_data_s;
 
+/* Recent output of all printers (for output triggers) */
+static char history[HISTORY_SIZE];
+static uint64_t history_count = 0;
+
 
 
 /** Init command implementation
@@ -147,9 +227,16 @@ static bool dprinter_init(parm_link_s *parm, device_s *dev)
 	parm_next( &parm);
 	pd->addr = parm_next_int(&parm);
 	pd->flush = false;
+	pd->sink = SINK_STDOUT;
 	pd->output_file = stdout;
 	
+	pd->size = BUFFER_SIZE;
+	pd->pos = 0;
+	pd->interval = 1;
+	pd->ticks = 0;
+	
 	pd->count = 0;
+	pd->writes = 0;
 	
 	/* Check address alignment */
 	if (!addr_word_aligned(pd->addr)) {
@@ -158,10 +245,130 @@ static bool dprinter_init(parm_link_s *parm, device_s *dev)
 		return false;
 	}
 	
+	pd->buf = (char *) safe_malloc(pd->size);
+	string_init(&pd->capture);
+	
 	return true;
 }
 
 
+/** Write the buffered output to a file or socket sink
+ *
+ * The socket is written directly without SIGPIPE,
+ * so a closed listener only fails the write.
+ *
+ * @return False if the output could not be written.
+ *
+ */
+static bool printer_write_sink(printer_data_s *pd)
+{
+#ifndef __WIN32__
+	if (pd->sink == SINK_SOCKET) {
+		size_t done = 0;
+		
+		while (done < pd->pos) {
+			ssize_t wr = send(fileno(pd->output_file), pd->buf + done,
+			    pd->pos - done, MSG_NOSIGNAL);
+			if (wr == -1) {
+				if (errno == EINTR)
+					continue;
+				
+				return false;
+			}
+			
+			done += wr;
+		}
+		
+		return true;
+	}
+#endif
+	
+	if (fwrite(pd->buf, 1, pd->pos, pd->output_file) < pd->pos)
+		return false;
+	
+	return (fflush(pd->output_file) == 0);
+}
+
+
+/** Write the buffered output to the sink
+ *
+ * If a file or socket sink fails, it is closed and
+ * the output continues to the standard output.
+ *
+ */
+static void printer_flush(printer_data_s *pd)
+{
+	pd->flush = false;
+	pd->ticks = 0;
+	
+	if (pd->pos == 0)
+		return;
+	
+	if (pd->sink == SINK_CAPTURE) {
+		size_t i;
+		for (i = 0; i < pd->pos; i++)
+			string_push(&pd->capture, pd->buf[i]);
+	} else if (!printer_write_sink(pd)) {
+		if (pd->sink == SINK_STDOUT)
+			clearerr(stdout);
+		else {
+			io_error(NULL);
+			mprintf("Printer output failed, "
+			    "continuing to the standard output\n");
+			
+			(void) fclose(pd->output_file);
+			pd->sink = SINK_STDOUT;
+			pd->output_file = stdout;
+		}
+	}
+	
+	pd->pos = 0;
+	pd->writes++;
+}
+
+
+/** Flush the output and close the current sink
+ *
+ * @return False if the output file could not be closed.
+ *
+ */
+static bool printer_close(printer_data_s *pd)
+{
+	printer_flush(pd);
+	
+	bool ok = true;
+	
+	if ((pd->sink == SINK_FILE) || (pd->sink == SINK_SOCKET)) {
+		if (fclose(pd->output_file) != 0) {
+			io_error(NULL);
+			error(txt_file_close_err);
+			ok = false;
+		}
+	}
+	
+	pd->sink = SINK_STDOUT;
+	pd->output_file = stdout;
+	
+	return ok;
+}
+
+
+/** Flush the output of all printers
+ *
+ * Called when the simulation stops for interaction.
+ *
+ */
+void dprinter_flush(void)
+{
+	device_s *dev = NULL;
+	
+	while (dev_next(&dev, DEVICE_FILTER_ALL)) {
+		if (dev->type == &dprinter)
+			printer_flush((printer_data_s *) dev->data);
+	}
+}
+
+
 /** Redir command implementation
  *
  */
@@ -181,15 +388,13 @@ static bool dprinter_redir(parm_link_s *parm, device_s *dev)
 	}
 	
 	/* Close old output file */
-	if (pd->output_file != stdout) {
-		if (!fclose(pd->output_file)) {
-			io_error(NULL);
-			error(txt_file_close_err);
-			return false;
-		}
+	if (!printer_close(pd)) {
+		fclose(new_file);
+		return false;
 	}
 	
 	/* Set new output file */
+	pd->sink = SINK_FILE;
 	pd->output_file = new_file;
 	return true;
 }
@@ -203,15 +408,194 @@ static bool dprinter_stdout(parm_link_s *parm, device_s *dev)
 	printer_data_s *pd = (printer_data_s *) dev->data;
 
 	/* Close old ouput file if it is not stdout already */
-	if (pd->output_file != stdout) {
-		if (!fclose( pd->output_file)) {
-			io_error(NULL);
-			return txt_file_close_err;
+	return printer_close(pd);
+}
+
+
+/** Number of characters written by all printers
+ *
+ */
+uint64_t dprinter_output_count(void)
+{
+	return history_count;
+}
+
+
+/** Check whether the recent output contains a pattern
+ *
+ * @param pattern Pattern to search for.
+ * @param since   Only the output after this character count is searched
+ *                (as far as the history reaches).
+ *
+ */
+bool dprinter_output_match(const char *pattern, uint64_t since)
+{
+	uint64_t start = since;
+	if (history_count - start > HISTORY_SIZE)
+		start = history_count - HISTORY_SIZE;
+	
+	size_t len = strlen(pattern);
+	uint64_t pos;
+	
+	for (pos = start; pos + len <= history_count; pos++) {
+		size_t i;
+		
+		for (i = 0; i < len; i++) {
+			if (history[(pos + i) % HISTORY_SIZE] != pattern[i])
+				break;
 		}
+		
+		if (i == len)
+			return true;
+	}
+	
+	return false;
+}
+
+
+/** Socket command implementation
+ *
+ */
+static bool dprinter_socket(parm_link_s *parm, device_s *dev)
+{
+#ifdef __WIN32__
+	mprintf("Unix sockets are not supported on this platform\n");
+	return false;
+#else
+	printer_data_s *pd = (printer_data_s *) dev->data;
+	const char *const path = parm_str(parm);
+	struct sockaddr_un sa;
+	
+	if (strlen(path) >= sizeof(sa.sun_path)) {
+		mprintf("Socket path too long\n");
+		return false;
+	}
+	
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	strcpy(sa.sun_path, path);
+	
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1) {
+		io_error(path);
+		return false;
+	}
+
+#ifdef SO_NOSIGPIPE
+	int on = 1;
+	(void) setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+	
+	if (connect(fd, (struct sockaddr *) &sa, sizeof(sa)) == -1) {
+		io_error(path);
+		close(fd);
+		return false;
+	}
+	
+	FILE *new_file = fdopen(fd, "w");
+	if (new_file == NULL) {
+		io_error(path);
+		close(fd);
+		return false;
+	}
+	
+	if (!printer_close(pd)) {
+		fclose(new_file);
+		return false;
+	}
+	
+	pd->sink = SINK_SOCKET;
+	pd->output_file = new_file;
+	return true;
+#endif
+}
+
+
+/** Capture command implementation
+ *
+ */
+static bool dprinter_capture(parm_link_s *parm, device_s *dev)
+{
+	printer_data_s *pd = (printer_data_s *) dev->data;
+	
+	if (!printer_close(pd))
+		return false;
+	
+	pd->sink = SINK_CAPTURE;
+	return true;
+}
+
+
+/** Dump command implementation
+ *
+ */
+static bool dprinter_dump(parm_link_s *parm, device_s *dev)
+{
+	printer_data_s *pd = (printer_data_s *) dev->data;
+	
+	printer_flush(pd);
+	
+	if (parm_type(parm) != tt_str) {
+		fwrite(pd->capture.str, 1, pd->capture.pos, stdout);
+		fflush(stdout);
+		return true;
+	}
+	
+	const char *const filename = parm_str(parm);
+	FILE *file = fopen(filename, "w");
+	if (!file) {
+		io_error(filename);
+		mprintf(txt_file_open_err);
+		return false;
+	}
+	
+	if (fwrite(pd->capture.str, 1, pd->capture.pos, file) < pd->capture.pos) {
+		io_error(filename);
+		mprintf(txt_file_write_err);
+		fclose(file);
+		return false;
+	}
+	
+	if (fclose(file) != 0) {
+		io_error(filename);
+		mprintf(txt_file_close_err);
+		return false;
+	}
+	
+	return true;
+}
 
-		pd->output_file = stdout;
+
+/** Buffer command implementation
+ *
+ */
+static bool dprinter_buffer(parm_link_s *parm, device_s *dev)
+{
+	printer_data_s *pd = (printer_data_s *) dev->data;
+	const uint64_t size = parm_next_int(&parm);
+	
+	if ((size == 0) || (size > 0x1000000)) {
+		mprintf("Buffer size out of range 1..16M\n");
+		return false;
+	}
+	
+	uint32_t interval = pd->interval;
+	if (parm_type(parm) == tt_int) {
+		if ((parm_int(parm) == 0) || (parm_int(parm) > UINT32_MAX)) {
+			mprintf("Flush interval out of range\n");
+			return false;
+		}
+		
+		interval = parm_int(parm);
 	}
 	
+	printer_flush(pd);
+	
+	safe_free(pd->buf);
+	pd->size = size;
+	pd->buf = (char *) safe_malloc(pd->size);
+	pd->interval = interval;
+	
 	return true;
 }
 
@@ -238,9 +622,9 @@ static bool dprinter_stat(parm_link_s *parm, device_s *dev)
 {
 	printer_data_s *pd = (printer_data_s *) dev->data;
 	
-	mprintf("Count\n");
-	mprintf("--------------------\n");
-	mprintf("%20" PRIu64 "\n", pd->count);
+	mprintf("Count                Writes\n");
+	mprintf("-------------------- --------------------\n");
+	mprintf("%20" PRIu64 " %20" PRIu64 "\n", pd->count, pd->writes);
 	
 	return true;
 }
@@ -254,12 +638,10 @@ static void printer_done(device_s *d)
 	printer_data_s *pd = (printer_data_s *) d->data;
 
 	/* Close output file if it is not stdout */
-	if (pd->output_file != stdout) {
-		if (!fclose(pd->output_file)) {
-			io_error(NULL);
-			error(txt_file_close_err);
-		}
-	}
+	printer_close(pd);
+	
+	string_done(&pd->capture);
+	safe_free(pd->buf);
 
 	safe_free(d->name);
 	safe_free(d->data);
@@ -275,8 +657,9 @@ static void printer_step4(device_s *d)
 	
 	/* Check if flush is necesary */
 	if (pd->flush) {
-		pd->flush = false;
-		fflush(pd->output_file);
+		pd->ticks++;
+		if (pd->ticks >= pd->interval)
+			printer_flush(pd);
 	}
 }
 
@@ -289,8 +672,15 @@ static void printer_write(cpu_t *cpu, device_s *dev, ptr_t addr, uint32_t val)
 	printer_data_s *pd = (printer_data_s *) dev->data;
 
 	if (addr == pd->addr + REGISTER_CHAR) {
-		fprintf(pd->output_file, "%c", (char) val);
+		pd->buf[pd->pos] = (char) val;
+		pd->pos++;
+		
+		history[history_count % HISTORY_SIZE] = (char) val;
+		history_count++;
 		pd->flush = true;
 		pd->count++;
+		
+		if (pd->pos == pd->size)
+			printer_flush(pd);
 	}
 }
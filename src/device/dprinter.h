@@ -16,4 +16,8 @@
 
 extern device_type_s dprinter;
 
+extern void dprinter_flush(void);
+extern uint64_t dprinter_output_count(void);
+extern bool dprinter_output_match(const char *pattern, uint64_t since);
+
 #endif /* DPRINTER_H_ */
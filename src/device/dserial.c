@@ -0,0 +1,606 @@
+/*
+ * Copyright (c) 2008 Martin Decky
+ * All rights reserved.
+ *
+ * Distributed under the terms of GPL.
+ *
+ *
+ *  Serial console
+ *
+ */
+
+/* Pseudo-terminal functions */
+#define _XOPEN_SOURCE  600
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <fcntl.h>
+
+#ifndef __WIN32__
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#include "dserial.h"
+
+#include "../text.h"
+#include "../arch/chario.h"
+#include "dcpu.h"
+#include "../fault.h"
+#include "../io/output.h"
+#include "../utils.h"
+
+/** \{ \name Register offsets */
+#define REGISTER_DATA          0   /**< Character (read receives, write transmits) */
+#define REGISTER_STATUS        4   /**< Status */
+#define REGISTER_CONTROL       8   /**< Interrupt enable */
+#define REGISTER_RX_COUNT      12  /**< Received characters in the FIFO */
+#define REGISTER_TX_COUNT      16  /**< Characters waiting in the FIFO */
+#define REGISTER_RX_THRESHOLD  20  /**< Receive interrupt threshold */
+#define REGISTER_TX_THRESHOLD  24  /**< Transmit interrupt threshold */
+#define REGISTER_LIMIT         28  /**< Size of register block */
+/* \} */
+
+/** \{ \name Status bits */
+#define STATUS_RX_READY  0x01  /**< Received characters available */
+#define STATUS_TX_FULL   0x02  /**< Transmit FIFO full */
+#define STATUS_TX_EMPTY  0x04  /**< Transmit FIFO empty */
+#define STATUS_INT       0x08  /**< Interrupt pending */
+#define STATUS_OVERRUN   0x10  /**< Character written to a full FIFO */
+/* \} */
+
+/** \{ \name Control bits */
+#define CONTROL_RX_INT  0x01  /**< Receive threshold interrupt */
+#define CONTROL_TX_INT  0x02  /**< Transmit threshold interrupt */
+/* \} */
+
+/*
+ * Device commands
+ */
+
+static bool dserial_init(parm_link_s *parm, device_s *dev);
+static bool dserial_info(parm_link_s *parm, device_s *dev);
+static bool dserial_stat(parm_link_s *parm, device_s *dev);
+static bool dserial_pty(parm_link_s *parm, device_s *dev);
+static bool dserial_socket(parm_link_s *parm, device_s *dev);
+static bool dserial_file(parm_link_s *parm, device_s *dev);
+static bool dserial_route(parm_link_s *parm, device_s *dev);
+
+cmd_s dserial_cmds[] = {
+	{
+		"init",
+		(cmd_f) dserial_init,
+		DEFAULT,
+		DEFAULT,
+		"Initialization",
+		"Initialization",
+		REQ STR "name/device name" NEXT
+		REQ INT "addr/register block address" NEXT
+		REQ INT "intno/interrupt number within 0..6" END
+	},
+	{
+		"help",
+		(cmd_f) dev_generic_help,
+		DEFAULT,
+		DEFAULT,
+		"Display help",
+		"Display help",
+		OPT STR "cmd/command name" END
+	},
+	{
+		"info",
+		(cmd_f) dserial_info,
+		DEFAULT,
+		DEFAULT,
+		"Configuration information",
+		"Configuration information",
+		NOCMD
+	},
+	{
+		"stat",
+		(cmd_f) dserial_stat,
+		DEFAULT,
+		DEFAULT,
+		"Statistics",
+		"Statistics",
+		NOCMD
+	},
+	{
+		"pty",
+		(cmd_f) dserial_pty,
+		DEFAULT,
+		DEFAULT,
+		"Connect the console to a pseudo-terminal",
+		"Create a pseudo-terminal and print the name of its slave side",
+		NOCMD
+	},
+	{
+		"socket",
+		(cmd_f) dserial_socket,
+		DEFAULT,
+		DEFAULT,
+		"Connect the console to a Unix socket",
+		"Connect the console to a listening Unix socket",
+		REQ STR "path/socket path" END
+	},
+	{
+		"file",
+		(cmd_f) dserial_file,
+		DEFAULT,
+		DEFAULT,
+		"Write the console output to a file",
+		"Write the console output to a file, there is no input",
+		REQ STR "fname/file name" END
+	},
+	{
+		"route",
+		(cmd_f) dserial_route,
+		DEFAULT,
+		DEFAULT,
+		"Set the interrupt routing",
+		"Route the interrupt to a processor (cpu no), to processors "
+			"in a mask (mask mask) or round-robin to all processors (rr)",
+		REQ STR "mode/cpu, mask or rr" NEXT
+		OPT VAR "target/processor number, mask or list" END
+	},
+	LAST_CMD
+};
+
+/**< Name of the device as presented to the user */
+const char id_dserial[] = "dserial";
+
+static void dserial_done(device_s *dev);
+static void dserial_step4(device_s *dev);
+static void dserial_read(cpu_t *cpu, device_s *dev, ptr_t addr, uint32_t *val);
+static void dserial_write(cpu_t *cpu, device_s *dev, ptr_t addr, uint32_t val);
+
+/**< Dserial object structure */
+device_type_s dserial = {
+	/* Type name and description */
+	.name = id_dserial,
+	.brief = "Serial console",
+	.full = "Serial console with buffered input and output connected "
+		"to a pseudo-terminal, a Unix socket or a file",
+	
+	/* Functions */
+	.done = dserial_done,
+	.step4 = dserial_step4,
+	.read = dserial_read,
+	.write = dserial_write,
+	
+	/* Commands */
+	dserial_cmds
+};
+
+/** Dserial instance data structure */
+typedef struct {
+	/* Configuration */
+	uint32_t addr;          /**< Register block location */
+	int intno;              /**< Interrupt number */
+	intr_route_t route;     /**< Interrupt routing */
+	
+	/* Host backend */
+	chario_t *cio;          /**< Buffered host stream (or NULL) */
+	char *backend;          /**< Backend description */
+	
+	/* Registers */
+	uint32_t control;       /**< Interrupt enable */
+	uint32_t rx_threshold;  /**< Receive interrupt threshold */
+	uint32_t tx_threshold;  /**< Transmit interrupt threshold */
+	bool overrun;           /**< Overrun since the last status read */
+	bool intr;              /**< Interrupt asserted */
+	
+	/* Statistics */
+	uint64_t intrcount;     /**< Number of interrupts */
+	uint64_t rx_count;      /**< Received characters */
+	uint64_t tx_count;      /**< Transmitted characters */
+	uint64_t overruns;      /**< Discarded characters */
+} serial_data_s;
+
+/** Replace the host backend
+ *
+ * @param sd      Device instance data structure
+ * @param fd      File descriptor of the new backend (or -1)
+ * @param input   The backend provides input
+ * @param backend Backend description
+ *
+ */
+static void dserial_attach(serial_data_s *sd, int fd, bool input,
+    const char *backend)
+{
+	if (sd->cio != NULL)
+		chario_close(sd->cio);
+	
+	safe_free(sd->backend);
+	
+	if (fd == -1) {
+		sd->cio = NULL;
+		return;
+	}
+	
+	sd->cio = chario_open(fd, input);
+	sd->backend = safe_strdup(backend);
+}
+
+/** Update the interrupt line
+ *
+ * The interrupt is asserted while the receive FIFO is filled up to
+ * the threshold or the transmit FIFO is drained down to the threshold.
+ *
+ * @param sd Device instance data structure
+ *
+ */
+static void dserial_update(serial_data_s *sd)
+{
+	bool intr = false;
+	
+	if (sd->cio != NULL) {
+		if ((sd->control & CONTROL_RX_INT) &&
+		    (chario_rx_count(sd->cio) >= sd->rx_threshold))
+			intr = true;
+		
+		if ((sd->control & CONTROL_TX_INT) &&
+		    (chario_tx_count(sd->cio) <= sd->tx_threshold))
+			intr = true;
+	}
+	
+	if (intr == sd->intr)
+		return;
+	
+	sd->intr = intr;
+	
+	if (intr) {
+		sd->intrcount++;
+		dcpu_route_up(&sd->route, sd->intno);
+	} else
+		dcpu_route_down(&sd->route, sd->intno);
+}
+
+/** Init command implementation
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ *
+ * @return true if successful
+ *
+ */
+static bool dserial_init(parm_link_s *parm, device_s *dev)
+{
+	serial_data_s *sd = (serial_data_s *) safe_malloc_t(serial_data_s);
+	memset(sd, 0, sizeof(serial_data_s));
+	dev->data = sd;
+	
+	parm_next(&parm);
+	sd->addr = parm_next_int(&parm);
+	sd->intno = parm_next_int(&parm);
+	dcpu_route_init(&sd->route);
+	
+	sd->cio = NULL;
+	sd->backend = NULL;
+	sd->rx_threshold = 1;
+	
+	if (!addr_word_aligned(sd->addr)) {
+		mprintf("Device address must be 4-byte aligned\n");
+		free(sd);
+		return false;
+	}
+	
+	if ((uint64_t) sd->addr + (uint64_t) REGISTER_LIMIT > 0x100000000ull) {
+		mprintf("Invalid address; registers would exceed the 4 GB limit\n");
+		free(sd);
+		return false;
+	}
+	
+	if ((sd->intno < 0) || (sd->intno > 6)) {
+		mprintf("Interrupt number must be within 0..6\n");
+		free(sd);
+		return false;
+	}
+	
+	return true;
+}
+
+/** Info command implementation
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ *
+ * @return true; always successful
+ *
+ */
+static bool dserial_info(parm_link_s *parm, device_s *dev)
+{
+	serial_data_s *sd = (serial_data_s *) dev->data;
+	
+	mprintf("address:%#010" PRIx32 " intno:%d backend:%s%s control:%#"
+	    PRIx32 " rx threshold:%" PRIu32 " tx threshold:%" PRIu32 " route:",
+	    sd->addr, sd->intno, (sd->backend != NULL) ? sd->backend : "none",
+	    ((sd->cio != NULL) && (chario_hangup(sd->cio))) ? " (hung up)" : "",
+	    sd->control, sd->rx_threshold, sd->tx_threshold);
+	dcpu_route_print(&sd->route);
+	mprintf("\n");
+	
+	return true;
+}
+
+/** Stat command implementation
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ *
+ * @return true; always successful
+ *
+ */
+static bool dserial_stat(parm_link_s *parm, device_s *dev)
+{
+	serial_data_s *sd = (serial_data_s *) dev->data;
+	
+	uint64_t dropped = (sd->cio != NULL) ? chario_dropped(sd->cio) : 0;
+	
+	mprintf("Interrupts           Received             Transmitted          Overruns             Dropped\n");
+	mprintf("-------------------- -------------------- -------------------- -------------------- --------------------\n");
+	mprintf("%20" PRIu64 " %20" PRIu64 " %20" PRIu64 " %20" PRIu64 " %20"
+	    PRIu64 "\n", sd->intrcount, sd->rx_count, sd->tx_count,
+	    sd->overruns, dropped);
+	
+	return true;
+}
+
+/** Pty command implementation
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ *
+ * @return true if successful
+ *
+ */
+static bool dserial_pty(parm_link_s *parm, device_s *dev)
+{
+#ifdef __WIN32__
+	mprintf("Pseudo-terminals are not supported on this platform\n");
+	return false;
+#else
+	serial_data_s *sd = (serial_data_s *) dev->data;
+	
+	int fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (fd == -1) {
+		io_error(NULL);
+		return false;
+	}
+	
+	const char *name = NULL;
+	if ((grantpt(fd) == -1) || (unlockpt(fd) == -1) ||
+	    ((name = ptsname(fd)) == NULL)) {
+		io_error(NULL);
+		close(fd);
+		return false;
+	}
+	
+	mprintf("Serial console %s connected to %s\n", dev->name, name);
+	dserial_attach(sd, fd, true, name);
+	
+	return true;
+#endif
+}
+
+/** Socket command implementation
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ *
+ * @return true if successful
+ *
+ */
+static bool dserial_socket(parm_link_s *parm, device_s *dev)
+{
+#ifdef __WIN32__
+	mprintf("Unix sockets are not supported on this platform\n");
+	return false;
+#else
+	serial_data_s *sd = (serial_data_s *) dev->data;
+	const char *const path = parm_str(parm);
+	struct sockaddr_un sa;
+	
+	if (strlen(path) >= sizeof(sa.sun_path)) {
+		mprintf("Socket path too long\n");
+		return false;
+	}
+	
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	strcpy(sa.sun_path, path);
+	
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1) {
+		io_error(path);
+		return false;
+	}
+	
+	if (connect(fd, (struct sockaddr *) &sa, sizeof(sa)) == -1) {
+		io_error(path);
+		close(fd);
+		return false;
+	}
+	
+	dserial_attach(sd, fd, true, path);
+	return true;
+#endif
+}
+
+/** File command implementation
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ *
+ * @return true if successful
+ *
+ */
+static bool dserial_file(parm_link_s *parm, device_s *dev)
+{
+	serial_data_s *sd = (serial_data_s *) dev->data;
+	const char *const path = parm_str(parm);
+	
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd == -1) {
+		io_error(path);
+		mprintf(txt_file_create_err);
+		return false;
+	}
+	
+	dserial_attach(sd, fd, false, path);
+	return true;
+}
+
+/** Route command implementation
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ *
+ * @return true if successful
+ *
+ */
+static bool dserial_route(parm_link_s *parm, device_s *dev)
+{
+	serial_data_s *sd = (serial_data_s *) dev->data;
+	
+	return dcpu_route_set(&sd->route, parm);
+}
+
+/** Dispose the device
+ *
+ * @param dev Device instance structure
+ *
+ */
+static void dserial_done(device_s *dev)
+{
+	serial_data_s *sd = (serial_data_s *) dev->data;
+	
+	dserial_attach(sd, -1, false, NULL);
+	
+	safe_free(dev->name);
+	safe_free(dev->data);
+}
+
+/** One step4 implementation
+ *
+ * The host I/O is done by the worker thread, so the FIFO
+ * levels only need to be checked for the interrupt here.
+ *
+ * @param dev Device instance structure
+ *
+ */
+static void dserial_step4(device_s *dev)
+{
+	serial_data_s *sd = (serial_data_s *) dev->data;
+	
+	if (sd->control != 0)
+		dserial_update(sd);
+}
+
+/** Read command implementation
+ *
+ * @param cpu  Processor which reads (or NULL)
+ * @param dev  Device instance structure
+ * @param addr Address of the read operation
+ * @param val  Read (returned) value
+ *
+ */
+static void dserial_read(cpu_t *cpu, device_s *dev, ptr_t addr, uint32_t *val)
+{
+	serial_data_s *sd = (serial_data_s *) dev->data;
+	
+	if ((addr < sd->addr) || (addr >= sd->addr + REGISTER_LIMIT))
+		return;
+	
+	char c;
+	
+	switch (addr - sd->addr) {
+	case REGISTER_DATA:
+		*val = 0;
+		if ((sd->cio != NULL) && (chario_getc(sd->cio, &c))) {
+			*val = (unsigned char) c;
+			sd->rx_count++;
+		}
+		dserial_update(sd);
+		break;
+	case REGISTER_STATUS:
+		*val = (sd->intr ? STATUS_INT : 0) |
+		    (sd->overrun ? STATUS_OVERRUN : 0);
+		sd->overrun = false;
+		
+		if (sd->cio == NULL) {
+			*val |= STATUS_TX_EMPTY;
+			break;
+		}
+		
+		if (chario_rx_count(sd->cio) > 0)
+			*val |= STATUS_RX_READY;
+		
+		size_t tx = chario_tx_count(sd->cio);
+		if (tx == 0)
+			*val |= STATUS_TX_EMPTY;
+		else if (tx == CHARIO_RING_SIZE)
+			*val |= STATUS_TX_FULL;
+		break;
+	case REGISTER_CONTROL:
+		*val = sd->control;
+		break;
+	case REGISTER_RX_COUNT:
+		*val = (sd->cio != NULL) ? chario_rx_count(sd->cio) : 0;
+		break;
+	case REGISTER_TX_COUNT:
+		*val = (sd->cio != NULL) ? chario_tx_count(sd->cio) : 0;
+		break;
+	case REGISTER_RX_THRESHOLD:
+		*val = sd->rx_threshold;
+		break;
+	case REGISTER_TX_THRESHOLD:
+		*val = sd->tx_threshold;
+		break;
+	}
+}
+
+/** Write command implementation
+ *
+ * Characters written without a backend are discarded.
+ *
+ * @param cpu  Processor which writes (or NULL)
+ * @param dev  Device instance structure
+ * @param addr Address of the write operation
+ * @param val  Value to write
+ *
+ */
+static void dserial_write(cpu_t *cpu, device_s *dev, ptr_t addr, uint32_t val)
+{
+	serial_data_s *sd = (serial_data_s *) dev->data;
+	
+	if ((addr < sd->addr) || (addr >= sd->addr + REGISTER_LIMIT))
+		return;
+	
+	switch (addr - sd->addr) {
+	case REGISTER_DATA:
+		if ((sd->cio != NULL) && (!chario_putc(sd->cio, (char) val))) {
+			sd->overrun = true;
+			sd->overruns++;
+			break;
+		}
+		sd->tx_count++;
+		break;
+	case REGISTER_CONTROL:
+		sd->control = val & (CONTROL_RX_INT | CONTROL_TX_INT);
+		break;
+	case REGISTER_RX_THRESHOLD:
+		sd->rx_threshold = (val == 0) ? 1 : val;
+		break;
+	case REGISTER_TX_THRESHOLD:
+		sd->tx_threshold = val;
+		break;
+	default:
+		return;
+	}
+	
+	dserial_update(sd);
+}
@@ -0,0 +1,19 @@
+/*
+ * Copyright (c) 2008 Martin Decky
+ * All rights reserved.
+ *
+ * Distributed under the terms of GPL.
+ *
+ *
+ *  Serial console
+ *
+ */
+
+#ifndef DSERIAL_H_
+#define DSERIAL_H_
+
+#include "device.h"
+
+extern device_type_s dserial;
+
+#endif /* DSERIAL_H_ */
@@ -0,0 +1,585 @@
+/*
+ * Copyright (c) 2008 Martin Decky
+ * All rights reserved.
+ *
+ * Distributed under the terms of GPL.
+ *
+ *
+ *  Shared memory device
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#ifndef __WIN32__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#include "dshm.h"
+
+#include "../text.h"
+#include "../arch/mmap.h"
+#include "machine.h"
+#include "dcpu.h"
+#include "../fault.h"
+#include "../io/output.h"
+#include "../utils.h"
+
+/** \{ \name Register offsets */
+#define REGISTER_DOORBELL  0   /**< Ring the peer (write) */
+#define REGISTER_VALUE     4   /**< Last value received from the peer */
+#define REGISTER_COUNT     8   /**< Doorbells received since the last ack */
+#define REGISTER_ACK       12  /**< Interrupt acknowledge (write) */
+#define REGISTER_SIZE      16  /**< Shared memory size */
+#define REGISTER_LIMIT     20  /**< Size of register block */
+/* \} */
+
+/*
+ * Device commands
+ */
+
+static bool dshm_init(parm_link_s *parm, device_s *dev);
+static bool dshm_info(parm_link_s *parm, device_s *dev);
+static bool dshm_stat(parm_link_s *parm, device_s *dev);
+static bool dshm_map(parm_link_s *parm, device_s *dev);
+static bool dshm_doorbell(parm_link_s *parm, device_s *dev);
+static bool dshm_route(parm_link_s *parm, device_s *dev);
+
+cmd_s dshm_cmds[] = {
+	{
+		"init",
+		(cmd_f) dshm_init,
+		DEFAULT,
+		DEFAULT,
+		"Initialization",
+		"Initialization",
+		REQ STR "name/device name" NEXT
+		REQ INT "addr/register block address" NEXT
+		REQ INT "intno/interrupt number within 0..6" END
+	},
+	{
+		"help",
+		(cmd_f) dev_generic_help,
+		DEFAULT,
+		DEFAULT,
+		"Display help",
+		"Display help",
+		OPT STR "cmd/command name" END
+	},
+	{
+		"info",
+		(cmd_f) dshm_info,
+		DEFAULT,
+		DEFAULT,
+		"Configuration information",
+		"Configuration information",
+		NOCMD
+	},
+	{
+		"stat",
+		(cmd_f) dshm_stat,
+		DEFAULT,
+		DEFAULT,
+		"Statistics",
+		"Statistics",
+		NOCMD
+	},
+	{
+		"map",
+		(cmd_f) dshm_map,
+		DEFAULT,
+		DEFAULT,
+		"Map a shared memory object",
+		"Map a POSIX shared memory object (created if it does not exist) "
+			"to the physical address specified",
+		REQ STR "shm/shared memory object name" NEXT
+		REQ INT "addr/physical address" NEXT
+		REQ INT "size/size in bytes" END
+	},
+	{
+		"doorbell",
+		(cmd_f) dshm_doorbell,
+		DEFAULT,
+		DEFAULT,
+		"Connect the doorbell to the peer",
+		"Bind a Unix datagram socket to the local path and ring "
+			"the peer bound to the remote path",
+		REQ STR "local/local socket path" NEXT
+		REQ STR "remote/remote socket path" END
+	},
+	{
+		"route",
+		(cmd_f) dshm_route,
+		DEFAULT,
+		DEFAULT,
+		"Set the interrupt routing",
+		"Route the interrupt to a processor (cpu no), to processors "
+			"in a mask (mask mask) or round-robin to all processors (rr)",
+		REQ STR "mode/cpu, mask or rr" NEXT
+		OPT VAR "target/processor number, mask or list" END
+	},
+	LAST_CMD
+};
+
+/**< Name of the device as presented to the user */
+const char id_dshm[] = "dshm";
+
+static void dshm_done(device_s *dev);
+static void dshm_step4(device_s *dev);
+static void dshm_read(cpu_t *cpu, device_s *dev, ptr_t addr, uint32_t *val);
+static void dshm_write(cpu_t *cpu, device_s *dev, ptr_t addr, uint32_t val);
+
+/**< Dshm object structure */
+device_type_s dshm = {
+	/* Type name and description */
+	.name = id_dshm,
+	.brief = "Shared memory",
+	.full = "Host shared memory mapped to the physical memory "
+		"with a doorbell interrupting a peer simulator",
+	
+	/* Functions */
+	.done = dshm_done,
+	.step4 = dshm_step4,
+	.read = dshm_read,
+	.write = dshm_write,
+	
+	/* Commands */
+	dshm_cmds
+};
+
+/** Dshm instance data structure */
+typedef struct {
+	/* Configuration */
+	uint32_t addr;               /**< Register block location */
+	int intno;                   /**< Interrupt number */
+	intr_route_t route;          /**< Interrupt routing */
+	
+	/* Shared memory */
+	mem_area_t *area;            /**< Mapped memory area (or NULL) */
+	char *shm;                   /**< Shared memory object name */
+	
+	/* Doorbell */
+	int fd;                      /**< Socket */
+	char *local;                 /**< Local socket path */
+#ifndef __WIN32__
+	struct sockaddr_un remote;   /**< Remote socket address */
+#endif
+	uint32_t value;              /**< Last received value */
+	uint32_t count;              /**< Doorbells since the last ack */
+	
+	/* Statistics */
+	uint64_t intrcount;          /**< Number of interrupts */
+	uint64_t sent;               /**< Doorbells sent */
+	uint64_t received;           /**< Doorbells received */
+	uint64_t failed;             /**< Doorbells which could not be sent */
+} shm_data_s;
+
+/** Unmap the shared memory
+ *
+ * @param sd Device instance data structure
+ *
+ */
+static void dshm_unmap(shm_data_s *sd)
+{
+	if (sd->area == NULL)
+		return;
+	
+	list_remove(&mem_areas, &sd->area->item);
+	
+	if (munmap(sd->area->data, sd->area->size) == -1) {
+		io_error(NULL);
+		error(txt_file_unmap_fail);
+	}
+	
+	mem_dirty_done(sd->area);
+	safe_free(sd->area);
+	safe_free(sd->shm);
+}
+
+/** Close the doorbell socket
+ *
+ * @param sd Device instance data structure
+ *
+ */
+static void dshm_disconnect(shm_data_s *sd)
+{
+#ifndef __WIN32__
+	if (sd->fd != -1) {
+		close(sd->fd);
+		unlink(sd->local);
+		sd->fd = -1;
+	}
+#endif
+	
+	safe_free(sd->local);
+}
+
+/** Init command implementation
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ *
+ * @return true if successful
+ *
+ */
+static bool dshm_init(parm_link_s *parm, device_s *dev)
+{
+	shm_data_s *sd = (shm_data_s *) safe_malloc_t(shm_data_s);
+	memset(sd, 0, sizeof(shm_data_s));
+	dev->data = sd;
+	
+	parm_next(&parm);
+	sd->addr = parm_next_int(&parm);
+	sd->intno = parm_next_int(&parm);
+	dcpu_route_init(&sd->route);
+	
+	sd->area = NULL;
+	sd->shm = NULL;
+	sd->fd = -1;
+	sd->local = NULL;
+	
+	if (!addr_word_aligned(sd->addr)) {
+		mprintf("Device address must be 4-byte aligned\n");
+		free(sd);
+		return false;
+	}
+	
+	if ((uint64_t) sd->addr + (uint64_t) REGISTER_LIMIT > 0x100000000ull) {
+		mprintf("Invalid address; registers would exceed the 4 GB limit\n");
+		free(sd);
+		return false;
+	}
+	
+	if ((sd->intno < 0) || (sd->intno > 6)) {
+		mprintf("Interrupt number must be within 0..6\n");
+		free(sd);
+		return false;
+	}
+	
+	return true;
+}
+
+/** Info command implementation
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ *
+ * @return true; always successful
+ *
+ */
+static bool dshm_info(parm_link_s *parm, device_s *dev)
+{
+	shm_data_s *sd = (shm_data_s *) dev->data;
+	
+	mprintf("address:%#010" PRIx32 " intno:%d", sd->addr, sd->intno);
+	
+	if (sd->area != NULL)
+		mprintf(" shm:%s start:%#010" PRIx32 " size:%" PRIu32, sd->shm,
+		    sd->area->start, sd->area->size);
+
+#ifndef __WIN32__
+	if (sd->fd != -1)
+		mprintf(" doorbell:%s peer:%s", sd->local, sd->remote.sun_path);
+#endif
+	
+	mprintf(" route:");
+	dcpu_route_print(&sd->route);
+	mprintf("\n");
+	
+	return true;
+}
+
+/** Stat command implementation
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ *
+ * @return true; always successful
+ *
+ */
+static bool dshm_stat(parm_link_s *parm, device_s *dev)
+{
+	shm_data_s *sd = (shm_data_s *) dev->data;
+	
+	mprintf("Interrupts           Sent                 Received             Failed\n");
+	mprintf("-------------------- -------------------- -------------------- --------------------\n");
+	mprintf("%20" PRIu64 " %20" PRIu64 " %20" PRIu64 " %20" PRIu64 "\n",
+	    sd->intrcount, sd->sent, sd->received, sd->failed);
+	
+	return true;
+}
+
+/** Map command implementation
+ *
+ * The shared memory object is extended to the size specified
+ * if it is smaller. The mapping becomes a file-mapped memory
+ * area like the fmap command of the memory devices creates.
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ *
+ * @return true if successful
+ *
+ */
+static bool dshm_map(parm_link_s *parm, device_s *dev)
+{
+#ifdef __WIN32__
+	mprintf("Shared memory is not supported on this platform\n");
+	return false;
+#else
+	shm_data_s *sd = (shm_data_s *) dev->data;
+	const char *const name = parm_str(parm);
+	parm_next(&parm);
+	uint32_t start = parm_next_int(&parm);
+	uint32_t size = parm_int(parm);
+	
+	if (sd->area != NULL) {
+		mprintf("Shared memory already mapped\n");
+		return false;
+	}
+	
+	if ((!addr_word_aligned(start)) || (!addr_word_aligned(size))) {
+		mprintf("Memory address and size must be 4-byte aligned\n");
+		return false;
+	}
+	
+	if (size == 0) {
+		mprintf("Memory size is illegal\n");
+		return false;
+	}
+	
+	if ((uint64_t) start + (uint64_t) size > 0x100000000ull) {
+		mprintf("Memory would exceed the 4 GB limit\n");
+		return false;
+	}
+	
+	/* Portable names start with a slash */
+	char *shm;
+	if (name[0] == '/')
+		shm = safe_strdup(name);
+	else {
+		shm = (char *) safe_malloc(strlen(name) + 2);
+		shm[0] = '/';
+		strcpy(shm + 1, name);
+	}
+	
+	int fd = shm_open(shm, O_RDWR | O_CREAT, 0600);
+	if (fd == -1) {
+		io_error(shm);
+		safe_free(shm);
+		return false;
+	}
+	
+	struct stat st;
+	if ((fstat(fd, &st) == -1) ||
+	    ((st.st_size < (off_t) size) && (ftruncate(fd, size) == -1))) {
+		io_error(shm);
+		close(fd);
+		safe_free(shm);
+		return false;
+	}
+	
+	void *ptr = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	
+	if (ptr == MAP_FAILED) {
+		io_error(shm);
+		mprintf("%s\n", txt_file_map_fail);
+		safe_free(shm);
+		return false;
+	}
+	
+	mem_area_t *area = safe_malloc_t(mem_area_t);
+	item_init(&area->item);
+	
+	area->type = MEMT_FMAP;
+	area->writable = true;
+	area->huge = MEMH_NONE;
+	area->start = start;
+	area->size = size;
+	area->data = (unsigned char *) ptr;
+	area->save_path = NULL;
+	mem_dirty_init(area);
+	
+	list_append(&mem_areas, &area->item);
+	sd->area = area;
+	sd->shm = shm;
+	
+	return true;
+#endif
+}
+
+/** Doorbell command implementation
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ *
+ * @return true if successful
+ *
+ */
+static bool dshm_doorbell(parm_link_s *parm, device_s *dev)
+{
+#ifdef __WIN32__
+	mprintf("Unix sockets are not supported on this platform\n");
+	return false;
+#else
+	shm_data_s *sd = (shm_data_s *) dev->data;
+	const char *const local = parm_str(parm);
+	parm_next(&parm);
+	const char *const remote = parm_str(parm);
+	struct sockaddr_un sa;
+	
+	if ((strlen(local) >= sizeof(sa.sun_path)) ||
+	    (strlen(remote) >= sizeof(sa.sun_path))) {
+		mprintf("Socket path too long\n");
+		return false;
+	}
+	
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	strcpy(sa.sun_path, local);
+	
+	int fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+	if (fd == -1) {
+		io_error(local);
+		return false;
+	}
+	
+	unlink(local);
+	if ((bind(fd, (struct sockaddr *) &sa, sizeof(sa)) == -1) ||
+	    (fcntl(fd, F_SETFL, O_NONBLOCK) == -1)) {
+		io_error(local);
+		close(fd);
+		return false;
+	}
+	
+	dshm_disconnect(sd);
+	
+	sd->fd = fd;
+	sd->local = safe_strdup(local);
+	
+	memset(&sd->remote, 0, sizeof(sd->remote));
+	sd->remote.sun_family = AF_UNIX;
+	strcpy(sd->remote.sun_path, remote);
+	
+	return true;
+#endif
+}
+
+/** Route command implementation
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ *
+ * @return true if successful
+ *
+ */
+static bool dshm_route(parm_link_s *parm, device_s *dev)
+{
+	shm_data_s *sd = (shm_data_s *) dev->data;
+	
+	return dcpu_route_set(&sd->route, parm);
+}
+
+/** Dispose the device
+ *
+ * The shared memory object is kept for the peers.
+ *
+ * @param dev Device instance structure
+ *
+ */
+static void dshm_done(device_s *dev)
+{
+	shm_data_s *sd = (shm_data_s *) dev->data;
+	
+	dshm_unmap(sd);
+	dshm_disconnect(sd);
+	
+	safe_free(dev->name);
+	safe_free(dev->data);
+}
+
+/** One step4 implementation
+ *
+ * The doorbell socket is polled only here to keep
+ * the system calls out of the fast path.
+ *
+ * @param dev Device instance structure
+ *
+ */
+static void dshm_step4(device_s *dev)
+{
+#ifndef __WIN32__
+	shm_data_s *sd = (shm_data_s *) dev->data;
+	
+	if (sd->fd == -1)
+		return;
+	
+	uint32_t value;
+	while (recv(sd->fd, &value, sizeof(value), 0) == sizeof(value)) {
+		sd->value = value;
+		sd->received++;
+		
+		if (sd->count++ == 0) {
+			sd->intrcount++;
+			dcpu_route_up(&sd->route, sd->intno);
+		}
+	}
+#endif
+}
+
+/** Read command implementation
+ *
+ * @param cpu  Processor which reads (or NULL)
+ * @param dev  Device instance structure
+ * @param addr Address of the read operation
+ * @param val  Read (returned) value
+ *
+ */
+static void dshm_read(cpu_t *cpu, device_s *dev, ptr_t addr, uint32_t *val)
+{
+	shm_data_s *sd = (shm_data_s *) dev->data;
+	
+	if (addr == sd->addr + REGISTER_VALUE)
+		*val = sd->value;
+	else if (addr == sd->addr + REGISTER_COUNT)
+		*val = sd->count;
+	else if (addr == sd->addr + REGISTER_SIZE)
+		*val = (sd->area != NULL) ? sd->area->size : 0;
+}
+
+/** Write command implementation
+ *
+ * @param cpu  Processor which writes (or NULL)
+ * @param dev  Device instance structure
+ * @param addr Address of the write operation
+ * @param val  Value to write
+ *
+ */
+static void dshm_write(cpu_t *cpu, device_s *dev, ptr_t addr, uint32_t val)
+{
+	shm_data_s *sd = (shm_data_s *) dev->data;
+	
+	if (addr == sd->addr + REGISTER_DOORBELL) {
+#ifndef __WIN32__
+		if ((sd->fd != -1) && (sendto(sd->fd, &val, sizeof(val), 0,
+		    (struct sockaddr *) &sd->remote, sizeof(sd->remote)) ==
+		    sizeof(val)))
+			sd->sent++;
+		else
+#endif
+			sd->failed++;
+	} else if (addr == sd->addr + REGISTER_ACK) {
+		if (sd->count != 0) {
+			sd->count = 0;
+			dcpu_route_down(&sd->route, sd->intno);
+		}
+	}
+}
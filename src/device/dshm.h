@@ -0,0 +1,19 @@
+/*
+ * Copyright (c) 2008 Martin Decky
+ * All rights reserved.
+ *
+ * Distributed under the terms of GPL.
+ *
+ *
+ *  Shared memory device
+ *
+ */
+
+#ifndef DSHM_H_
+#define DSHM_H_
+
+#include "device.h"
+
+extern device_type_s dshm;
+
+#endif /* DSHM_H_ */
@@ -19,6 +19,7 @@
 #include "dtime.h"
 
 #include "device.h"
+#include "machine.h"
 #include "../io/output.h"
 #include "../utils.h"
 
@@ -36,6 +37,8 @@
 static bool dtime_init(parm_link_s *parm, device_s *dev);
 static bool dtime_info(parm_link_s *parm, device_s *dev);
 static bool dtime_stat(parm_link_s *parm, device_s *dev);
+static bool dtime_virtual(parm_link_s *parm, device_s *dev);
+static bool dtime_real(parm_link_s *parm, device_s *dev);
 
 cmd_s dtime_cmds[] = {
 	{
@@ -75,6 +78,26 @@ cmd_s dtime_cmds[] = {
 		"display device statictics",
 		NOCMD
 	},
+	{
+		"virtual",
+		(cmd_f) dtime_virtual,
+		DEFAULT,
+		DEFAULT,
+		"Derive the time from the machine cycles",
+		"Derive the time from the machine cycles at the given frequency "
+			"(Hz), starting at the given epoch (seconds)",
+		REQ INT "freq/cycles per second" NEXT
+		OPT INT "epoch/time at cycle 0" END
+	},
+	{
+		"real",
+		(cmd_f) dtime_real,
+		DEFAULT,
+		DEFAULT,
+		"Report the host real time",
+		"Report the host real time",
+		NOCMD
+	},
 	LAST_CMD
 };
 
@@ -106,6 +129,9 @@ device_type_s dtime = {
 /** Dtime instance data structure */
 typedef struct {
 	uint32_t addr;	/**< Dtime memory location */
+	bool virt;	/**< Virtual time derived from the cycles */
+	uint32_t freq;	/**< Virtual time frequency (Hz) */
+	uint32_t epoch;	/**< Virtual time at cycle 0 (seconds) */
 } dtime_data_s;
 
 /** Init command implementation
@@ -124,6 +150,9 @@ static bool dtime_init(parm_link_s *parm, device_s *dev)
 	/* Inicialization */
 	parm_next(&parm);
 	td->addr = parm_next_int(&parm);
+	td->virt = false;
+	td->freq = 0;
+	td->epoch = 0;
 	
 	/* Checks */
 
@@ -160,6 +189,51 @@ static bool dtime_info(parm_link_s *parm, device_s *dev)
 	mprintf("----------\n");
 	mprintf("%#10" PRIx64 "\n", td->addr);
 	
+	if (td->virt)
+		mprintf("Virtual time: %" PRIu32 " Hz, epoch %" PRIu32 "\n",
+		    td->freq, td->epoch);
+	
+	return true;
+}
+
+
+/** Virtual command implementation
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ * @return true if successful
+ *
+ */
+static bool dtime_virtual(parm_link_s *parm, device_s *dev)
+{
+	dtime_data_s *td = (dtime_data_s *) dev->data;
+	uint32_t freq = parm_next_int(&parm);
+	
+	if (freq == 0) {
+		mprintf("Frequency must be non-zero\n");
+		return false;
+	}
+	
+	td->virt = true;
+	td->freq = freq;
+	td->epoch = (parm_type(parm) == tt_int) ? parm_int(parm) : 0;
+	
+	return true;
+}
+
+
+/** Real command implementation
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ * @return true; always successful
+ *
+ */
+static bool dtime_real(parm_link_s *parm, device_s *dev)
+{
+	dtime_data_s *td = (dtime_data_s *) dev->data;
+	
+	td->virt = false;
 	return true;
 }
 
@@ -192,7 +266,8 @@ static void dtime_done(device_s *d)
 
 /** Read command implementation
  *
- * Read host time via gettimeofday().
+ * Read host time via gettimeofday() or compute the virtual time
+ * from the machine cycles.
  *
  * @param d    Ddisk device pointer
  * @param addr Address of the read operation
@@ -204,6 +279,18 @@ static void dtime_read(cpu_t *cpu, device_s *dev, ptr_t addr, uint32_t *val)
 	dtime_data_s *od = (dtime_data_s *) dev->data;
 	
 	if ((addr == od->addr + REGISTER_SEC) || (addr == od->addr + REGISTER_USEC)) {
+		if (od->virt) {
+			uint64_t sec = msteps / od->freq;
+			
+			if (addr == od->addr)
+				*val = (uint32_t) (od->epoch + sec);
+			else
+				*val = (uint32_t) ((msteps - sec * od->freq) * 1000000 /
+				    od->freq);
+			
+			return;
+		}
+		
 		/* Get actual time */
 		struct timeval t;
 		gettimeofday( &t, NULL);
@@ -0,0 +1,446 @@
+/*
+ * Copyright (c) 2008 Martin Decky
+ * All rights reserved.
+ *
+ * Distributed under the terms of GPL.
+ *
+ *
+ *  Programmable interval timer
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "dtimer.h"
+
+#include "machine.h"
+#include "dcpu.h"
+#include "../fault.h"
+#include "../io/output.h"
+#include "../utils.h"
+
+/** Number of timer channels */
+#define TIMER_CHANNELS  4
+
+/** \{ \name Register offsets within a channel */
+#define REGISTER_PERIOD   0   /**< Period in cycles */
+#define REGISTER_CONTROL  4   /**< Control */
+#define REGISTER_STATUS   8   /**< Status (read), acknowledge (write) */
+#define REGISTER_COUNTER  12  /**< Cycles to the expiration */
+#define REGISTER_CHANNEL  16  /**< Size of channel registers */
+#define REGISTER_LIMIT    (TIMER_CHANNELS * REGISTER_CHANNEL)
+/* \} */
+
+/** \{ \name Control flags */
+#define CONTROL_ENABLE    0x01  /**< Timer running */
+#define CONTROL_PERIODIC  0x02  /**< Reload after the expiration */
+#define CONTROL_INT       0x04  /**< Interrupt on the expiration */
+#define CONTROL_MASK      0x07
+/* \} */
+
+/** \{ \name Status flags */
+#define STATUS_EXPIRED  0x01  /**< Timer expired since the acknowledge */
+#define STATUS_INT      0x02  /**< Interrupt pending */
+/* \} */
+
+/*
+ * Device commands
+ */
+
+static bool dtimer_init(parm_link_s *parm, device_s *dev);
+static bool dtimer_info(parm_link_s *parm, device_s *dev);
+static bool dtimer_stat(parm_link_s *parm, device_s *dev);
+static bool dtimer_route(parm_link_s *parm, device_s *dev);
+
+cmd_s dtimer_cmds[] = {
+	{
+		"init",
+		(cmd_f) dtimer_init,
+		DEFAULT,
+		DEFAULT,
+		"Initialization",
+		"Initialization",
+		REQ STR "name/device name" NEXT
+		REQ INT "addr/register block address" NEXT
+		REQ INT "intno/interrupt number within 0..6" END
+	},
+	{
+		"help",
+		(cmd_f) dev_generic_help,
+		DEFAULT,
+		DEFAULT,
+		"Display help",
+		"Display help",
+		OPT STR "cmd/command name" END
+	},
+	{
+		"info",
+		(cmd_f) dtimer_info,
+		DEFAULT,
+		DEFAULT,
+		"Configuration information",
+		"Configuration information",
+		NOCMD
+	},
+	{
+		"stat",
+		(cmd_f) dtimer_stat,
+		DEFAULT,
+		DEFAULT,
+		"Statistics",
+		"Statistics",
+		NOCMD
+	},
+	{
+		"route",
+		(cmd_f) dtimer_route,
+		DEFAULT,
+		DEFAULT,
+		"Set the interrupt routing of a channel",
+		"Route the interrupt of the channel to a processor (cpu no), "
+			"to processors in a mask (mask mask) or round-robin "
+			"to all processors (rr)",
+		REQ INT "channel/timer channel" NEXT
+		REQ STR "mode/cpu, mask or rr" NEXT
+		OPT VAR "target/processor number, mask or list" END
+	},
+	LAST_CMD
+};
+
+/**< Name of the device as presented to the user */
+const char id_dtimer[] = "dtimer";
+
+static void dtimer_done(device_s *dev);
+static void dtimer_read(cpu_t *cpu, device_s *dev, ptr_t addr, uint32_t *val);
+static void dtimer_write(cpu_t *cpu, device_s *dev, ptr_t addr, uint32_t val);
+
+/**< Dtimer object structure */
+device_type_s dtimer = {
+	/* Type name and description */
+	.name = id_dtimer,
+	.brief = "Interval timer",
+	.full = "Programmable interval timer with one-shot and periodic channels",
+	
+	/* Functions */
+	.done = dtimer_done,
+	.read = dtimer_read,
+	.write = dtimer_write,
+	
+	/* Commands */
+	dtimer_cmds
+};
+
+struct timer_data;
+
+/** Timer channel structure */
+typedef struct {
+	struct timer_data *td;  /**< Device instance data */
+	event_t event;          /**< Expiration event */
+	intr_route_t route;     /**< Interrupt routing */
+	
+	/* Registers */
+	uint32_t period;        /**< Period in cycles */
+	uint32_t control;       /**< Control */
+	bool expired;           /**< Expired since the acknowledge */
+	
+	/* Statistics */
+	uint64_t expirations;   /**< Number of expirations */
+	uint64_t intrcount;     /**< Number of interrupts */
+} timer_channel_s;
+
+/** Dtimer instance data structure */
+typedef struct timer_data {
+	/* Configuration */
+	uint32_t addr;          /**< Register block location */
+	int intno;              /**< Interrupt number */
+	
+	/* Channels */
+	timer_channel_s channels[TIMER_CHANNELS];
+} timer_data_s;
+
+/** Expiration event handler
+ *
+ * A periodic channel is rescheduled relative to the expiration
+ * cycle, so the period does not drift.
+ *
+ * @param data Timer channel
+ *
+ */
+static void dtimer_expire(void *data)
+{
+	timer_channel_s *ch = (timer_channel_s *) data;
+	
+	ch->expirations++;
+	
+	if (ch->control & CONTROL_PERIODIC)
+		event_schedule(&ch->event, ch->event.cycle + ch->period);
+	else
+		ch->control &= ~CONTROL_ENABLE;
+	
+	ch->expired = true;
+	
+	if ((ch->control & CONTROL_INT) && (!ch->route.pending)) {
+		ch->intrcount++;
+		dcpu_route_up(&ch->route, ch->td->intno);
+	}
+}
+
+/** Start or stop a channel according to its registers
+ *
+ * @param ch Timer channel
+ *
+ */
+static void dtimer_arm(timer_channel_s *ch)
+{
+	if ((ch->control & CONTROL_ENABLE) && (ch->period != 0))
+		event_schedule(&ch->event, msteps + ch->period);
+	else
+		event_cancel(&ch->event);
+}
+
+/** Acknowledge the expiration of a channel
+ *
+ * The channels share the interrupt number, thus the interrupts
+ * still pending on other channels are asserted again.
+ *
+ * @param td Device instance data structure
+ * @param ch Timer channel
+ *
+ */
+static void dtimer_ack(timer_data_s *td, timer_channel_s *ch)
+{
+	ch->expired = false;
+	
+	if (!ch->route.pending)
+		return;
+	
+	dcpu_route_down(&ch->route, td->intno);
+	
+	unsigned int i;
+	for (i = 0; i < TIMER_CHANNELS; i++) {
+		if (td->channels[i].route.pending)
+			dcpu_route_up(&td->channels[i].route, td->intno);
+	}
+}
+
+/** Init command implementation
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ *
+ * @return true if successful
+ *
+ */
+static bool dtimer_init(parm_link_s *parm, device_s *dev)
+{
+	timer_data_s *td = (timer_data_s *) safe_malloc_t(timer_data_s);
+	memset(td, 0, sizeof(timer_data_s));
+	dev->data = td;
+	
+	parm_next(&parm);
+	td->addr = parm_next_int(&parm);
+	td->intno = parm_next_int(&parm);
+	
+	if (!addr_word_aligned(td->addr)) {
+		mprintf("Device address must be 4-byte aligned\n");
+		free(td);
+		return false;
+	}
+	
+	if ((uint64_t) td->addr + (uint64_t) REGISTER_LIMIT > 0x100000000ull) {
+		mprintf("Invalid address; registers would exceed the 4 GB limit\n");
+		free(td);
+		return false;
+	}
+	
+	if ((td->intno < 0) || (td->intno > 6)) {
+		mprintf("Interrupt number must be within 0..6\n");
+		free(td);
+		return false;
+	}
+	
+	unsigned int i;
+	for (i = 0; i < TIMER_CHANNELS; i++) {
+		timer_channel_s *ch = &td->channels[i];
+		
+		ch->td = td;
+		event_init(&ch->event, dtimer_expire, ch);
+		dcpu_route_init(&ch->route);
+	}
+	
+	return true;
+}
+
+/** Info command implementation
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ *
+ * @return true; always successful
+ *
+ */
+static bool dtimer_info(parm_link_s *parm, device_s *dev)
+{
+	timer_data_s *td = (timer_data_s *) dev->data;
+	
+	mprintf("address:%#010" PRIx32 " intno:%d channels:%u\n",
+	    td->addr, td->intno, TIMER_CHANNELS);
+	
+	unsigned int i;
+	for (i = 0; i < TIMER_CHANNELS; i++) {
+		timer_channel_s *ch = &td->channels[i];
+		
+		mprintf("channel:%u period:%" PRIu32 " mode:%s%s%s route:", i,
+		    ch->period,
+		    (ch->control & CONTROL_ENABLE) ? "running" : "stopped",
+		    (ch->control & CONTROL_PERIODIC) ? ",periodic" : ",one-shot",
+		    (ch->control & CONTROL_INT) ? ",int" : "");
+		dcpu_route_print(&ch->route);
+		mprintf("\n");
+	}
+	
+	return true;
+}
+
+/** Stat command implementation
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ *
+ * @return true; always successful
+ *
+ */
+static bool dtimer_stat(parm_link_s *parm, device_s *dev)
+{
+	timer_data_s *td = (timer_data_s *) dev->data;
+	
+	mprintf("Channel Expirations          Interrupts\n");
+	mprintf("------- -------------------- --------------------\n");
+	
+	unsigned int i;
+	for (i = 0; i < TIMER_CHANNELS; i++)
+		mprintf("%7u %20" PRIu64 " %20" PRIu64 "\n", i,
+		    td->channels[i].expirations, td->channels[i].intrcount);
+	
+	return true;
+}
+
+/** Route command implementation
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ *
+ * @return true if successful
+ *
+ */
+static bool dtimer_route(parm_link_s *parm, device_s *dev)
+{
+	timer_data_s *td = (timer_data_s *) dev->data;
+	uint32_t no = parm_next_int(&parm);
+	
+	if (no >= TIMER_CHANNELS) {
+		mprintf("Channel number must be within 0..%u\n",
+		    TIMER_CHANNELS - 1);
+		return false;
+	}
+	
+	return dcpu_route_set(&td->channels[no].route, parm);
+}
+
+/** Dispose the device
+ *
+ * @param dev Device instance structure
+ *
+ */
+static void dtimer_done(device_s *dev)
+{
+	timer_data_s *td = (timer_data_s *) dev->data;
+	
+	unsigned int i;
+	for (i = 0; i < TIMER_CHANNELS; i++)
+		event_cancel(&td->channels[i].event);
+	
+	safe_free(dev->name);
+	safe_free(dev->data);
+}
+
+/** Read command implementation
+ *
+ * The counter is computed from the expiration cycle,
+ * the timer is not stepped.
+ *
+ * @param cpu  Processor which reads (or NULL)
+ * @param dev  Device instance structure
+ * @param addr Address of the read operation
+ * @param val  Read (returned) value
+ *
+ */
+static void dtimer_read(cpu_t *cpu, device_s *dev, ptr_t addr, uint32_t *val)
+{
+	timer_data_s *td = (timer_data_s *) dev->data;
+	
+	if ((addr < td->addr) || (addr >= td->addr + REGISTER_LIMIT))
+		return;
+	
+	timer_channel_s *ch = &td->channels[(addr - td->addr) / REGISTER_CHANNEL];
+	
+	switch ((addr - td->addr) % REGISTER_CHANNEL) {
+	case REGISTER_PERIOD:
+		*val = ch->period;
+		break;
+	case REGISTER_CONTROL:
+		*val = ch->control;
+		break;
+	case REGISTER_STATUS:
+		*val = (ch->expired ? STATUS_EXPIRED : 0) |
+		    (ch->route.pending ? STATUS_INT : 0);
+		break;
+	case REGISTER_COUNTER:
+		*val = event_scheduled(&ch->event) ?
+		    (uint32_t) (ch->event.cycle - msteps) : 0;
+		break;
+	}
+}
+
+/** Write command implementation
+ *
+ * Writing the period of a running channel restarts it.
+ *
+ * @param cpu  Processor which writes (or NULL)
+ * @param dev  Device instance structure
+ * @param addr Address of the write operation
+ * @param val  Value to write
+ *
+ */
+static void dtimer_write(cpu_t *cpu, device_s *dev, ptr_t addr, uint32_t val)
+{
+	timer_data_s *td = (timer_data_s *) dev->data;
+	
+	if ((addr < td->addr) || (addr >= td->addr + REGISTER_LIMIT))
+		return;
+	
+	timer_channel_s *ch = &td->channels[(addr - td->addr) / REGISTER_CHANNEL];
+	
+	switch ((addr - td->addr) % REGISTER_CHANNEL) {
+	case REGISTER_PERIOD:
+		ch->period = val;
+		dtimer_arm(ch);
+		break;
+	case REGISTER_CONTROL:
+		val &= CONTROL_MASK;
+		
+		/* Start a stopped channel, stop a running one */
+		if ((val ^ ch->control) & CONTROL_ENABLE) {
+			ch->control = val;
+			dtimer_arm(ch);
+		} else
+			ch->control = val;
+		break;
+	case REGISTER_STATUS:
+		dtimer_ack(td, ch);
+		break;
+	}
+}
@@ -0,0 +1,19 @@
+/*
+ * Copyright (c) 2008 Martin Decky
+ * All rights reserved.
+ *
+ * Distributed under the terms of GPL.
+ *
+ *
+ *  Programmable interval timer
+ *
+ */
+
+#ifndef DTIMER_H_
+#define DTIMER_H_
+
+#include "device.h"
+
+extern device_type_s dtimer;
+
+#endif /* DTIMER_H_ */
@@ -0,0 +1,740 @@
+/*
+ * Copyright (c) 2008 Martin Decky
+ * All rights reserved.
+ *
+ * Distributed under the terms of GPL.
+ *
+ *
+ *  Paravirtual block device
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "dvblk.h"
+
+#include "../text.h"
+#include "../arch/mmap.h"
+#include "machine.h"
+#include "dcpu.h"
+#include "../fault.h"
+#include "../io/output.h"
+#include "../utils.h"
+
+/** \{ \name Register offsets */
+#define REGISTER_CAPACITY    0   /**< Disk size in sectors */
+#define REGISTER_QUEUE_SIZE  4   /**< Number of ring entries */
+#define REGISTER_DESC_ADDR   8   /**< Descriptor table address */
+#define REGISTER_AVAIL_ADDR  12  /**< Available ring address */
+#define REGISTER_USED_ADDR   16  /**< Used ring address */
+#define REGISTER_NOTIFY      20  /**< Doorbell */
+#define REGISTER_ISR         24  /**< Interrupt status (read acknowledges) */
+#define REGISTER_LIMIT       28  /**< Size of register block */
+/* \} */
+
+/** \{ \name Descriptor words */
+#define DESC_TYPE    0  /**< Request type */
+#define DESC_SECTOR  1  /**< First sector */
+#define DESC_LENGTH  2  /**< Length in bytes (multiple of 512) */
+#define DESC_ADDR    3  /**< Buffer physical address */
+#define DESC_WORDS   4  /**< Descriptor size in words */
+/* \} */
+
+/** \{ \name Request types */
+#define TYPE_READ   0  /**< Read sectors into the memory */
+#define TYPE_WRITE  1  /**< Write sectors from the memory */
+/* \} */
+
+/** \{ \name Used entry status */
+#define USED_OK     0
+#define USED_ERROR  1
+/* \} */
+
+/** \{ \name Interrupt status bits */
+#define ISR_USED   1  /**< A batch of requests has completed */
+#define ISR_ERROR  2  /**< The queue is broken (reset by the queue size) */
+/* \} */
+
+/** Maximal number of ring entries */
+#define QUEUE_MAX  1024
+
+/** Image backing types */
+enum vblk_type_e {
+	VBLKT_NONE,  /**< Uninitialized */
+	VBLKT_MEM,   /**< Host memory */
+	VBLKT_FMAP   /**< File-mapped */
+};
+
+/*
+ * Device commands
+ */
+
+static bool dvblk_init(parm_link_s *parm, device_s *dev);
+static bool dvblk_info(parm_link_s *parm, device_s *dev);
+static bool dvblk_stat(parm_link_s *parm, device_s *dev);
+static bool dvblk_generic(parm_link_s *parm, device_s *dev);
+static bool dvblk_fmap(parm_link_s *parm, device_s *dev);
+static bool dvblk_load(parm_link_s *parm, device_s *dev);
+static bool dvblk_save(parm_link_s *parm, device_s *dev);
+static bool dvblk_route(parm_link_s *parm, device_s *dev);
+
+cmd_s dvblk_cmds[] = {
+	{
+		"init",
+		(cmd_f) dvblk_init,
+		DEFAULT,
+		DEFAULT,
+		"Initialization",
+		"Initialization",
+		REQ STR "name/device name" NEXT
+		REQ INT "addr/register block address" NEXT
+		REQ INT "intno/interrupt number within 0..6" END
+	},
+	{
+		"help",
+		(cmd_f) dev_generic_help,
+		DEFAULT,
+		DEFAULT,
+		"Display help",
+		"Display help",
+		OPT STR "cmd/command name" END
+	},
+	{
+		"info",
+		(cmd_f) dvblk_info,
+		DEFAULT,
+		DEFAULT,
+		"Configuration information",
+		"Configuration information",
+		NOCMD
+	},
+	{
+		"stat",
+		(cmd_f) dvblk_stat,
+		DEFAULT,
+		DEFAULT,
+		"Statistics",
+		"Statistics",
+		NOCMD
+	},
+	{
+		"generic",
+		(cmd_f) dvblk_generic,
+		DEFAULT,
+		DEFAULT,
+		"Generic memory type",
+		"Generic memory type",
+		REQ INT "size" END
+	},
+	{
+		"fmap",
+		(cmd_f) dvblk_fmap,
+		DEFAULT,
+		DEFAULT,
+		"Map the memory as the file specified",
+		"Map the memory as the file specified",
+		REQ STR "fname/file name" END
+	},
+	{
+		"load",
+		(cmd_f) dvblk_load,
+		DEFAULT,
+		DEFAULT,
+		"Load the memory image from the file specified",
+		"Load the memory image from the file specified",
+		REQ STR "fname/file name" END
+	},
+	{
+		"save",
+		(cmd_f) dvblk_save,
+		DEFAULT,
+		DEFAULT,
+		"Save the memory image into the file specified",
+		"Save the memory image into the file specified",
+		REQ STR "fname/file name" END
+	},
+	{
+		"route",
+		(cmd_f) dvblk_route,
+		DEFAULT,
+		DEFAULT,
+		"Set the interrupt routing",
+		"Route the interrupt to a processor (cpu no), to processors "
+			"in a mask (mask mask) or round-robin to all processors (rr)",
+		REQ STR "mode/cpu, mask or rr" NEXT
+		OPT VAR "target/processor number, mask or list" END
+	},
+	LAST_CMD
+};
+
+/**< Name of the device as presented to the user */
+const char id_dvblk[] = "dvblk";
+
+static void dvblk_done(device_s *dev);
+static void dvblk_step(device_s *dev);
+static void dvblk_read(cpu_t *cpu, device_s *dev, ptr_t addr, uint32_t *val);
+static void dvblk_write(cpu_t *cpu, device_s *dev, ptr_t addr, uint32_t val);
+
+/**< Dvblk object structure */
+device_type_s dvblk = {
+	/* Type name and description */
+	.name = id_dvblk,
+	.brief = "Paravirtual block device",
+	.full = "Block device processing batches of requests posted "
+		"to descriptor rings in the guest memory",
+	
+	/* Functions */
+	.done = dvblk_done,
+	.step = dvblk_step,
+	.read = dvblk_read,
+	.write = dvblk_write,
+	
+	/* Commands */
+	dvblk_cmds
+};
+
+/** Dvblk instance data structure */
+typedef struct {
+	uint32_t *img;               /**< Disk image memory */
+	enum vblk_type_e type;       /**< Image backing */
+	uint32_t size;               /**< Disk size */
+	
+	/* Configuration */
+	uint32_t addr;               /**< Register block location */
+	int intno;                   /**< Interrupt number */
+	intr_route_t route;          /**< Interrupt routing */
+	
+	/* Registers */
+	uint32_t queue_size;         /**< Number of ring entries */
+	uint32_t desc_addr;          /**< Descriptor table address */
+	uint32_t avail_addr;         /**< Available ring address */
+	uint32_t used_addr;          /**< Used ring address */
+	uint32_t isr;                /**< Interrupt status */
+	
+	/* Queue state */
+	uint32_t last_avail;         /**< Next available entry to process */
+	uint32_t used_idx;           /**< Next used entry to post */
+	bool notified;               /**< Doorbell rung */
+	bool broken;                 /**< Invalid available index seen */
+	
+	/* Statistics */
+	uint64_t intrcount;          /**< Number of interrupts */
+	uint64_t notifies;           /**< Number of doorbells */
+	uint64_t requests;           /**< Number of requests */
+	uint64_t errors;             /**< Number of failed requests */
+} vblk_data_s;
+
+/** Dispose the disk image
+ *
+ * @param vd Device instance data structure
+ *
+ */
+static void dvblk_clean_up(vblk_data_s *vd)
+{
+	switch (vd->type) {
+	case VBLKT_NONE:
+		break;
+	case VBLKT_MEM:
+		safe_free(vd->img);
+		break;
+	case VBLKT_FMAP:
+		if (munmap(vd->img, vd->size) == -1) {
+			io_error(NULL);
+			error(txt_file_unmap_fail);
+		}
+		break;
+	}
+	
+	vd->img = NULL;
+	vd->size = 0;
+	vd->type = VBLKT_NONE;
+}
+
+/** Init command implementation
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ *
+ * @return true if successful
+ *
+ */
+static bool dvblk_init(parm_link_s *parm, device_s *dev)
+{
+	vblk_data_s *vd = (vblk_data_s *) safe_malloc_t(vblk_data_s);
+	dev->data = vd;
+	
+	parm_next(&parm);
+	vd->addr = parm_next_int(&parm);
+	vd->intno = parm_next_int(&parm);
+	dcpu_route_init(&vd->route);
+	
+	vd->img = NULL;
+	vd->type = VBLKT_NONE;
+	vd->size = 0;
+	
+	vd->queue_size = 0;
+	vd->desc_addr = 0;
+	vd->avail_addr = 0;
+	vd->used_addr = 0;
+	vd->isr = 0;
+	vd->last_avail = 0;
+	vd->used_idx = 0;
+	vd->notified = false;
+	vd->broken = false;
+	
+	vd->intrcount = 0;
+	vd->notifies = 0;
+	vd->requests = 0;
+	vd->errors = 0;
+	
+	if (!addr_word_aligned(vd->addr)) {
+		mprintf("Device address must be 4-byte aligned\n");
+		free(vd);
+		return false;
+	}
+	
+	if ((uint64_t) vd->addr + (uint64_t) REGISTER_LIMIT > 0x100000000ull) {
+		mprintf("Invalid address; registers would exceed the 4 GB limit\n");
+		free(vd);
+		return false;
+	}
+	
+	if ((vd->intno < 0) || (vd->intno > 6)) {
+		mprintf("Interrupt number must be within 0..6\n");
+		free(vd);
+		return false;
+	}
+	
+	return true;
+}
+
+/** Info command implementation
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ *
+ * @return true; always successful
+ *
+ */
+static bool dvblk_info(parm_link_s *parm, device_s *dev)
+{
+	vblk_data_s *vd = (vblk_data_s *) dev->data;
+	
+	mprintf("address:%#010" PRIx32 " intno:%d size:%" PRIu32
+	    " queue:%" PRIu32 " desc:%#010" PRIx32 " avail:%#010" PRIx32
+	    " used:%#010" PRIx32 "\n", vd->addr, vd->intno, vd->size,
+	    vd->queue_size, vd->desc_addr, vd->avail_addr, vd->used_addr);
+	
+	mprintf("route:");
+	dcpu_route_print(&vd->route);
+	mprintf(" last_avail:%" PRIu32 " used_idx:%" PRIu32 " isr:%" PRIu32 "\n",
+	    vd->last_avail, vd->used_idx, vd->isr);
+	
+	return true;
+}
+
+/** Stat command implementation
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ *
+ * @return true; always successful
+ *
+ */
+static bool dvblk_stat(parm_link_s *parm, device_s *dev)
+{
+	vblk_data_s *vd = (vblk_data_s *) dev->data;
+	
+	mprintf("Interrupts           Doorbells            Requests             Errors\n");
+	mprintf("-------------------- -------------------- -------------------- --------------------\n");
+	mprintf("%20" PRIu64 " %20" PRIu64 " %20" PRIu64 " %20" PRIu64 "\n",
+	    vd->intrcount, vd->notifies, vd->requests, vd->errors);
+	
+	return true;
+}
+
+/** Generic command implementation
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ *
+ * @return true if successful
+ *
+ */
+static bool dvblk_generic(parm_link_s *parm, device_s *dev)
+{
+	vblk_data_s *vd = (vblk_data_s *) dev->data;
+	uint32_t size = parm_int(parm);
+	
+	if ((size == 0) || (size & 511)) {
+		mprintf("Illegal disk size; must be a non-zero multiple of 512 B\n");
+		return false;
+	}
+	
+	dvblk_clean_up(vd);
+	vd->img = (uint32_t *) safe_malloc(size);
+	memset(vd->img, 0, size);
+	vd->size = size;
+	vd->type = VBLKT_MEM;
+	
+	return true;
+}
+
+/** Fmap command implementation
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ *
+ * @return true if successful
+ *
+ */
+static bool dvblk_fmap(parm_link_s *parm, device_s *dev)
+{
+	vblk_data_s *vd = (vblk_data_s *) dev->data;
+	const char *const path = parm_str(parm);
+	
+	FILE *file = try_fopen(path, "rb+");
+	if (file == NULL) {
+		mprintf("%s\n", txt_file_open_err);
+		return false;
+	}
+	
+	size_t fsize;
+	if ((!try_fseek(file, 0, SEEK_END, path)) ||
+	    (!try_ftell(file, path, &fsize))) {
+		mprintf("%s\n", txt_file_seek_err);
+		try_soft_fclose(file, path);
+		return false;
+	}
+	
+	/* Whole sectors only */
+	fsize = ALIGN_DOWN(fsize, 512);
+	if ((fsize == 0) || (fsize > UINT32_MAX)) {
+		mprintf("File size must be within 512 B and 4 GB\n");
+		try_soft_fclose(file, path);
+		return false;
+	}
+	
+	void *ptr = mmap(0, fsize, PROT_READ | PROT_WRITE, MAP_SHARED,
+	    fileno(file), 0);
+	if (ptr == MAP_FAILED) {
+		io_error(path);
+		mprintf("%s\n", txt_file_map_fail);
+		try_soft_fclose(file, path);
+		return false;
+	}
+	
+	if (!try_fclose(file, path)) {
+		mprintf(txt_file_close_err);
+		munmap(ptr, fsize);
+		return false;
+	}
+	
+	dvblk_clean_up(vd);
+	vd->img = (uint32_t *) ptr;
+	vd->size = fsize;
+	vd->type = VBLKT_FMAP;
+	
+	return true;
+}
+
+/** Load command implementation
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ *
+ * @return true if successful
+ *
+ */
+static bool dvblk_load(parm_link_s *parm, device_s *dev)
+{
+	vblk_data_s *vd = (vblk_data_s *) dev->data;
+	const char *const path = parm_str(parm);
+	
+	if (vd->type == VBLKT_NONE) {
+		mprintf("Disk image not initialized\n");
+		return false;
+	}
+	
+	FILE *file = try_fopen(path, "rb");
+	if (file == NULL) {
+		mprintf(txt_file_open_err);
+		return false;
+	}
+	
+	if (fread(vd->img, 1, vd->size, file) < vd->size) {
+		io_error(path);
+		mprintf(txt_file_read_err);
+		try_soft_fclose(file, path);
+		return false;
+	}
+	
+	if (!try_fclose(file, path)) {
+		mprintf(txt_file_close_err);
+		return false;
+	}
+	
+	return true;
+}
+
+/** Save command implementation
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ *
+ * @return true if successful
+ *
+ */
+static bool dvblk_save(parm_link_s *parm, device_s *dev)
+{
+	vblk_data_s *vd = (vblk_data_s *) dev->data;
+	const char *const path = parm_str(parm);
+	
+	if (vd->type == VBLKT_NONE)
+		return true;
+	
+	FILE *file = try_fopen(path, "wb");
+	if (file == NULL) {
+		mprintf(txt_file_create_err);
+		return false;
+	}
+	
+	if (fwrite(vd->img, 1, vd->size, file) < vd->size) {
+		io_error(path);
+		mprintf(txt_file_write_err);
+		try_soft_fclose(file, path);
+		return false;
+	}
+	
+	if (!try_fclose(file, path)) {
+		mprintf(txt_file_close_err);
+		return false;
+	}
+	
+	return true;
+}
+
+/** Route command implementation
+ *
+ * @param parm Command-line parameters
+ * @param dev  Device instance structure
+ *
+ * @return true if successful
+ *
+ */
+static bool dvblk_route(parm_link_s *parm, device_s *dev)
+{
+	vblk_data_s *vd = (vblk_data_s *) dev->data;
+	
+	return dcpu_route_set(&vd->route, parm);
+}
+
+/** Dispose the device
+ *
+ * @param dev Device instance structure
+ *
+ */
+static void dvblk_done(device_s *dev)
+{
+	vblk_data_s *vd = (vblk_data_s *) dev->data;
+	
+	dvblk_clean_up(vd);
+	
+	safe_free(dev->name);
+	safe_free(dev->data);
+}
+
+/** Serve a single request
+ *
+ * The sectors are copied directly between the image and
+ * the guest memory.
+ *
+ * @param vd   Device instance data structure
+ * @param desc Request descriptor
+ *
+ * @return Used entry status.
+ *
+ */
+static uint32_t dvblk_request(vblk_data_s *vd, const uint32_t *desc)
+{
+	uint32_t length = desc[DESC_LENGTH];
+	uint64_t start = (uint64_t) desc[DESC_SECTOR] * 512;
+	
+	if ((vd->type == VBLKT_NONE) || (length == 0) || (length & 511) ||
+	    (start + length > vd->size) || (!addr_word_aligned(desc[DESC_ADDR])))
+		return USED_ERROR;
+	
+	uint32_t *data = vd->img + start / 4;
+	
+	switch (desc[DESC_TYPE]) {
+	case TYPE_READ:
+		mem_write_block(NULL, desc[DESC_ADDR], data, length / 4, true);
+		break;
+	case TYPE_WRITE:
+		mem_read_block(NULL, desc[DESC_ADDR], data, length / 4, true);
+		break;
+	default:
+		return USED_ERROR;
+	}
+	
+	return USED_OK;
+}
+
+/** Raise the interrupt with the status bits specified
+ *
+ */
+static void dvblk_raise(vblk_data_s *vd, uint32_t isr)
+{
+	if (vd->isr == 0) {
+		vd->intrcount++;
+		dcpu_route_up(&vd->route, vd->intno);
+	}
+	
+	vd->isr |= isr;
+}
+
+/** Process all available requests
+ *
+ * The completed requests are posted to the used ring and
+ * a single interrupt is raised for the whole batch. At most
+ * one queue of requests is processed. An available index
+ * which is more than the queue size ahead breaks the queue
+ * until it is reset.
+ *
+ * @param vd Device instance data structure
+ *
+ */
+static void dvblk_process(vblk_data_s *vd)
+{
+	if ((vd->queue_size == 0) || (vd->broken))
+		return;
+	
+	uint32_t avail_idx = mem_read(NULL, vd->avail_addr, BITS_32, true);
+	uint32_t pending = avail_idx - vd->last_avail;
+	
+	if (pending > vd->queue_size) {
+		vd->broken = true;
+		vd->errors++;
+		dvblk_raise(vd, ISR_ERROR);
+		return;
+	}
+	
+	bool completed = false;
+	
+	for (; pending > 0; pending--) {
+		uint32_t slot = vd->last_avail % vd->queue_size;
+		uint32_t id = mem_read(NULL, vd->avail_addr + 4 + slot * 4,
+		    BITS_32, true);
+		uint32_t status = USED_ERROR;
+		
+		if (id < vd->queue_size) {
+			uint32_t desc[DESC_WORDS];
+			
+			mem_read_block(NULL, vd->desc_addr + id * DESC_WORDS * 4,
+			    desc, DESC_WORDS, true);
+			status = dvblk_request(vd, desc);
+		}
+		
+		if (status != USED_OK)
+			vd->errors++;
+		
+		/* Post the used entry */
+		uint32_t used[2] = {id, status};
+		slot = vd->used_idx % vd->queue_size;
+		mem_write_block(NULL, vd->used_addr + 4 + slot * 8, used, 2, true);
+		
+		vd->used_idx++;
+		vd->last_avail++;
+		vd->requests++;
+		completed = true;
+	}
+	
+	if (!completed)
+		return;
+	
+	mem_write(NULL, vd->used_addr, vd->used_idx, BITS_32, true);
+	dvblk_raise(vd, ISR_USED);
+}
+
+/** One step implementation
+ *
+ * The requests are processed in the cycle after the doorbell.
+ *
+ * @param dev Device instance structure
+ *
+ */
+static void dvblk_step(device_s *dev)
+{
+	vblk_data_s *vd = (vblk_data_s *) dev->data;
+	
+	if (vd->notified) {
+		vd->notified = false;
+		dvblk_process(vd);
+	}
+}
+
+/** Read command implementation
+ *
+ * @param cpu  Processor which reads (or NULL)
+ * @param dev  Device instance structure
+ * @param addr Address of the read operation
+ * @param val  Read (returned) value
+ *
+ */
+static void dvblk_read(cpu_t *cpu, device_s *dev, ptr_t addr, uint32_t *val)
+{
+	vblk_data_s *vd = (vblk_data_s *) dev->data;
+	
+	if (addr == vd->addr + REGISTER_CAPACITY)
+		*val = vd->size / 512;
+	else if (addr == vd->addr + REGISTER_QUEUE_SIZE)
+		*val = vd->queue_size;
+	else if (addr == vd->addr + REGISTER_DESC_ADDR)
+		*val = vd->desc_addr;
+	else if (addr == vd->addr + REGISTER_AVAIL_ADDR)
+		*val = vd->avail_addr;
+	else if (addr == vd->addr + REGISTER_USED_ADDR)
+		*val = vd->used_addr;
+	else if (addr == vd->addr + REGISTER_ISR) {
+		/* Reading acknowledges the interrupt */
+		*val = vd->isr;
+		if (vd->isr != 0) {
+			vd->isr = 0;
+			dcpu_route_down(&vd->route, vd->intno);
+		}
+	}
+}
+
+/** Write command implementation
+ *
+ * Setting the queue size resets the queue state.
+ *
+ * @param cpu  Processor which writes (or NULL)
+ * @param dev  Device instance structure
+ * @param addr Address of the write operation
+ * @param val  Value to write
+ *
+ */
+static void dvblk_write(cpu_t *cpu, device_s *dev, ptr_t addr, uint32_t val)
+{
+	vblk_data_s *vd = (vblk_data_s *) dev->data;
+	
+	if (addr == vd->addr + REGISTER_QUEUE_SIZE) {
+		vd->queue_size = (val > QUEUE_MAX) ? 0 : val;
+		vd->last_avail = 0;
+		vd->used_idx = 0;
+		vd->broken = false;
+	} else if (addr == vd->addr + REGISTER_DESC_ADDR)
+		vd->desc_addr = val;
+	else if (addr == vd->addr + REGISTER_AVAIL_ADDR)
+		vd->avail_addr = val;
+	else if (addr == vd->addr + REGISTER_USED_ADDR)
+		vd->used_addr = val;
+	else if (addr == vd->addr + REGISTER_NOTIFY) {
+		vd->notified = true;
+		vd->notifies++;
+	}
+}
@@ -0,0 +1,19 @@
+/*
+ * Copyright (c) 2008 Martin Decky
+ * All rights reserved.
+ *
+ * Distributed under the terms of GPL.
+ *
+ *
+ *  Paravirtual block device
+ *
+ */
+
+#ifndef DVBLK_H_
+#define DVBLK_H_
+
+#include "device.h"
+
+extern device_type_s dvblk;
+
+#endif /* DVBLK_H_ */
@@ -0,0 +1,510 @@
+/*
+ * Copyright (c) 2008 Martin Decky
+ * All rights reserved.
+ *
+ * Distributed under the terms of GPL.
+ *
+ *
+ *  ELF loader
+ *
+ * The PT_LOAD segments of an ELF32 executable are placed into the
+ * configured memory areas. On request, large read-only segments are
+ * mapped from the file as private (copy-on-write) pages instead of
+ * being copied. The host does not snapshot such pages, thus the file
+ * must not be modified while the machine runs. The pages of the
+ * uninitialized data are replaced by fresh anonymous pages, which
+ * the host zero-fills on the first access.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "elf.h"
+
+#include "../arch/mmap.h"
+#include "machine.h"
+#include "dcpu.h"
+#include "../fault.h"
+#include "../text.h"
+#include "../io/output.h"
+#include "../utils.h"
+
+#ifndef O_BINARY
+	#define O_BINARY  0
+#endif
+
+/** \{ \name ELF identification */
+#define EI_CLASS     4
+#define EI_DATA      5
+#define EI_NIDENT    16
+#define ELFCLASS32   1
+#define ELFDATA2LSB  1
+#define ELFDATA2MSB  2
+/* \} */
+
+/** \{ \name ELF constants */
+#define ET_EXEC     2
+#define EM_MIPS     8
+#define PT_LOAD     1
+#define PF_W        2
+#define SHT_SYMTAB  2
+#define STT_NOTYPE  0
+#define STT_FUNC    2
+/* \} */
+
+/** \{ \name Header sizes */
+#define EHDR_SIZE  52
+#define PHDR_SIZE  32
+#define SHDR_SIZE  40
+#define SYM_SIZE   16
+/* \} */
+
+/** Smallest read-only segment mapped instead of copied */
+#define ELF_MAP_THRESHOLD  (64 * 1024)
+
+/** Segment of the physical address space covered by kseg0 and kseg1 */
+#define KSEG_MASK  0x1fffffffU
+
+/** Symbol table entry */
+typedef struct {
+	ptr_t addr;   /**< Symbol value */
+	char *name;   /**< Symbol name */
+} elf_sym_t;
+
+/** Symbols sorted by the address */
+static elf_sym_t *symbols = NULL;
+
+/** Number of symbols */
+static size_t symbol_count = 0;
+
+/** Loaded image */
+typedef struct {
+	const unsigned char *data;  /**< Mapped file */
+	size_t size;                /**< File size */
+	bool msb;                   /**< Big-endian image */
+	bool map;                   /**< Map read-only segments */
+	int fd;                     /**< File descriptor */
+} elf_image_t;
+
+/** Read a half word of the image
+ *
+ */
+static uint16_t elf_half(const elf_image_t *img, size_t off)
+{
+	const unsigned char *p = img->data + off;
+	
+	if (img->msb)
+		return (uint16_t) ((p[0] << 8) | p[1]);
+	
+	return (uint16_t) ((p[1] << 8) | p[0]);
+}
+
+/** Read a word of the image
+ *
+ */
+static uint32_t elf_word(const elf_image_t *img, size_t off)
+{
+	const unsigned char *p = img->data + off;
+	
+	if (img->msb)
+		return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) |
+		    ((uint32_t) p[2] << 8) | (uint32_t) p[3];
+	
+	return ((uint32_t) p[3] << 24) | ((uint32_t) p[2] << 16) |
+	    ((uint32_t) p[1] << 8) | (uint32_t) p[0];
+}
+
+/** Check whether a range lies within the image
+ *
+ */
+static bool elf_range(const elf_image_t *img, uint64_t off, uint64_t size)
+{
+	return (off + size <= img->size);
+}
+
+/** Find the memory area of a segment
+ *
+ * @param addr Physical address of the segment
+ * @param size Size of the segment
+ *
+ * @return Memory area or NULL if the segment does not lie
+ *         within a single generic memory area
+ *
+ */
+static mem_area_t *elf_area(ptr_t addr, len_t size)
+{
+	mem_area_t *area;
+	
+	for_each(mem_areas, area, mem_area_t) {
+		if ((addr >= area->start) &&
+		    ((uint64_t) addr + size <= (uint64_t) area->start + area->size))
+			return (area->type == MEMT_MEM) ? area : NULL;
+	}
+	
+	return NULL;
+}
+
+/** Replace the whole pages of a host memory block
+ *
+ * The file pages are mapped as private, the anonymous pages
+ * are fresh zero pages. Only the pages which lie within the block
+ * entirely are replaced, the block must be congruent with the file
+ * offset modulo the page size.
+ *
+ * @param ptr  Host memory block
+ * @param size Size of the block
+ * @param fd   File descriptor (-1 for anonymous pages)
+ * @param off  File offset of the block
+ * @param head Offset of the replaced pages within the block
+ *
+ * @return Number of bytes replaced (0 if nothing has been replaced)
+ *
+ */
+static size_t elf_map_pages(unsigned char *ptr, size_t size, int fd,
+    off_t off, size_t *head)
+{
+	*head = 0;
+	
+#if defined(MAP_FIXED) && defined(MAP_ANONYMOUS)
+	size_t page = (size_t) sysconf(_SC_PAGESIZE);
+	uintptr_t start = ALIGN_UP((uintptr_t) ptr, page);
+	uintptr_t end = ALIGN_DOWN((uintptr_t) ptr + size, page);
+	
+	if (end <= start)
+		return 0;
+	
+	*head = start - (uintptr_t) ptr;
+	
+	void *map;
+	if (fd == -1)
+		map = mmap((void *) start, end - start, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_FIXED | MAP_ANONYMOUS, -1, 0);
+	else {
+		if ((((uintptr_t) ptr - off) & (page - 1)) != 0)
+			return 0;
+		
+		map = mmap((void *) start, end - start, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_FIXED, fd, off + *head);
+	}
+	
+	if (map == MAP_FAILED)
+		return 0;
+	
+	return end - start;
+#else
+	return 0;
+#endif
+}
+
+/** Fill a host memory block from the image or with zeros
+ *
+ * @param img  Image
+ * @param dst  Host memory block
+ * @param off  File offset (ignored for zeros)
+ * @param size Size of the block
+ * @param map  Try to map the whole pages
+ * @param zero Fill with zeros
+ *
+ * @return Number of bytes mapped
+ *
+ */
+static size_t elf_fill(elf_image_t *img, unsigned char *dst, size_t off,
+    size_t size, bool map, bool zero)
+{
+	size_t head = 0;
+	size_t mapped = 0;
+	
+	if (map)
+		mapped = elf_map_pages(dst, size, zero ? -1 : img->fd,
+		    (off_t) off, &head);
+	
+	if (mapped == 0)
+		head = size;
+	
+	/* Before and after the mapped pages */
+	if (zero) {
+		memset(dst, 0, head);
+		memset(dst + head + mapped, 0, size - head - mapped);
+	} else {
+		memcpy(dst, img->data + off, head);
+		memcpy(dst + head + mapped, img->data + off + head + mapped,
+		    size - head - mapped);
+	}
+	
+	return mapped;
+}
+
+/** Compare the symbols by the address
+ *
+ */
+static int elf_sym_cmp(const void *a, const void *b)
+{
+	const elf_sym_t *sa = (const elf_sym_t *) a;
+	const elf_sym_t *sb = (const elf_sym_t *) b;
+	
+	if (sa->addr < sb->addr)
+		return -1;
+	
+	if (sa->addr > sb->addr)
+		return 1;
+	
+	return 0;
+}
+
+/** Dispose the symbol table
+ *
+ */
+void elf_done(void)
+{
+	size_t i;
+	
+	for (i = 0; i < symbol_count; i++)
+		safe_free(symbols[i].name);
+	
+	safe_free(symbols);
+	symbol_count = 0;
+}
+
+/** Load the symbol table of the image
+ *
+ * Only the function symbols and the labels are kept.
+ *
+ */
+static void elf_load_symbols(elf_image_t *img)
+{
+	elf_done();
+	
+	uint32_t shoff = elf_word(img, 32);
+	uint16_t shentsize = elf_half(img, 46);
+	uint16_t shnum = elf_half(img, 48);
+	
+	if ((shoff == 0) || (shentsize < SHDR_SIZE) ||
+	    (!elf_range(img, shoff, (uint64_t) shnum * shentsize)))
+		return;
+	
+	unsigned int i;
+	for (i = 0; i < shnum; i++) {
+		size_t sh = shoff + i * shentsize;
+		
+		if (elf_word(img, sh + 4) != SHT_SYMTAB)
+			continue;
+		
+		uint32_t symoff = elf_word(img, sh + 16);
+		uint32_t symsize = elf_word(img, sh + 20);
+		uint32_t link = elf_word(img, sh + 24);
+		
+		if ((link >= shnum) || (!elf_range(img, symoff, symsize)))
+			continue;
+		
+		size_t strsh = shoff + link * shentsize;
+		uint32_t stroff = elf_word(img, strsh + 16);
+		uint32_t strsize = elf_word(img, strsh + 20);
+		
+		if (!elf_range(img, stroff, strsize))
+			continue;
+		
+		size_t count = symsize / SYM_SIZE;
+		symbols = (elf_sym_t *) safe_malloc(count * sizeof(elf_sym_t));
+		
+		size_t j;
+		for (j = 0; j < count; j++) {
+			size_t sym = symoff + j * SYM_SIZE;
+			uint32_t name = elf_word(img, sym);
+			uint32_t value = elf_word(img, sym + 4);
+			unsigned int type = img->data[sym + 12] & 0x0f;
+			
+			if (((type != STT_FUNC) && (type != STT_NOTYPE)) ||
+			    (name == 0) || (name >= strsize) || (value == 0))
+				continue;
+			
+			const char *str = (const char *) img->data + stroff + name;
+			if (memchr(str, 0, strsize - name) == NULL)
+				continue;
+			
+			symbols[symbol_count].addr = value;
+			symbols[symbol_count].name = safe_strdup(str);
+			symbol_count++;
+		}
+		
+		qsort(symbols, symbol_count, sizeof(elf_sym_t), elf_sym_cmp);
+		return;
+	}
+}
+
+/** Find a symbol
+ *
+ * @param addr Virtual address
+ *
+ * @return Name of the symbol at the address or NULL
+ *
+ */
+const char *elf_symbol(ptr_t addr)
+{
+	size_t lo = 0;
+	size_t hi = symbol_count;
+	
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		
+		if (symbols[mid].addr < addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	
+	if ((lo < symbol_count) && (symbols[lo].addr == addr))
+		return symbols[lo].name;
+	
+	return NULL;
+}
+
+/** Load the segments of the image
+ *
+ * @return true if successful
+ *
+ */
+static bool elf_load_segments(elf_image_t *img)
+{
+	uint32_t phoff = elf_word(img, 28);
+	uint16_t phentsize = elf_half(img, 42);
+	uint16_t phnum = elf_half(img, 44);
+	
+	if ((phentsize < PHDR_SIZE) ||
+	    (!elf_range(img, phoff, (uint64_t) phnum * phentsize))) {
+		mprintf("Invalid program headers\n");
+		return false;
+	}
+	
+	unsigned int i;
+	for (i = 0; i < phnum; i++) {
+		size_t ph = phoff + i * phentsize;
+		
+		if (elf_word(img, ph) != PT_LOAD)
+			continue;
+		
+		uint32_t offset = elf_word(img, ph + 4);
+		uint32_t paddr = elf_word(img, ph + 12);
+		uint32_t filesz = elf_word(img, ph + 16);
+		uint32_t memsz = elf_word(img, ph + 20);
+		uint32_t flags = elf_word(img, ph + 24);
+		
+		if (memsz == 0)
+			continue;
+		
+		if ((filesz > memsz) || (!elf_range(img, offset, filesz))) {
+			mprintf("Invalid segment %u\n", i);
+			return false;
+		}
+		
+		/* Kernel segments are linked to kseg0 or kseg1 */
+		if ((paddr >= 0x80000000U) && (paddr < 0xc0000000U))
+			paddr &= KSEG_MASK;
+		
+		mem_area_t *area = elf_area(paddr, memsz);
+		if (area == NULL) {
+			mprintf("Segment %u (%#010" PRIx32 ", %" PRIu32 " bytes) "
+			    "does not fit into a generic memory area\n", i, paddr,
+			    memsz);
+			return false;
+		}
+		
+		unsigned char *dst = area->data + (paddr - area->start);
+		bool map = (img->map) && ((flags & PF_W) == 0) &&
+		    (filesz >= ELF_MAP_THRESHOLD);
+		
+		elf_fill(img, dst, offset, filesz, map, false);
+		elf_fill(img, dst + filesz, 0, memsz - filesz, true, true);
+		mem_dirty_set(area, paddr - area->start, memsz);
+	}
+	
+	return true;
+}
+
+/** Load an ELF executable
+ *
+ * Load the segments to the memory areas, set the entry point
+ * of the processor 0 and keep the symbol table.
+ *
+ * @param path File name
+ * @param map  Map large read-only segments from the file
+ *
+ * @return true if successful
+ *
+ */
+bool elf_load(const char *path, bool map)
+{
+	elf_image_t img;
+	
+	img.map = map;
+	img.fd = open(path, O_RDONLY | O_BINARY);
+	if (img.fd == -1) {
+		io_error(path);
+		mprintf("%s\n", txt_file_open_err);
+		return false;
+	}
+	
+	struct stat st;
+	if (fstat(img.fd, &st) == -1) {
+		io_error(path);
+		close(img.fd);
+		return false;
+	}
+	
+	img.size = (size_t) st.st_size;
+	if (img.size < EHDR_SIZE) {
+		mprintf("Not an ELF file\n");
+		close(img.fd);
+		return false;
+	}
+	
+	void *ptr = mmap(0, img.size, PROT_READ, MAP_PRIVATE, img.fd, 0);
+	if (ptr == MAP_FAILED) {
+		io_error(path);
+		mprintf("%s\n", txt_file_map_fail);
+		close(img.fd);
+		return false;
+	}
+	
+	img.data = (const unsigned char *) ptr;
+	img.msb = (img.data[EI_DATA] == ELFDATA2MSB);
+	
+	bool ok = false;
+	
+	if ((memcmp(img.data, "\177ELF", 4) != 0) ||
+	    (img.data[EI_CLASS] != ELFCLASS32) ||
+	    ((img.data[EI_DATA] != ELFDATA2LSB) && (!img.msb)))
+		mprintf("Not an ELF32 file\n");
+	else if ((elf_half(&img, 16) != ET_EXEC) ||
+	    (elf_half(&img, 18) != EM_MIPS))
+		mprintf("Not a MIPS executable\n");
+	else if (img.msb)
+		mprintf("Big-endian executable cannot run "
+		    "on the little-endian machine\n");
+	else if (elf_load_segments(&img)) {
+		elf_load_symbols(&img);
+		
+		cpu_t *cpu = dcpu_find_no(0);
+		if (cpu != NULL)
+			cpu_set_pc(cpu, elf_word(&img, 24));
+		else
+			mprintf("No processor 0, entry point not set\n");
+		
+		ok = true;
+	}
+	
+	if (munmap(ptr, img.size) == -1) {
+		io_error(path);
+		error(txt_file_unmap_fail);
+	}
+	
+	close(img.fd);
+	return ok;
+}
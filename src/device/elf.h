@@ -0,0 +1,23 @@
+/*
+ * Copyright (c) 2008 Martin Decky
+ * All rights reserved.
+ *
+ * Distributed under the terms of GPL.
+ *
+ *
+ *  ELF loader
+ *
+ */
+
+#ifndef ELF_H_
+#define ELF_H_
+
+#include <stdbool.h>
+
+#include "../mtypes.h"
+
+extern bool elf_load(const char *path, bool map);
+extern const char *elf_symbol(ptr_t addr);
+extern void elf_done(void);
+
+#endif
@@ -23,6 +23,9 @@
 #include "../debug/gdb.h"
 #include "../debug/breakpoint.h"
 #include "../device/dcpu.h"
+#include "../device/dprinter.h"
+#include "../device/elf.h"
+#include "../debug/semihost.h"
 #include "../env.h"
 #include "../check.h"
 #include "../utils.h"
@@ -42,6 +45,9 @@ bool tobreak = false;
 char *config_file = NULL;
 uint32_t stepping = 0;
 
+/** Exit code of the simulator */
+int exit_code = 0;
+
 /** Debug features */
 char **cp0name;
 char **cp1name;
@@ -67,7 +73,29 @@ bool remote_gdb_step = false;
 list_t mem_areas;
 list_t sc_list;
 
-static uint64_t msteps = 0;
+/**
+ * Fast mode: run without tracing, statistics and breakpoints
+ * until the trigger fires.
+ */
+bool fast_mode = false;
+
+/** Fast mode trigger */
+fast_until_t fast_until = FAST_UNTIL_GUEST;
+
+/** Address or cycle count of the fast mode trigger */
+uint64_t fast_until_value = 0;
+
+/** Trace mode requested by the user for the instrumented mode */
+static bool fast_trace = false;
+
+/** Number of machine cycles */
+uint64_t msteps = 0;
+
+/** Timed events ordered by the machine cycle */
+static list_t events;
+
+/** Machine cycle of the earliest timed event */
+static uint64_t events_next = UINT64_MAX;
 
 void init_machine(void)
 {
@@ -79,6 +107,7 @@ void init_machine(void)
 	
 	list_init(&mem_areas);
 	list_init(&sc_list);
+	list_init(&events);
 	
 	input_init();
 	input_shadow();
@@ -98,8 +127,110 @@ static void print_statistics(void)
 
 void done_machine(void)
 {
+	dprinter_flush();
+	semihost_done();
+	elf_done();
 	input_back();
 	print_statistics();
+	
+	/* Dispose the devices (flush and unmap files etc.) */
+	device_s *dev = NULL;
+	while (dev_next(&dev, DEVICE_FILTER_ALL)) {
+		if (dev->type->done)
+			dev->type->done(dev);
+	}
+}
+
+/** Initialize a timed event
+ *
+ * @param event   Event to initialize.
+ * @param handler Handler called when the event fires.
+ * @param data    Handler argument.
+ *
+ */
+void event_init(event_t *event, event_f handler, void *data)
+{
+	item_init(&event->item);
+	event->cycle = 0;
+	event->handler = handler;
+	event->data = data;
+}
+
+/** Check whether a timed event is scheduled
+ *
+ */
+bool event_scheduled(const event_t *event)
+{
+	return (event->item.list != NULL);
+}
+
+/** Update the machine cycle of the earliest timed event
+ *
+ */
+static void events_update(void)
+{
+	event_t *first = (event_t *) events.head;
+	events_next = (first != NULL) ? first->cycle : UINT64_MAX;
+}
+
+/** Schedule a timed event
+ *
+ * An event already scheduled is moved. An event scheduled
+ * for a past cycle fires in the next machine cycle.
+ *
+ * @param event Event to schedule.
+ * @param cycle Machine cycle to fire in.
+ *
+ */
+void event_schedule(event_t *event, uint64_t cycle)
+{
+	if (event_scheduled(event))
+		list_remove(&events, &event->item);
+	
+	event->cycle = cycle;
+	
+	/* Most events are scheduled for the future,
+	   look for the position from the end */
+	event_t *prev = (event_t *) events.tail;
+	while ((prev != NULL) && (prev->cycle > cycle))
+		prev = (event_t *) prev->item.prev;
+	
+	list_insert_before(&events, &event->item,
+	    (prev != NULL) ? prev->item.next : events.head);
+	events_update();
+}
+
+/** Cancel a timed event
+ *
+ * @param event Event to cancel (may not be scheduled).
+ *
+ */
+void event_cancel(event_t *event)
+{
+	if (!event_scheduled(event))
+		return;
+	
+	list_remove(&events, &event->item);
+	events_update();
+}
+
+/** Fire all the timed events which are due
+ *
+ * The handlers can schedule further events.
+ *
+ */
+static void events_fire(void)
+{
+	event_t *event;
+	
+	while (((event = (event_t *) events.head) != NULL) &&
+	    (event->cycle <= msteps)) {
+		list_remove(&events, &event->item);
+		events_update();
+		event->handler(event->data);
+	}
+	
+	events_update();
 }
 
 /** One machine cycle
@@ -112,17 +243,114 @@ void machine_step(void)
 	
 	/* First traverse all the devices
 	   which requires processing time every step */
-	device_s *dev = NULL;
-	while (dev_next(&dev, DEVICE_FILTER_STEP))
-		dev->type->step(dev);
+	size_t count;
+	device_s *const *devs = dev_cached(DEVICE_FILTER_STEP, &count);
+	size_t i;
+	for (i = 0; i < count; i++)
+		devs[i]->type->step(devs[i]);
 	
 	/* Then, every 4096th cycle traverse
 	   all the devices implementing step4 function */
 	if ((msteps % 4096) == 0) {
-		dev = NULL;
-		while (dev_next(&dev, DEVICE_FILTER_STEP4))
-			dev->type->step4(dev);
+		devs = dev_cached(DEVICE_FILTER_STEP4, &count);
+		for (i = 0; i < count; i++)
+			devs[i]->type->step4(devs[i]);
 	}
+	
+	/* Finally, fire the timed events which are due */
+	if (msteps >= events_next)
+		events_fire();
+}
+
+/** Leave the fast mode and continue in the instrumented mode
+ *
+ * @param reason Description of the trigger which has fired.
+ *
+ */
+void machine_fast_leave(const char *reason)
+{
+	if (!fast_mode)
+		return;
+	
+	fast_mode = false;
+	totrace = fast_trace;
+	
+	mprintf("\nFast mode finished at cycle %" PRIu64 " (%s)\n\n",
+	    msteps, reason);
+}
+
+/** Check whether any processor has reached the trigger address
+ *
+ */
+static bool machine_fast_pc_reached(void)
+{
+	size_t count;
+	device_s *const *devs = dev_cached(DEVICE_FILTER_PROCESSOR, &count);
+	size_t i;
+	
+	for (i = 0; i < count; i++) {
+		cpu_t *cpu = (cpu_t *) devs[i]->data;
+		
+		if (cpu->pc == fast_until_value)
+			return true;
+	}
+	
+	return false;
+}
+
+/** Check whether any code or memory breakpoint is set
+ *
+ */
+static bool machine_breakpoints_set(void)
+{
+	if (memory_breakpoints.head != NULL)
+		return true;
+	
+	size_t count;
+	device_s *const *devs = dev_cached(DEVICE_FILTER_PROCESSOR, &count);
+	size_t i;
+	
+	for (i = 0; i < count; i++) {
+		cpu_t *cpu = (cpu_t *) devs[i]->data;
+		
+		if (cpu->bps.head != NULL)
+			return true;
+	}
+	
+	return false;
+}
+
+/** Run the machine in the fast mode
+ *
+ * No breakpoints, debugger or stepping are checked. Run until
+ * the trigger fires, the machine halts or the interactive mode
+ * is requested.
+ *
+ */
+static void machine_fast_run(void)
+{
+	fast_trace = totrace;
+	totrace = false;
+	
+	while ((fast_mode) && (!tohalt) && (!interactive)) {
+		machine_step();
+		
+		switch (fast_until) {
+		case FAST_UNTIL_GUEST:
+			break;
+		case FAST_UNTIL_PC:
+			if (machine_fast_pc_reached())
+				machine_fast_leave("address reached");
+			break;
+		case FAST_UNTIL_CYCLE:
+			if (msteps >= fast_until_value)
+				machine_fast_leave("cycle count reached");
+			break;
+		}
+	}
+	
+	if (fast_mode)
+		totrace = fast_trace;
 }
 
 /** Try to run gdb communication.
@@ -158,6 +386,12 @@ static bool gdb_startup(void) {
 void go_machine(void)
 {
 	while (!tohalt) {
+		/* Uninstrumented run until the trigger fires */
+		if ((fast_mode) && (!interactive)) {
+			machine_fast_run();
+			continue;
+		}
+		
 		/*
 		 * Check for code breakpoints. Interactive
 		 * or gdb flags will be set if a breakpoint
@@ -190,8 +424,16 @@ void go_machine(void)
 		}
 		
 		/* Interactive mode control */
-		if (interactive)
+		if (interactive) {
+			dprinter_flush();
 			interactive_control();
+			
+			/* Stepping and breakpoints are not checked in the fast mode */
+			if (stepping > 0)
+				machine_fast_leave("stepping requested");
+			else if (machine_breakpoints_set())
+				machine_fast_leave("breakpoint set");
+		}
 		
 		/* Step */
 		if (!tohalt)
@@ -234,6 +476,101 @@ void unregister_sc(cpu_t *cpu)
 	}
 }
 
+/** Number of the dirty pages of a memory area */
+static inline len_t dirty_pages(mem_area_t *area)
+{
+	return (area->size + DIRTY_PAGE_SIZE - 1) / DIRTY_PAGE_SIZE;
+}
+
+/** Number of the words of the dirty bitmap of a memory area */
+static inline len_t dirty_words(mem_area_t *area)
+{
+	return (dirty_pages(area) + 31) / 32;
+}
+
+/** Initialize the dirty page tracking of a memory area
+ *
+ * Must be called after the size of the area is set.
+ * All pages are clean initially.
+ *
+ */
+void mem_dirty_init(mem_area_t *area)
+{
+	len_t words = dirty_words(area);
+	
+	area->dirty = (uint32_t *) safe_malloc(words * sizeof(uint32_t));
+	memset(area->dirty, 0, words * sizeof(uint32_t));
+}
+
+/** Dispose the dirty page tracking of a memory area
+ *
+ */
+void mem_dirty_done(mem_area_t *area)
+{
+	if (area->dirty != NULL) {
+		safe_free(area->dirty);
+		area->dirty = NULL;
+	}
+}
+
+/** Mark a block of a memory area as dirty
+ *
+ * @param area   Memory area.
+ * @param offset Offset of the block within the area.
+ * @param size   Size of the block in bytes.
+ *
+ */
+void mem_dirty_set(mem_area_t *area, len_t offset, len_t size)
+{
+	if ((area->dirty == NULL) || (size == 0))
+		return;
+	
+	len_t page = offset / DIRTY_PAGE_SIZE;
+	len_t last = (offset + size - 1) / DIRTY_PAGE_SIZE;
+	
+	for (; page <= last; page++)
+		area->dirty[page / 32] |= 1U << (page % 32);
+}
+
+/** Test whether a page of a memory area is dirty
+ *
+ * @param area Memory area.
+ * @param page Page number within the area.
+ *
+ */
+bool mem_dirty_test(mem_area_t *area, len_t page)
+{
+	if (area->dirty == NULL)
+		return false;
+	
+	return ((area->dirty[page / 32] & (1U << (page % 32))) != 0);
+}
+
+/** Count the dirty pages of a memory area
+ *
+ */
+len_t mem_dirty_count(mem_area_t *area)
+{
+	len_t count = 0;
+	len_t page;
+	
+	for (page = 0; page < dirty_pages(area); page++) {
+		if (mem_dirty_test(area, page))
+			count++;
+	}
+	
+	return count;
+}
+
+/** Mark all pages of a memory area as clean
+ *
+ */
+void mem_dirty_clear(mem_area_t *area)
+{
+	if (area->dirty != NULL)
+		memset(area->dirty, 0, dirty_words(area) * sizeof(uint32_t));
+}
+
 static inline mem_area_t* find_mem_area(ptr_t addr)
 {
 	mem_area_t *area;
@@ -316,7 +653,7 @@ uint32_t mem_read(cpu_t *cpu, ptr_t addr, size_t size,
 	}
 	
 	/* Check for memory read breakpoints */
-	if (protected_read) {
+	if ((protected_read) && (!fast_mode)) {
 		mem_breakpoint_t *breakpoint =
 		    memory_breakpoint_find(addr, ACCESS_READ);
 		
@@ -405,7 +742,7 @@ bool mem_write(cpu_t *cpu, uint32_t addr, uint32_t val, size_t size,
 	}
 	
 	/* Check for memory write breakpoints */
-	if (protected_write) {
+	if ((protected_write) && (!fast_mode)) {
 		mem_breakpoint_t *breakpoint =
 		    memory_breakpoint_find(addr, ACCESS_WRITE);
 		
@@ -414,6 +751,7 @@ bool mem_write(cpu_t *cpu, uint32_t addr, uint32_t val, size_t size,
 	}
 	
 	unsigned char *value_ptr = &area->data[addr - area->start];
+	mem_dirty_set(area, addr - area->start, size);
 	
 	switch (size) {
 	case BITS_8:
@@ -431,3 +769,272 @@ bool mem_write(cpu_t *cpu, uint32_t addr, uint32_t val, size_t size,
 	
 	return true;
 }
+
+/** Find a memory area containing the whole block
+ *
+ * @return Memory area or NULL if the block is not
+ *         contained in a single memory area.
+ *
+ */
+static mem_area_t *find_mem_area_block(ptr_t addr, len_t size)
+{
+	mem_area_t *area = find_mem_area(addr);
+	
+	if (area == NULL)
+		return NULL;
+	
+	if ((uint64_t) addr + size > (uint64_t) area->start + area->size)
+		return NULL;
+	
+	return area;
+}
+
+/** Cancel the LL/SC reservations within a written block
+ *
+ */
+static void sc_invalidate_block(ptr_t addr, len_t size)
+{
+	sc_item_t *sc_item = (sc_item_t *) sc_list.head;
+	
+	while (sc_item != NULL) {
+		cpu_t *sc_cpu = sc_item->cpu;
+		
+		if ((sc_cpu->lladdr >= addr) && (sc_cpu->lladdr - addr < size)) {
+			sc_cpu->llbit = false;
+			
+			sc_item_t *tmp = sc_item;
+			sc_item = (sc_item_t *) sc_item->item.next;
+			
+			list_remove(&sc_list, &tmp->item);
+			safe_free(tmp);
+		} else
+			sc_item = (sc_item_t *) sc_item->item.next;
+	}
+}
+
+/** Check whether memory breakpoints have to be checked
+ *
+ */
+static bool mem_block_protected(bool protected_access)
+{
+	return (protected_access) && (!fast_mode) &&
+	    (memory_breakpoints.head != NULL);
+}
+
+/** Block memory read
+ *
+ * Read whole words as if they were read one by one by mem_read,
+ * but copy them in a single pass if the block lies in a single
+ * memory area and no memory breakpoints have to be checked.
+ *
+ * @param cpu            Processor which wants to read.
+ * @param addr           Word-aligned address of the block.
+ * @param dst            Destination buffer.
+ * @param count          Number of words to read.
+ * @param protected_read If true the memory breakpoints check is performed.
+ *
+ */
+void mem_read_block(cpu_t *cpu, ptr_t addr, uint32_t *dst, size_t count,
+    bool protected_read)
+{
+	len_t size = count * sizeof(uint32_t);
+	mem_area_t *area = find_mem_area_block(addr, size);
+	size_t i;
+	
+	if ((area == NULL) || (!addr_word_aligned(addr)) ||
+	    (mem_block_protected(protected_read))) {
+		for (i = 0; i < count; i++)
+			dst[i] = mem_read(cpu, addr + 4 * i, BITS_32, protected_read);
+		
+		return;
+	}
+	
+	unsigned char *data = &area->data[addr - area->start];
+	
+#ifdef WORDS_BIGENDIAN
+	for (i = 0; i < count; i++)
+		dst[i] = convert_uint32_t_endian(((uint32_t *) data)[i]);
+#else
+	memcpy(dst, data, size);
+#endif
+}
+
+/** Block memory write
+ *
+ * Write whole words as if they were written one by one by mem_write,
+ * but copy them in a single pass if the block lies in a single
+ * memory area and no memory breakpoints have to be checked.
+ *
+ * @param cpu             Processor which wants to write.
+ * @param addr            Word-aligned address of the block.
+ * @param src             Source buffer.
+ * @param count           Number of words to write.
+ * @param protected_write False to allow writing to ROM memory and ignore
+ *                        the memory breakpoints check.
+ *
+ */
+void mem_write_block(cpu_t *cpu, ptr_t addr, const uint32_t *src,
+    size_t count, bool protected_write)
+{
+	len_t size = count * sizeof(uint32_t);
+	mem_area_t *area = find_mem_area_block(addr, size);
+	size_t i;
+	
+	if ((area == NULL) || (!addr_word_aligned(addr)) ||
+	    (mem_block_protected(protected_write))) {
+		for (i = 0; i < count; i++)
+			mem_write(cpu, addr + 4 * i, src[i], BITS_32, protected_write);
+		
+		return;
+	}
+	
+	/* Writting to ROM? */
+	if ((!area->writable) && (protected_write))
+		return;
+	
+	sc_invalidate_block(addr, size);
+	mem_dirty_set(area, addr - area->start, size);
+	
+	unsigned char *data = &area->data[addr - area->start];
+	
+#ifdef WORDS_BIGENDIAN
+	for (i = 0; i < count; i++)
+		((uint32_t *) data)[i] = convert_uint32_t_endian(src[i]);
+#else
+	memcpy(data, src, size);
+#endif
+}
+
+/** Block memory copy
+ *
+ * Copy whole words as if they were read and written one by one,
+ * but move them in a single pass if both blocks lie in single memory
+ * areas and no memory breakpoints have to be checked. Overlapping
+ * blocks are copied as if through a temporary buffer.
+ *
+ * @param cpu              Processor which wants to copy.
+ * @param dst              Word-aligned destination address.
+ * @param src              Word-aligned source address.
+ * @param count            Number of words to copy.
+ * @param protected_access False to allow writing to ROM memory and ignore
+ *                         the memory breakpoints check.
+ *
+ */
+void mem_copy_block(cpu_t *cpu, ptr_t dst, ptr_t src, size_t count,
+    bool protected_access)
+{
+	len_t size = count * sizeof(uint32_t);
+	mem_area_t *dst_area = find_mem_area_block(dst, size);
+	mem_area_t *src_area = find_mem_area_block(src, size);
+	size_t i;
+	
+	if ((dst_area == NULL) || (src_area == NULL) ||
+	    (!addr_word_aligned(dst)) || (!addr_word_aligned(src)) ||
+	    (mem_block_protected(protected_access))) {
+		if ((dst > src) && (dst - src < size)) {
+			for (i = count; i > 0; i--)
+				mem_write(cpu, dst + 4 * (i - 1),
+				    mem_read(cpu, src + 4 * (i - 1), BITS_32,
+				    protected_access), BITS_32, protected_access);
+		} else {
+			for (i = 0; i < count; i++)
+				mem_write(cpu, dst + 4 * i,
+				    mem_read(cpu, src + 4 * i, BITS_32,
+				    protected_access), BITS_32, protected_access);
+		}
+		
+		return;
+	}
+	
+	/* Writting to ROM? */
+	if ((!dst_area->writable) && (protected_access))
+		return;
+	
+	sc_invalidate_block(dst, size);
+	mem_dirty_set(dst_area, dst - dst_area->start, size);
+	
+	memmove(&dst_area->data[dst - dst_area->start],
+	    &src_area->data[src - src_area->start], size);
+}
+
+/** Block memory fill
+ *
+ * Write the same word repeatedly as if it was written one by one
+ * by mem_write, but store it in a single pass if the block lies
+ * in a single memory area and no memory breakpoints have to be checked.
+ *
+ * @param cpu             Processor which wants to write.
+ * @param addr            Word-aligned address of the block.
+ * @param val             Value to write.
+ * @param count           Number of words to write.
+ * @param protected_write False to allow writing to ROM memory and ignore
+ *                        the memory breakpoints check.
+ *
+ */
+void mem_fill_block(cpu_t *cpu, ptr_t addr, uint32_t val, size_t count,
+    bool protected_write)
+{
+	len_t size = count * sizeof(uint32_t);
+	mem_area_t *area = find_mem_area_block(addr, size);
+	size_t i;
+	
+	if ((area == NULL) || (!addr_word_aligned(addr)) ||
+	    (mem_block_protected(protected_write))) {
+		for (i = 0; i < count; i++)
+			mem_write(cpu, addr + 4 * i, val, BITS_32, protected_write);
+		
+		return;
+	}
+	
+	/* Writting to ROM? */
+	if ((!area->writable) && (protected_write))
+		return;
+	
+	sc_invalidate_block(addr, size);
+	mem_dirty_set(area, addr - area->start, size);
+	
+	unsigned char *data = &area->data[addr - area->start];
+	
+	/* The same byte everywhere */
+	if (val == (val & 0xff) * 0x01010101U) {
+		memset(data, val & 0xff, size);
+		return;
+	}
+	
+	uint32_t word = convert_uint32_t_endian(val);
+	for (i = 0; i < count; i++)
+		((uint32_t *) data)[i] = word;
+}
+
+/** Direct access to a memory block
+ *
+ * Return the host memory of a block which lies in a single memory
+ * area, so the block can be transferred in a single pass. The memory
+ * breakpoints are not checked. Writing cancels the LL/SC reservations
+ * within the block and marks the block as dirty.
+ *
+ * @param addr  Address of the block.
+ * @param size  Size of the block in bytes.
+ * @param write The block is going to be written.
+ *
+ * @return Host memory of the block or NULL if the block is not
+ *         in a single (writable) memory area.
+ *
+ */
+unsigned char *mem_direct(ptr_t addr, len_t size, bool write)
+{
+	mem_area_t *area = find_mem_area_block(addr, size);
+	
+	if (area == NULL)
+		return NULL;
+	
+	if (write) {
+		if (!area->writable)
+			return NULL;
+		
+		sc_invalidate_block(addr, size);
+		mem_dirty_set(area, addr - area->start, size);
+	}
+	
+	return &area->data[addr - area->start];
+}
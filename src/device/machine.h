@@ -9,6 +9,8 @@
 #ifndef MACHINE_H_
 #define MACHINE_H_
 
+#include <time.h>
+#include <sys/types.h>
 
 #include "../mtypes.h"
 #include "../list.h"
@@ -20,6 +22,9 @@
 
 #define DEFAULT_MEMORY_VALUE  0xffffffffU
 
+/** Granularity of the dirty page tracking */
+#define DIRTY_PAGE_SIZE  4096
+
 /*
  * Memory area types
  */
@@ -27,9 +32,20 @@
 typedef enum {
 	MEMT_NONE = 0,  /**< Uninitialized */
 	MEMT_MEM  = 1,  /**< Generic */
-	MEMT_FMAP = 2   /**< File mapped */
+	MEMT_FMAP = 2,  /**< File mapped */
+	MEMT_PMAP = 3   /**< File mapped privately (copy-on-write) */
 } mem_type_t;
 
+/*
+ * Host page backing of generic memory areas
+ */
+
+typedef enum {
+	MEMH_NONE    = 0,  /**< Base pages */
+	MEMH_THP     = 1,  /**< Transparent huge pages */
+	MEMH_HUGETLB = 2   /**< Explicit huge pages */
+} mem_huge_t;
+
 typedef struct {
 	item_t item;
 	
@@ -37,12 +53,27 @@ typedef struct {
 	mem_type_t type;
 	bool writable;
 	
+	/* Host page backing */
+	mem_huge_t huge;
+	
 	/* Basic specification (position and size) */
 	ptr_t start;
 	len_t size;
 	
 	/* Memory content */
 	unsigned char *data;
+	
+	/* File the memory is mapped from (fmap and pmap) */
+	dev_t map_dev;
+	ino_t map_ino;
+	
+	/* Bitmap of the pages written since the last clear */
+	uint32_t *dirty;
+	
+	/* File the dirty pages are relative to (saved last) */
+	char *save_path;
+	uint64_t save_size;
+	time_t save_mtime;
 } mem_area_t;
 
 typedef struct {
@@ -50,6 +81,34 @@ typedef struct {
 	cpu_t *cpu;
 } sc_item_t;
 
+/** Fast mode triggers
+ *
+ * The DTRC and DINT instructions always end the fast mode.
+ *
+ */
+typedef enum {
+	FAST_UNTIL_GUEST,  /**< Only the guest instructions */
+	FAST_UNTIL_PC,     /**< Any processor reaches the address */
+	FAST_UNTIL_CYCLE   /**< Machine cycle count reached */
+} fast_until_t;
+
+/** Timed event handler */
+typedef void (*event_f)(void *data);
+
+/** Timed event
+ *
+ * The event fires once in the machine cycle specified,
+ * the handler can schedule it again.
+ *
+ */
+typedef struct {
+	item_t item;
+	
+	uint64_t cycle;   /**< Machine cycle to fire in */
+	event_f handler;  /**< Event handler */
+	void *data;       /**< Handler argument */
+} event_t;
+
 /** Common variables */
 extern bool totrace;
 extern bool tohalt;
@@ -80,8 +139,14 @@ extern bool remote_gdb_listen;
 extern bool remote_gdb_step;
 
 extern uint32_t stepping;
+extern int exit_code;
+extern uint64_t msteps;
 extern list_t sc_list;
 
+extern bool fast_mode;
+extern fast_until_t fast_until;
+extern uint64_t fast_until_value;
+
 extern void input_back(void);
 
 /*
@@ -92,6 +157,13 @@ extern void init_machine(void);
 extern void done_machine(void);
 extern void go_machine(void);
 extern void machine_step(void);
+extern void machine_fast_leave(const char *reason);
+
+/** Timed events */
+extern void event_init(event_t *event, event_f handler, void *data);
+extern void event_schedule(event_t *event, uint64_t cycle);
+extern void event_cancel(event_t *event);
+extern bool event_scheduled(const event_t *event);
 
 /** Liked Local and Store Conditional control */
 extern void register_sc(cpu_t *cpu);
@@ -102,5 +174,22 @@ extern bool mem_write(cpu_t *cpu, uint32_t addr, uint32_t val,
     size_t size, bool protected_write);
 extern uint32_t mem_read(cpu_t *cpu, uint32_t addr, size_t size,
     bool protected_read);
+extern void mem_read_block(cpu_t *cpu, ptr_t addr, uint32_t *dst,
+    size_t count, bool protected_read);
+extern void mem_write_block(cpu_t *cpu, ptr_t addr, const uint32_t *src,
+    size_t count, bool protected_write);
+extern void mem_copy_block(cpu_t *cpu, ptr_t dst, ptr_t src, size_t count,
+    bool protected_access);
+extern void mem_fill_block(cpu_t *cpu, ptr_t addr, uint32_t val, size_t count,
+    bool protected_write);
+extern unsigned char *mem_direct(ptr_t addr, len_t size, bool write);
+
+/** Dirty page tracking */
+extern void mem_dirty_init(mem_area_t *area);
+extern void mem_dirty_done(mem_area_t *area);
+extern void mem_dirty_set(mem_area_t *area, len_t offset, len_t size);
+extern bool mem_dirty_test(mem_area_t *area, len_t page);
+extern len_t mem_dirty_count(mem_area_t *area);
+extern void mem_dirty_clear(mem_area_t *area);
 
 #endif
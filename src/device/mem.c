@@ -31,6 +31,12 @@
 #include "../io/output.h"
 #include "../utils.h"
 
+/** Granularity of the holes skipped by the save command */
+#define MEM_SAVE_CHUNK  4096
+
+/** Size and alignment of the host huge pages */
+#define MEM_HUGE_PAGE  (2 * 1024 * 1024)
+
 /*
  * Device structure initialization
  */
@@ -39,9 +45,12 @@ static bool mem_init(parm_link_s *parm, device_s *dev);
 static bool mem_info(parm_link_s *parm, device_s *dev);
 static bool mem_generic(parm_link_s *parm, device_s *dev);
 static bool mem_fmap(parm_link_s *parm, device_s *dev);
+static bool mem_pmap(parm_link_s *parm, device_s *dev);
 static bool mem_fill(parm_link_s *parm, device_s *dev);
 static bool mem_load(parm_link_s *parm, device_s *dev);
 static bool mem_save(parm_link_s *parm, device_s *dev);
+static bool mem_stat(parm_link_s *parm, device_s *dev);
+static bool mem_dirty(parm_link_s *parm, device_s *dev);
 
 cmd_s dmem_cmds[] = {
 	{
@@ -72,14 +81,25 @@ cmd_s dmem_cmds[] = {
 		"Configuration information",
 		NOCMD
 	},
+	{
+		"stat",
+		(cmd_f) mem_stat,
+		DEFAULT,
+		DEFAULT,
+		"Statistics",
+		"Statistics",
+		NOCMD
+	},
 	{
 		"generic",
 		(cmd_f) mem_generic,
 		DEFAULT,
 		DEFAULT,
 		"Generic memory type.",
-		"Generic memory type.",
-		REQ INT "size" END
+		"Generic memory type. The huge mode backs the memory by "
+			"the huge pages of the host if available.",
+		REQ INT "size" NEXT
+		OPT STR "mode/huge" END
 	},
 	{
 		"fmap",
@@ -90,6 +110,18 @@ cmd_s dmem_cmds[] = {
 		"Map the memory into the file.",
 		REQ STR "File name" END
 	},
+	{
+		"pmap",
+		(cmd_f) mem_pmap,
+		DEFAULT,
+		DEFAULT,
+		"Map the file into the memory privately.",
+		"Map the file into the memory privately. The pages are "
+			"shared with other mappings of the file until they "
+			"are modified, the modifications are never written "
+			"back to the file.",
+		REQ STR "File name" END
+	},
 	{
 		"fill",
 		(cmd_f) mem_fill,
@@ -114,8 +146,21 @@ cmd_s dmem_cmds[] = {
 		DEFAULT,
 		DEFAULT,
 		"Save the context of the memory into the file specified",
-		"Save the context of the memory into the file specified",
-		REQ STR "File name" END
+		"Save the context of the memory into the file specified. "
+			"The dirty mode updates only the pages written since "
+			"the last save in the file saved previously.",
+		REQ STR "File name" NEXT
+		OPT STR "mode/dirty" END
+	},
+	{
+		"dirty",
+		(cmd_f) mem_dirty,
+		DEFAULT,
+		DEFAULT,
+		"Dump or clear the dirty pages",
+		"Dump the ranges of the pages written since the last save "
+			"or clear, or mark all pages as clean.",
+		OPT STR "clear/clear the dirty pages" END
 	},
 	LAST_CMD
 };
@@ -158,7 +203,14 @@ device_type_s drwm = {
 const char *txt_mem_type[] = {
 	"none",
 	"mem",
-	"fmap"
+	"fmap",
+	"pmap"
+};
+
+static const char *txt_mem_huge[] = {
+	"base",
+	"thp",
+	"hugetlb"
 };
 
 /** Safe munmap
@@ -172,6 +224,271 @@ static void try_munmap(void *ptr, size_t size)
 	}
 }
 
+#ifndef __WIN32__
+
+/** Flags of the anonymous mappings of generic areas */
+static int mem_map_flags(void)
+{
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+	
+#ifdef MAP_NORESERVE
+	flags |= MAP_NORESERVE;
+#endif
+	
+	return flags;
+}
+
+/** Allocate the memory of a generic area backed by huge pages
+ *
+ * Explicit huge pages are tried first. If the host has none
+ * reserved, the memory is aligned to the huge page size and
+ * advised for the transparent huge pages instead.
+ *
+ * @param size Size of the memory
+ * @param huge Backing obtained
+ *
+ * @return Pointer to the memory or NULL if not available
+ *
+ */
+static void *mem_alloc_huge(size_t size, mem_huge_t *huge)
+{
+	void *ptr;
+	
+#ifdef MAP_HUGETLB
+	/*
+	 * The huge pages are reserved in advance (no MAP_NORESERVE),
+	 * otherwise the mapping succeeds even if the host has no huge
+	 * pages and the first touch raises SIGBUS.
+	 */
+	if ((size & (MEM_HUGE_PAGE - 1)) == 0) {
+		ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (ptr != MAP_FAILED) {
+			*huge = MEMH_HUGETLB;
+			return ptr;
+		}
+	}
+#endif
+	
+#ifdef MADV_HUGEPAGE
+	size_t page = (size_t) sysconf(_SC_PAGESIZE);
+	size_t mapped = ALIGN_UP(size, page);
+	size_t length = mapped + MEM_HUGE_PAGE;
+	
+	ptr = mmap(NULL, length, PROT_READ | PROT_WRITE, mem_map_flags(),
+	    -1, 0);
+	if (ptr == MAP_FAILED)
+		return NULL;
+	
+	/* Trim the mapping to the aligned block */
+	uintptr_t start = ALIGN_UP((uintptr_t) ptr, MEM_HUGE_PAGE);
+	size_t head = start - (uintptr_t) ptr;
+	size_t tail = length - head - mapped;
+	
+	if (head > 0)
+		try_munmap(ptr, head);
+	
+	if (tail > 0)
+		try_munmap((void *) (start + mapped), tail);
+	
+	if (madvise((void *) start, mapped, MADV_HUGEPAGE) == 0)
+		*huge = MEMH_THP;
+	
+	return (void *) start;
+#else
+	return NULL;
+#endif
+}
+
+#endif /* __WIN32__ */
+
+/** Allocate the memory of a generic area
+ *
+ * The memory is reserved as anonymous pages, so the host
+ * provides the physical memory only for the pages the guest
+ * actually touches. Untouched pages read as zeros. The memory
+ * is also aligned to the host pages, so the ELF loader can
+ * map the pages of the executable into it.
+ *
+ * @param area Memory area (the size and the backing are set)
+ * @param huge Try to back the memory by huge pages
+ *
+ */
+static void mem_alloc(mem_area_t *area, bool huge)
+{
+	area->huge = MEMH_NONE;
+	
+#ifdef __WIN32__
+	area->data = safe_malloc(area->size);
+#else
+	void *ptr = NULL;
+	
+	if (huge)
+		ptr = mem_alloc_huge(area->size, &area->huge);
+	
+	if (ptr == NULL) {
+		ptr = mmap(NULL, area->size, PROT_READ | PROT_WRITE,
+		    mem_map_flags(), -1, 0);
+		if (ptr == MAP_FAILED)
+			die(ERR_MEM, "Not enough memory");
+	}
+	
+	area->data = (unsigned char *) ptr;
+#endif
+}
+
+/** Release the memory of a generic area
+ *
+ */
+static void mem_free(mem_area_t *area)
+{
+#ifdef __WIN32__
+	safe_free(area->data);
+#else
+	try_munmap(area->data, area->size);
+#endif
+}
+
+/** Zero the memory of a generic area
+ *
+ * The pages are given back to the host instead
+ * of being cleared one by one. Explicit huge pages
+ * are kept and cleared.
+ *
+ */
+static void mem_zero(mem_area_t *area)
+{
+#ifdef __WIN32__
+	memset(area->data, 0, area->size);
+#else
+	if (area->huge == MEMH_HUGETLB) {
+		memset(area->data, 0, area->size);
+		return;
+	}
+	
+	void *ptr = mmap(area->data, area->size, PROT_READ | PROT_WRITE,
+	    mem_map_flags() | MAP_FIXED, -1, 0);
+	if (ptr == MAP_FAILED) {
+		memset(area->data, 0, area->size);
+		return;
+	}
+	
+#ifdef MADV_HUGEPAGE
+	if (area->huge == MEMH_THP)
+		madvise(area->data, area->size, MADV_HUGEPAGE);
+#endif
+#endif
+}
+
+/** Get the size of the memory of an area backed by huge pages
+ *
+ * The transparent huge pages are provided by the host lazily
+ * and might be split later, the current state is reported.
+ *
+ * @param area Memory area
+ * @param size Size of the memory backed by huge pages
+ *
+ * @return false if the size cannot be determined
+ *
+ */
+static bool mem_huge_size(mem_area_t *area, uint64_t *size)
+{
+	*size = 0;
+	
+	switch (area->huge) {
+	case MEMH_NONE:
+		return true;
+	case MEMH_HUGETLB:
+		*size = area->size;
+		return true;
+	case MEMH_THP:
+		break;
+	}
+	
+#ifdef __linux__
+	FILE *file = fopen("/proc/self/smaps", "r");
+	if (file == NULL)
+		return false;
+	
+	uintptr_t start = (uintptr_t) area->data;
+	uintptr_t end = start + area->size;
+	bool inside = false;
+	char line[256];
+	
+	while (fgets(line, sizeof(line), file) != NULL) {
+		unsigned long vma_start;
+		unsigned long vma_end;
+		unsigned long kb;
+		
+		if (sscanf(line, "%lx-%lx ", &vma_start, &vma_end) == 2)
+			inside = ((vma_start < end) && (vma_end > start));
+		else if ((inside)
+		    && (sscanf(line, "AnonHugePages: %lu kB", &kb) == 1))
+			*size += (uint64_t) kb * 1024;
+	}
+	
+	fclose(file);
+	
+	/* Adjacent mappings might be merged with the area */
+	if (*size > area->size)
+		*size = area->size;
+	
+	return true;
+#else
+	return false;
+#endif
+}
+
+/** Test whether a block of memory contains only zeros
+ *
+ */
+static bool mem_is_zero(const unsigned char *data, size_t size)
+{
+	size_t i;
+	
+	for (i = 0; i < size; i++) {
+		if (data[i] != 0)
+			return false;
+	}
+	
+	return true;
+}
+
+/** Forget the file the dirty pages are relative to
+ *
+ */
+static void mem_save_forget(mem_area_t *area)
+{
+	if (area->save_path != NULL) {
+		safe_free(area->save_path);
+		area->save_path = NULL;
+	}
+}
+
+/** Remember the file the dirty pages are relative to
+ *
+ * The size and the modification time of the file are kept,
+ * so that a file changed by somebody else is not updated
+ * incrementally.
+ *
+ * @return true if the file has been remembered
+ *
+ */
+static bool mem_save_track(mem_area_t *area, const char *path)
+{
+	mem_save_forget(area);
+	
+	struct stat st;
+	if (stat(path, &st) == -1)
+		return false;
+	
+	area->save_path = safe_strdup(path);
+	area->save_size = (uint64_t) st.st_size;
+	area->save_mtime = st.st_mtime;
+	
+	return true;
+}
+
 /** Cleanup the memory
  *
  */
@@ -183,13 +500,17 @@ static void mem_cleanup(mem_area_t *area)
 		break;
 	case MEMT_MEM:
 		/* Free old memory block. */
-		safe_free(area->data);
+		mem_free(area);
 		break;
 	case MEMT_FMAP:
+	case MEMT_PMAP:
 		try_munmap(area->data, area->size);
 		break;
 	}
 	
+	mem_dirty_done(area);
+	mem_save_forget(area);
+	
 	area->type = MEMT_NONE;
 	area->size = 0;
 }
@@ -214,10 +535,13 @@ static bool mem_init(parm_link_s *parm, device_s *dev)
 	
 	area->type = MEMT_NONE;
 	area->writable = (dev->type->name == id_rwm);
+	area->huge = MEMH_NONE;
 	
 	area->start = start;
 	area->size = 0;
 	area->data = NULL;
+	area->dirty = NULL;
+	area->save_path = NULL;
 	
 	list_append(&mem_areas, &area->item);
 	dev->data = area;
@@ -243,6 +567,29 @@ static bool mem_info(parm_link_s *parm, device_s *dev)
 	return true;
 }
 
+/** Stat command implementation
+ *
+ * Print the host page backing of the memory.
+ *
+ */
+static bool mem_stat(parm_link_s *parm, device_s *dev)
+{
+	mem_area_t *area = (mem_area_t *) dev->data;
+	uint64_t huge_size;
+	
+	mprintf("Backing Huge pages\n");
+	mprintf("------- ------------\n");
+	
+	if (mem_huge_size(area, &huge_size)) {
+		char *size = uint32_human_readable((uint32_t) huge_size);
+		mprintf("%-7s %12s\n", txt_mem_huge[area->huge], size);
+		safe_free(size);
+	} else
+		mprintf("%-7s %12s\n", txt_mem_huge[area->huge], "unknown");
+	
+	return true;
+}
+
 /** Load command implementation
  *
  * Load the contents of the file specified to the memory block.
@@ -304,6 +651,8 @@ static bool mem_load(parm_link_s *parm, device_s *dev)
 		return false;
 	}
 	
+	mem_dirty_set(area, 0, fsize);
+	
 	if (!try_fclose(file, path)) {
 		mprintf("%s\n", txt_file_close_err);
 		return false;
@@ -350,20 +699,26 @@ static bool mem_fill(parm_link_s *parm, device_s *dev)
 		break;
 	}
 	
-	memset(area->data, c, area->size);
+	if ((c == 0) && (area->type == MEMT_MEM))
+		mem_zero(area);
+	else
+		memset(area->data, c, area->size);
+	
+	mem_dirty_set(area, 0, area->size);
 	return true;
 }
 
-/** Fmap command implementation
+/** Map the memory block to a file
  *
- * Map memory to a file. Allocated memory block is disposed. When the file
- * size is less than memory size it is enlarged.
+ * A shared mapping writes the modifications of a read/write memory
+ * back to the file. A private mapping is always writable on the
+ * host side, the modified pages are copied and the file is never
+ * changed. The guest write protection of a read-only memory is
+ * handled by the simulator.
  *
  */
-static bool mem_fmap(parm_link_s *parm, device_s *dev)
+static bool mem_map_file(mem_area_t *area, const char *path, bool priv)
 {
-	mem_area_t *area = (mem_area_t *) dev->data;
-	const char *const path = parm_str(parm);
 	FILE *file;
 	
 	if (area->type != MEMT_NONE) {
@@ -372,7 +727,7 @@ static bool mem_fmap(parm_link_s *parm, device_s *dev)
 	}
 	
 	/* Open the file */
-	if (area->writable)
+	if ((area->writable) && (!priv))
 		file = try_fopen(path, "rb+");
 	else
 		file = try_fopen(path, "rb");
@@ -418,8 +773,18 @@ static bool mem_fmap(parm_link_s *parm, device_s *dev)
 	int fd = fileno(file);
 	void *ptr;
 	
+	/* Identify the file for the save command */
+	struct stat st;
+	if (fstat(fd, &st) == -1) {
+		io_error(path);
+		try_soft_fclose(file, path);
+		return false;
+	}
+	
 	/* File mapping */
-	if (area->writable)
+	if (priv)
+		ptr = mmap(0, fsize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	else if (area->writable)
 		ptr = mmap(0, fsize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
 	else
 		ptr = mmap(0, fsize, PROT_READ, MAP_SHARED, fd, 0);
@@ -438,13 +803,37 @@ static bool mem_fmap(parm_link_s *parm, device_s *dev)
 	}
 	
 	/* Upgrade structure */
-	area->type = MEMT_FMAP;
+	area->type = priv ? MEMT_PMAP : MEMT_FMAP;
 	area->size = fsize;
 	area->data = (unsigned char *) ptr;
+	area->map_dev = st.st_dev;
+	area->map_ino = st.st_ino;
+	mem_dirty_init(area);
 	
 	return true;
 }
 
+/** Fmap command implementation
+ *
+ * Map memory to a file. Allocated memory block is disposed. When the file
+ * size is less than memory size it is enlarged.
+ *
+ */
+static bool mem_fmap(parm_link_s *parm, device_s *dev)
+{
+	return mem_map_file((mem_area_t *) dev->data, parm_str(parm), false);
+}
+
+/** Pmap command implementation
+ *
+ * Map memory to a file privately (copy-on-write).
+ *
+ */
+static bool mem_pmap(parm_link_s *parm, device_s *dev)
+{
+	return mem_map_file((mem_area_t *) dev->data, parm_str(parm), true);
+}
+
 /** Generic command implementation
  *
  * Generic command makes memory device a standard memory.
@@ -454,12 +843,23 @@ static bool mem_generic(parm_link_s *parm, device_s *dev)
 {
 	mem_area_t *area = (mem_area_t *) dev->data;
 	uint32_t size = parm_int(parm);
+	bool huge = false;
 	
 	if (area->type != MEMT_NONE) {
 		/* Illegal. */
 		return false;
 	}
 	
+	parm_next(&parm);
+	if (parm_type(parm) == tt_str) {
+		if (strcmp(parm_str(parm), "huge") != 0) {
+			mprintf("Unknown memory mode, huge expected\n");
+			return false;
+		}
+		
+		huge = true;
+	}
+	
 	/* Test parameter */
 	if (!addr_word_aligned(size)) {
 		mprintf("Memory size must be 4-byte aligned\n");
@@ -478,45 +878,287 @@ static bool mem_generic(parm_link_s *parm, device_s *dev)
 	
 	area->type = MEMT_MEM;
 	area->size = size;
-	area->data = safe_malloc(size);
+	mem_alloc(area, huge);
+	mem_dirty_init(area);
 	
 	return true;
 }
 
+/** Save the whole memory to a file
+ *
+ * The file is closed on failure.
+ *
+ */
+static bool mem_save_full(mem_area_t *area, FILE *file, const char *path)
+{
+	/*
+	 * Chunks containing only zeros are skipped, so the holes
+	 * of a sparse memory stay holes in the file as well.
+	 */
+	bool hole = false;
+	len_t offset;
+	
+	for (offset = 0; offset < area->size; offset += MEM_SAVE_CHUNK) {
+		size_t chunk = area->size - offset;
+		if (chunk > MEM_SAVE_CHUNK)
+			chunk = MEM_SAVE_CHUNK;
+		
+		if (mem_is_zero(area->data + offset, chunk)) {
+			hole = true;
+			continue;
+		}
+		
+		if ((hole) && (!try_fseek(file, offset, SEEK_SET, path))) {
+			mprintf("%s\n", txt_file_seek_err);
+			try_soft_fclose(file, path);
+			return false;
+		}
+		
+		hole = false;
+		
+		size_t wr = fwrite(area->data + offset, 1, chunk, file);
+		if (wr != chunk) {
+			io_error(path);
+			try_soft_fclose(file, path);
+			mprintf("%s\n", txt_file_write_err);
+			return false;
+		}
+	}
+	
+	/* Extend the file over the trailing hole */
+	if (hole) {
+		if (!try_fseek(file, area->size - 1, SEEK_SET, path)) {
+			mprintf("%s\n", txt_file_seek_err);
+			try_soft_fclose(file, path);
+			return false;
+		}
+		
+		if (fputc(0, file) == EOF) {
+			io_error(path);
+			try_soft_fclose(file, path);
+			mprintf("%s\n", txt_file_write_err);
+			return false;
+		}
+	}
+	
+	return true;
+}
+
+/** Save the dirty pages of the memory to a file
+ *
+ * The other pages of the file are expected to hold
+ * the contents saved previously. The file is closed
+ * on failure.
+ *
+ */
+static bool mem_save_dirty(mem_area_t *area, FILE *file, const char *path)
+{
+	len_t offset;
+	
+	for (offset = 0; offset < area->size; offset += DIRTY_PAGE_SIZE) {
+		if (!mem_dirty_test(area, offset / DIRTY_PAGE_SIZE))
+			continue;
+		
+		size_t chunk = area->size - offset;
+		if (chunk > DIRTY_PAGE_SIZE)
+			chunk = DIRTY_PAGE_SIZE;
+		
+		if (!try_fseek(file, offset, SEEK_SET, path)) {
+			mprintf("%s\n", txt_file_seek_err);
+			try_soft_fclose(file, path);
+			return false;
+		}
+		
+		size_t wr = fwrite(area->data + offset, 1, chunk, file);
+		if (wr != chunk) {
+			io_error(path);
+			try_soft_fclose(file, path);
+			mprintf("%s\n", txt_file_write_err);
+			return false;
+		}
+	}
+	
+	return true;
+}
+
+/** Check whether a file is the one the memory is mapped from
+ *
+ * Saving the memory to that file would truncate the file
+ * under the mapping (and the sparse save reads the memory
+ * while it is being truncated).
+ *
+ */
+static bool mem_save_backing(mem_area_t *area, const char *path)
+{
+#ifndef __WIN32__
+	if ((area->type != MEMT_FMAP) && (area->type != MEMT_PMAP))
+		return false;
+	
+	struct stat st;
+	if (stat(path, &st) == -1)
+		return false;
+	
+	return ((st.st_dev == area->map_dev) && (st.st_ino == area->map_ino));
+#else
+	/* Mapped files cannot be truncated */
+	return false;
+#endif
+}
+
+/** Open a file previously saved for an incremental save
+ *
+ * The dirty pages are relative to the file saved last,
+ * so only that file can be updated incrementally.
+ *
+ * @return File or NULL if the file is not the one saved last
+ *         or it has been changed since.
+ *
+ */
+static FILE *mem_save_reopen(mem_area_t *area, const char *path)
+{
+	if ((area->save_path == NULL) || (strcmp(area->save_path, path) != 0))
+		return NULL;
+	
+	struct stat st;
+	if ((stat(path, &st) == -1) ||
+	    ((uint64_t) st.st_size != area->save_size) ||
+	    (st.st_mtime != area->save_mtime))
+		return NULL;
+	
+	return fopen(path, "rb+");
+}
+
 /** Save command implementation
  *
- * Save the content of the memory to the file specified.
+ * Save the content of the memory to the file specified. In the dirty
+ * mode only the pages written since the last save are updated in the
+ * file (the whole memory is saved if the file is not the one saved
+ * last or it has been changed since). The dirty pages are cleared
+ * only when they become relative to the file saved.
  *
  */
 static bool mem_save(parm_link_s *parm, device_s *dev)
 {
 	mem_area_t *area = (mem_area_t *) dev->data;
 	const char *const path = parm_str(parm);
+	bool incremental = false;
+	
+	parm_next(&parm);
+	if (parm_type(parm) == tt_str) {
+		if (strcmp(parm_str(parm), "dirty") != 0) {
+			mprintf("Unknown save mode, dirty expected\n");
+			return false;
+		}
+		
+		incremental = true;
+	}
 	
 	/* Do not write anything
 	   if the memory is not inicialized */
 	if (area->type == MEMT_NONE)
 		return true;
 	
-	FILE *file = try_fopen(path, "wb");
-	if (file == NULL) {
-		mprintf("%s\n", txt_file_create_err);
+	if (mem_save_backing(area, path)) {
+		mprintf("Cannot save the memory to the file it is mapped from\n");
 		return false;
 	}
 	
-	size_t wr = fwrite(area->data, 1, area->size, file);
-	if (wr != area->size) {
-		io_error(path);
-		try_soft_fclose(file, path);
-		mprintf("%s\n", txt_file_write_err);
+	/*
+	 * A full save to another file than the one saved last
+	 * keeps the dirty pages of the incremental saves, unless
+	 * nothing has been saved yet or the dirty mode has been
+	 * requested.
+	 */
+	bool track = (incremental) || (area->save_path == NULL) ||
+	    (strcmp(area->save_path, path) == 0);
+	
+	FILE *file = NULL;
+	bool saved;
+	
+	if (incremental)
+		file = mem_save_reopen(area, path);
+	
+	if (file != NULL)
+		saved = mem_save_dirty(area, file, path);
+	else {
+		file = try_fopen(path, "wb");
+		if (file == NULL) {
+			mprintf("%s\n", txt_file_create_err);
+			return false;
+		}
+		
+		saved = mem_save_full(area, file, path);
+	}
+	
+	if (!saved) {
+		if (track)
+			mem_save_forget(area);
+		
 		return false;
 	}
 	
 	if (!try_fclose(file, path)) {
 		mprintf("%s\n", txt_file_close_err);
+		
+		if (track)
+			mem_save_forget(area);
+		
 		return false;
 	}
 	
+	if ((track) && (mem_save_track(area, path)))
+		mem_dirty_clear(area);
+	
+	return true;
+}
+
+/** Dirty command implementation
+ *
+ * Dump the ranges of the dirty pages or clear them.
+ *
+ */
+static bool mem_dirty(parm_link_s *parm, device_s *dev)
+{
+	mem_area_t *area = (mem_area_t *) dev->data;
+	
+	if (parm_type(parm) == tt_str) {
+		if (strcmp(parm_str(parm), "clear") != 0) {
+			mprintf("Unknown argument, clear expected\n");
+			return false;
+		}
+		
+		mem_dirty_clear(area);
+		return true;
+	}
+	
+	len_t pages = (area->size + DIRTY_PAGE_SIZE - 1) / DIRTY_PAGE_SIZE;
+	len_t page = 0;
+	
+	mprintf("Start      End        Pages\n");
+	mprintf("---------- ---------- ----------\n");
+	
+	while (page < pages) {
+		if (!mem_dirty_test(area, page)) {
+			page++;
+			continue;
+		}
+		
+		len_t first = page;
+		while ((page < pages) && (mem_dirty_test(area, page)))
+			page++;
+		
+		uint64_t end = (uint64_t) page * DIRTY_PAGE_SIZE;
+		if (end > area->size)
+			end = area->size;
+		
+		mprintf("%#10" PRIx32 " %#10" PRIx32 " %10" PRIu32 "\n",
+		    area->start + first * DIRTY_PAGE_SIZE,
+		    (uint32_t) (area->start + end - 1), page - first);
+	}
+	
+	mprintf("Dirty pages: %" PRIu32 " of %" PRIu32 "\n",
+	    mem_dirty_count(area), pages);
+	
 	return true;
 }
 
@@ -19,6 +19,7 @@
 #include "parser.h"
 #include "io/output.h"
 #include "cpu/instr.h"
+#include "debug/semihost.h"
 #include "check.h"
 #include "utils.h"
 
@@ -202,6 +203,16 @@ const set_t env_set[] =	{
 		&totrace,
 		NULL
 	},
+	{
+		"semihost",
+		"Set the semihosting sandbox directory",
+		"The DSYS instruction lets the simulated software open, read, write "
+			"and seek host files in this directory. The file access is "
+			"disabled until the directory is set.",
+		vt_str,
+		&semihost_dir,
+		semihost_set_dir
+	},
 	LAST_ENV
 };
 
@@ -244,7 +255,8 @@ static void print_all_variables(void)
 				mprintf("%d", *(int *) s->val);
 				break;
 			case vt_str:
-				mprintf("%s", *(const char *) s->val);
+				mprintf("%s", (*(const char **) s->val != NULL) ?
+				    *(const char **) s->val : "");
 				break;
 			case vt_bool:
 				mprintf("%s", *(bool *) s->val ? "on" : "off");
@@ -16,6 +16,7 @@
 #include <readline/readline.h>
 #include <readline/history.h>
 #include "../arch/console.h"
+#include "../arch/stdin.h"
 #include "../device/machine.h"
 #include "../check.h"
 #include "../parser.h"
@@ -151,6 +152,9 @@ void interactive_control(void)
 	
 	stepping = 0;
 	
+	/* The standard input belongs to the command line now */
+	stdin_pause();
+	
 	while (interactive) {
 		input_back();
 		commline = readline("[msim] ");
@@ -171,4 +175,6 @@ void interactive_control(void)
 		
 		free(commline);
 	}
+	
+	stdin_resume();
 }
@@ -86,3 +86,35 @@ void list_remove(list_t *list, item_t *item)
 	else
 		item->next->prev = item->prev;
 }
+
+/** Insert an item before another item of a list
+ *
+ * @param list The list to insert to.
+ * @param item The item to insert.
+ * @param next The item to insert before or NULL to append.
+ *
+ */
+void list_insert_before(list_t *list, item_t *item, item_t *next)
+{
+	if (next == NULL) {
+		list_append(list, item);
+		return;
+	}
+	
+	/* Make sure the item is not a member of a list
+	   and the next item is a member of our list. */
+	PRE(item->list == NULL);
+	PRE(next->list == list);
+	item->list = list;
+	
+	/* Link us between the previous and the next item. */
+	item->prev = next->prev;
+	item->next = next;
+	
+	if (next->prev == NULL)
+		list->head = item;
+	else
+		next->prev->next = item;
+	
+	next->prev = item;
+}
@@ -70,6 +70,12 @@ static struct option long_options[] = {
 		0,
 		'g'
 	},
+	{
+		"fast-until",
+		required_argument,
+		0,
+		'F'
+	},
 	{ NULL, 0, NULL, 0 }
 };
 
@@ -91,6 +97,43 @@ static void conf_remote_gdb(const char *opt)
 }
 
 
+/** Parse the fast mode trigger
+ *
+ * The trigger is "pc=address", "cycle=count" or "guest"
+ * (only the DTRC and DINT instructions end the fast mode).
+ *
+ */
+static void conf_fast_until(const char *opt)
+{
+	const char *value = NULL;
+	
+	if (strcmp(opt, "guest") == 0) {
+		fast_until = FAST_UNTIL_GUEST;
+		fast_mode = true;
+		return;
+	}
+	
+	if (strncmp(opt, "pc=", 3) == 0) {
+		fast_until = FAST_UNTIL_PC;
+		value = opt + 3;
+	} else if (strncmp(opt, "cycle=", 6) == 0) {
+		fast_until = FAST_UNTIL_CYCLE;
+		value = opt + 6;
+	} else
+		die(ERR_PARM, "Fast mode trigger pc=address, cycle=count or guest expected.");
+	
+	char *endp;
+	fast_until_value = strtoull(value, &endp, 0);
+	if ((*value == 0) || (*endp != 0))
+		die(ERR_PARM, "Invalid fast mode trigger value.");
+	
+	if ((fast_until == FAST_UNTIL_PC) && (fast_until_value > UINT32_MAX))
+		die(ERR_PARM, "Fast mode trigger address out of range.");
+	
+	fast_mode = true;
+}
+
+
 static void parse_cmdline(int argc, char *args[])
 {
 	int c;
@@ -100,7 +143,7 @@ static void parse_cmdline(int argc, char *args[])
 	while (1) {
 		int option_index = 0;
 	
-		c = getopt_long( argc, args, "tVic:hg:",
+		c = getopt_long( argc, args, "tVic:hg:F:",
 			long_options, &option_index);
 	
 		if (c == -1)
@@ -130,6 +173,9 @@ static void parse_cmdline(int argc, char *args[])
 		case 'g':
 			conf_remote_gdb(optarg);
 			break;
+		case 'F':
+			conf_fast_until(optarg);
+			break;
 		case '?':
 			die(ERR_PARM, "Unknown parameter or argument required\n");
 		default:
@@ -152,5 +198,5 @@ int main(int argc, char *args[])
 	go_machine();
 	done_machine();
 
-	return 0;
+	return exit_code;
 }
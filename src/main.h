@@ -9,7 +9,7 @@
 #ifndef MAIN_H_
 #define MAIN_H_
 
-#define MAX_CPU  31
+#define MAX_CPU  256
 
 #define SETUP_BUF_SIZE   65536
 
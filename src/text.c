@@ -86,6 +86,8 @@ const char txt_help[] =
 	"  -c, --config=file_name   configuration file name\n"
 	"  -i, --interactive        enter interactive mode\n"
 	"  -t, --trace              enter trace mode\n"
-	"  -g, --remote-gdb=port    enter gdb mode\n";
+	"  -g, --remote-gdb=port    enter gdb mode\n"
+	"  -F, --fast-until=trigger run uninstrumented until the trigger\n"
+	"                           (pc=address, cycle=count or guest)\n";
 
 const char hexchar[] = "0123456789abcdef";